@@ -0,0 +1,213 @@
+/**
+ * index_lookup.cpp
+ * Look up the documents containing all the given terms in the output of the index job.
+ *
+ * Usage: index_lookup <index_file> <term>...
+ * The index_file is the sdfs_dest file of the index job, the term dictionaries and posting lists it lists are read
+ * from the current directory, so get them from the sdfs first. Prints the matching document ids in order, and their
+ * number to stderr.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+/// The partition of a term, the same FNV-1a hash as in the index job.
+uint64_t index_term_hash(const string &term) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : term) h = (h ^ c) * 1099511628211ULL;
+    return h;
+}
+
+/// The number of postings in a block, the same as in the index job.
+const uint64_t BLOCK_POSTINGS = 128;
+
+/**
+ * Cursor over a posting list, skipping the blocks whose last document is below the target without decoding them.
+ */
+class PostingCursor {
+public:
+    explicit PostingCursor(const string &bytes) : bytes(bytes) {
+        read_varint(documents_left);
+        num_documents = documents_left;
+    }
+
+    /**
+     * Move to the first document not below the target.
+     *
+     * Returns:
+     *      Return false if there is no such document.
+     */
+    bool advance_to(uint64_t target, uint64_t &document) {
+        /// The cursor stays on its document until a target above it.
+        if (positioned && current >= target) {
+            document = current;
+            return true;
+        }
+        while (true) {
+            if (block_documents_left > 0) {
+                if (block_last < target) {
+                    position = block_end;
+                    block_documents_left = 0;
+                    continue;
+                }
+                while (block_documents_left > 0) {
+                    uint64_t gap = 0;
+                    read_varint(gap);
+                    current += gap;
+                    block_documents_left--;
+                    if (current >= target) {
+                        positioned = true;
+                        document = current;
+                        return true;
+                    }
+                }
+            } else if (!load_block()) {
+                return false;
+            }
+        }
+    }
+
+    uint64_t num_documents = 0;
+
+private:
+    /// Positions are offsets into bytes, so a cursor can be moved.
+    string bytes;
+    size_t position = 0, block_end = 0;
+    uint64_t documents_left = 0, block_documents_left = 0, block_last = 0, current = 0;
+    bool positioned = false;
+
+    bool read_varint(uint64_t &value) {
+        value = 0;
+        for (int shift = 0; position < bytes.size() && shift < 64; shift += 7) {
+            unsigned char byte = (unsigned char) bytes[position++];
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool load_block() {
+        uint64_t last_gap = 0, length = 0;
+        if (documents_left == 0 || !read_varint(last_gap) || !read_varint(length)) return false;
+        current = block_last;
+        block_last += last_gap;
+        block_end = position + length;
+        block_documents_left = min(BLOCK_POSTINGS, documents_left);
+        documents_left -= block_documents_left;
+        return true;
+    }
+};
+
+/// An entry of a term dictionary.
+class TermEntry {
+public:
+    string term;
+    uint64_t offset = 0, length = 0;
+};
+
+/**
+ * Load the term dictionary of a partition, the index job writes it sorted by term.
+ */
+vector<TermEntry> load_term_dictionary(const string &terms_file) {
+    ifstream terms(terms_file);
+    vector<TermEntry> dictionary;
+    string line;
+    uint64_t num_documents = 0;
+    while (getline(terms, line)) {
+        stringstream ss(line);
+        TermEntry entry;
+        if (ss >> entry.term >> num_documents >> entry.offset >> entry.length) dictionary.push_back(entry);
+    }
+    return dictionary;
+}
+
+/**
+ * Read the posting list of a term from its partition, the dictionary of a partition is loaded once and binary
+ * searched for each of its terms.
+ *
+ * Returns:
+ *      Return false if the term is not in the index.
+ */
+bool read_posting_list(const vector<pair<string, string>> &partitions, map<size_t, vector<TermEntry>> &dictionaries,
+                       const string &term, string &bytes) {
+    size_t partition = index_term_hash(term) % partitions.size();
+    auto it = dictionaries.find(partition);
+    if (it == dictionaries.end())
+        it = dictionaries.emplace(partition, load_term_dictionary(partitions[partition].first)).first;
+    const vector<TermEntry> &dictionary = it->second;
+    auto entry = lower_bound(dictionary.begin(), dictionary.end(), term,
+                             [](const TermEntry &a, const string &b) { return a.term < b; });
+    if (entry == dictionary.end() || entry->term != term) return false;
+    ifstream postings(partitions[partition].second, ifstream::binary);
+    bytes.resize(entry->length);
+    postings.seekg((streamoff) entry->offset);
+    return (bool) postings.read(&bytes[0], (streamsize) entry->length);
+}
+
+int main(int argc, char *argv[]) {
+    ios_base::sync_with_stdio(false);
+    if (argc < 3) {
+        cerr << "Usage: index_lookup <index_file> <term>..." << endl;
+        return 1;
+    }
+
+    ifstream index_file(argv[1]);
+    string header, terms_file, postings_file;
+    int num_partitions = 0;
+    index_file >> header >> num_partitions;
+    vector<pair<string, string>> partitions;
+    while (index_file >> terms_file >> postings_file) partitions.emplace_back(terms_file, postings_file);
+    if (header != "partitions" || num_partitions <= 0 || (int) partitions.size() != num_partitions) {
+        cerr << argv[1] << " is not an index file" << endl;
+        return 1;
+    }
+
+    /// Intersect the shortest lists first, each candidate document makes the other cursors skip up to it.
+    vector<PostingCursor> cursors;
+    map<size_t, vector<TermEntry>> dictionaries;
+    for (int i = 2; i < argc; i++) {
+        string bytes;
+        if (!read_posting_list(partitions, dictionaries, argv[i], bytes)) {
+            cerr << "0 documents" << endl;
+            return 0;
+        }
+        cursors.emplace_back(bytes);
+    }
+    sort(cursors.begin(), cursors.end(), [](const PostingCursor &a, const PostingCursor &b) {
+        return a.num_documents < b.num_documents;
+    });
+
+    uint64_t target = 0, document = 0, num_matches = 0;
+    bool exhausted = false;
+    while (!exhausted && cursors[0].advance_to(target, document)) {
+        bool matched = true;
+        for (size_t i = 1; i < cursors.size(); i++) {
+            uint64_t other = 0;
+            if (!cursors[i].advance_to(document, other)) {
+                exhausted = true;
+                matched = false;
+                break;
+            }
+            if (other != document) {
+                target = other;
+                matched = false;
+                break;
+            }
+        }
+        if (matched) {
+            cout << document << "\n";
+            num_matches++;
+            target = document + 1;
+        }
+    }
+    cerr << num_matches << " documents" << endl;
+    return 0;
+}
@@ -0,0 +1,395 @@
+/**
+ * mj_sdk.h
+ * Header-only kit for maple and juice executables, needs C++17.
+ *
+ * A maple or juice executable reads lines from stdin and writes lines to stdout. The getline, stringstream and
+ * std::map path copies every line and field and allocates a node per key, this kit avoids all three:
+ *      RecordReader    lines as string_views into a large buffer, or into the mapped input when stdin is a file
+ *      RecordWriter    buffered output with integer formatting, written out with write(2) in large chunks
+ *      next_field      whitespace field splitting over string_views
+ *      Arena           bump allocator for keys that must outlive the input buffer
+ *      HashAggregator  open-addressing hash map from string_view keys to values, keys copied into an arena
+ *      for_each_group  groups of consecutive lines with the same key, for input sorted by key
+ */
+
+#ifndef MJ_SDK_H
+#define MJ_SDK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace mj {
+
+/// The size of the read and write buffers.
+constexpr size_t BUFFER_BYTES = 1 << 20;
+
+/// The size of an arena chunk, a larger key gets a chunk of its own.
+constexpr size_t ARENA_CHUNK_BYTES = 1 << 20;
+
+/**
+ * Reads the lines of a file descriptor. A regular file or memfd, as maple gets its input, is mapped and its lines
+ * are views into the mapping. A pipe, as juice gets its input, is read in large chunks and a line is a view into the
+ * buffer, valid until the next call of next.
+ */
+class RecordReader {
+public:
+    explicit RecordReader(int fd = 0) : fd(fd) {
+        struct stat file_stat{};
+        if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+            void *region = mmap(nullptr, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (region != MAP_FAILED) {
+                mapped = (const char *) region;
+                mapped_size = (size_t) file_stat.st_size;
+                madvise(region, mapped_size, MADV_SEQUENTIAL);
+                data = mapped;
+                end = mapped_size;
+                eof = true;
+            }
+        }
+        if (mapped == nullptr) {
+            buffer.resize(BUFFER_BYTES);
+            data = buffer.data();
+        }
+    }
+
+    ~RecordReader() {
+        if (mapped != nullptr) munmap((void *) mapped, mapped_size);
+    }
+
+    RecordReader(const RecordReader &) = delete;
+
+    RecordReader &operator=(const RecordReader &) = delete;
+
+    /**
+     * Move to the next line, without its newline.
+     *
+     * Returns:
+     *      Return false at the end of the input.
+     */
+    bool next(std::string_view &line) {
+        while (true) {
+            const char *newline = (const char *) memchr(data + begin, '\n', end - begin);
+            if (newline != nullptr) {
+                size_t line_end = (size_t) (newline - data);
+                line = std::string_view(data + begin, line_end - begin);
+                begin = line_end + 1;
+                return true;
+            }
+            if (eof) {
+                /// The last line may have no newline.
+                if (begin == end) return false;
+                line = std::string_view(data + begin, end - begin);
+                begin = end;
+                return true;
+            }
+            fill();
+        }
+    }
+
+private:
+    int fd;
+    const char *mapped = nullptr;
+    size_t mapped_size = 0;
+    std::vector<char> buffer;
+    const char *data = nullptr;
+    size_t begin = 0, end = 0;
+    bool eof = false;
+
+    /// Move the partial line to the front, grow the buffer if the line fills it, and read after it.
+    void fill() {
+        if (begin > 0) {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+        data = buffer.data();
+        ssize_t num_read;
+        do {
+            num_read = read(fd, buffer.data() + end, buffer.size() - end);
+        } while (num_read < 0 && errno == EINTR);
+        if (num_read <= 0) eof = true;
+        else end += (size_t) num_read;
+    }
+};
+
+/**
+ * Buffered writer of a file descriptor, flushed when full and when destroyed.
+ */
+class RecordWriter {
+public:
+    explicit RecordWriter(int fd = 1) : fd(fd), buffer(BUFFER_BYTES) {}
+
+    ~RecordWriter() { flush(); }
+
+    RecordWriter(const RecordWriter &) = delete;
+
+    RecordWriter &operator=(const RecordWriter &) = delete;
+
+    RecordWriter &write(std::string_view text) {
+        if (size + text.size() > buffer.size()) {
+            flush();
+            if (text.size() > buffer.size()) {
+                write_fully(text.data(), text.size());
+                return *this;
+            }
+        }
+        memcpy(buffer.data() + size, text.data(), text.size());
+        size += text.size();
+        return *this;
+    }
+
+    RecordWriter &put(char c) {
+        if (size == buffer.size()) flush();
+        buffer[size++] = c;
+        return *this;
+    }
+
+    /// Integers are formatted with to_chars straight into the buffer.
+    template<typename T>
+    RecordWriter &write_number(T value) {
+        if (size + 24 > buffer.size()) flush();
+        char *last = std::to_chars(buffer.data() + size, buffer.data() + buffer.size(), value).ptr;
+        size = (size_t) (last - buffer.data());
+        return *this;
+    }
+
+    /// Write "<key>\t<value>\n" for an integer value.
+    template<typename T>
+    RecordWriter &write_pair(std::string_view key, T value) {
+        write(key).put('\t').write_number(value);
+        return put('\n');
+    }
+
+    void flush() {
+        write_fully(buffer.data(), size);
+        size = 0;
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t size = 0;
+
+    void write_fully(const char *bytes, size_t length) {
+        while (length > 0) {
+            ssize_t num_written = ::write(fd, bytes, length);
+            if (num_written < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            bytes += num_written;
+            length -= (size_t) num_written;
+        }
+    }
+};
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+/**
+ * Take the next whitespace separated field off the front of rest.
+ *
+ * Returns:
+ *      Return false if rest has no more fields.
+ */
+inline bool next_field(std::string_view &rest, std::string_view &field) {
+    size_t begin = 0;
+    while (begin < rest.size() && is_space(rest[begin])) begin++;
+    if (begin == rest.size()) {
+        rest = std::string_view();
+        return false;
+    }
+    size_t end = begin;
+    while (end < rest.size() && !is_space(rest[end])) end++;
+    field = rest.substr(begin, end - begin);
+    rest.remove_prefix(end);
+    return true;
+}
+
+/**
+ * Parse a whole field as an integer.
+ *
+ * Returns:
+ *      Return false if the field is not an integer.
+ */
+template<typename T>
+bool parse_number(std::string_view field, T &value) {
+    const char *first = field.data(), *last = field.data() + field.size();
+    if (first != last && *first == '+') first++;
+    auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+/**
+ * Bump allocator, everything is freed at once by clear or by the destructor. Clear keeps the first chunk, so an arena
+ * reused for every group does not allocate again.
+ */
+class Arena {
+public:
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    std::string_view copy(std::string_view text) {
+        if (text.size() > chunk_left) {
+            size_t chunk_bytes = std::max(ARENA_CHUNK_BYTES, text.size());
+            chunks.push_back({std::unique_ptr<char[]>(new char[chunk_bytes]), chunk_bytes});
+            position = chunks.back().bytes.get();
+            chunk_left = chunk_bytes;
+        }
+        memcpy(position, text.data(), text.size());
+        std::string_view result(position, text.size());
+        position += text.size();
+        chunk_left -= text.size();
+        return result;
+    }
+
+    void clear() {
+        if (chunks.size() > 1) chunks.resize(1);
+        position = chunks.empty() ? nullptr : chunks[0].bytes.get();
+        chunk_left = chunks.empty() ? 0 : chunks[0].size;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> bytes;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    char *position = nullptr;
+    size_t chunk_left = 0;
+};
+
+/// FNV-1a followed by the murmur3 finalizer, so that the low bits used by the hash tables depend on every byte.
+inline uint64_t hash_key(std::string_view key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) h = (h ^ c) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Open-addressing hash map with linear probing from string_view keys to values. A new key is copied into the arena
+ * of the map, so the key passed in may point into the input buffer. The table doubles at 70% load.
+ */
+template<typename V>
+class HashAggregator {
+public:
+    explicit HashAggregator(size_t initial_capacity = 1024) {
+        size_t capacity = 16;
+        while (capacity < initial_capacity) capacity *= 2;
+        slots.resize(capacity);
+    }
+
+    /// The value of a key, value initialized on its first use.
+    V &operator[](std::string_view key) {
+        if ((num_keys + 1) * 10 > slots.size() * 7) grow();
+        uint64_t hash = hash_key(key);
+        size_t mask = slots.size() - 1;
+        for (size_t index = hash & mask;; index = (index + 1) & mask) {
+            Slot &slot = slots[index];
+            if (!slot.used) {
+                slot.used = true;
+                slot.hash = hash;
+                slot.key = arena.copy(key);
+                slot.value = V();
+                num_keys++;
+                return slot.value;
+            }
+            if (slot.hash == hash && slot.key == key) return slot.value;
+        }
+    }
+
+    size_t size() const { return num_keys; }
+
+    /// Call f(key, value) for every key, in no particular order.
+    template<typename F>
+    void for_each(F f) {
+        for (auto &slot : slots)
+            if (slot.used) f(slot.key, slot.value);
+    }
+
+    /// Call f(key, value) for every key, in the order of the keys.
+    template<typename F>
+    void for_each_sorted(F f) {
+        std::vector<Slot *> used;
+        used.reserve(num_keys);
+        for (auto &slot : slots)
+            if (slot.used) used.push_back(&slot);
+        std::sort(used.begin(), used.end(), [](const Slot *a, const Slot *b) { return a->key < b->key; });
+        for (Slot *slot : used) f(slot->key, slot->value);
+    }
+
+private:
+    struct Slot {
+        bool used = false;
+        uint64_t hash = 0;
+        std::string_view key;
+        V value{};
+    };
+
+    std::vector<Slot> slots;
+    size_t num_keys = 0;
+    Arena arena;
+
+    void grow() {
+        std::vector<Slot> old_slots(slots.size() * 2);
+        old_slots.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (auto &slot : old_slots) {
+            if (!slot.used) continue;
+            size_t index = slot.hash & mask;
+            while (slots[index].used) index = (index + 1) & mask;
+            slots[index] = std::move(slot);
+        }
+    }
+};
+
+/**
+ * Call f(key, values) for every run of consecutive lines with the same first field, so input sorted by key, such as
+ * a juice input merged by sort, is reduced one key at a time without a map. The values are the rest of each line
+ * after the key, and stay valid until f returns.
+ */
+template<typename F>
+void for_each_group(RecordReader &reader, F f) {
+    Arena arena;
+    std::string_view key;
+    std::vector<std::string_view> values;
+    bool has_group = false;
+    std::string_view line, field;
+    while (reader.next(line)) {
+        std::string_view rest = line;
+        if (!next_field(rest, field)) continue;
+        while (!rest.empty() && is_space(rest.front())) rest.remove_prefix(1);
+        if (!has_group || field != key) {
+            if (has_group) f(key, values);
+            arena.clear();
+            values.clear();
+            key = arena.copy(field);
+            has_group = true;
+        }
+        values.push_back(arena.copy(rest));
+    }
+    if (has_group) f(key, values);
+}
+
+}
+
+#endif //MJ_SDK_H
@@ -3,24 +3,21 @@
  * Juice 0 phase for wordcount.
  */
 
-#include <iostream>
-#include <sstream>
-#include <map>
-
-using namespace std;
+#include "mj_sdk.h"
 
 int main() {
-    map<string, string> mp;
-    ios_base::sync_with_stdio(false);
-    string input;
-    while (getline(cin, input)) {
-        stringstream ss(input);
-        string key, val;
-        ss >> key >> val;
-        mp[key] += " " + val;
-    }
-    for (const auto &item : mp) {
-        cout << item.first << "\t" << item.second << endl;
+    mj::RecordReader reader;
+    mj::RecordWriter writer;
+    mj::HashAggregator<std::string> sources;
+    std::string_view line, key, value;
+    while (reader.next(line)) {
+        if (!mj::next_field(line, key)) key = std::string_view();
+        /// Append every value on the line, so partial outputs can be merged again.
+        std::string &joined = sources[key];
+        while (mj::next_field(line, value)) joined.append(" ").append(value);
     }
+    sources.for_each_sorted([&writer](std::string_view target, const std::string &joined) {
+        writer.write(target).put('\t').write(joined).put('\n');
+    });
     return 0;
 }
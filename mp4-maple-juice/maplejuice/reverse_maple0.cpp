@@ -3,20 +3,16 @@
  * Maple 0 phase for wordcount.
  */
 
-#include <iostream>
-#include <sstream>
-
-using namespace std;
+#include "mj_sdk.h"
 
 int main() {
-    ios_base::sync_with_stdio(false);
-    string input;
-    while (getline(cin, input)) {
-        string val1, val2;
-        stringstream ss(input);
-        ss >> val1 >> val2;
-
-        cout << val2 << "\t" << val1 << "\n";
+    mj::RecordReader reader;
+    mj::RecordWriter writer;
+    std::string_view line, source, target;
+    while (reader.next(line)) {
+        source = target = std::string_view();
+        mj::next_field(line, source) && mj::next_field(line, target);
+        writer.write(target).put('\t').write(source).put('\n');
     }
     return 0;
 }
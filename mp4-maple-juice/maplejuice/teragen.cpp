@@ -0,0 +1,64 @@
+/**
+ * teragen.cpp
+ * Generate TeraSort like input records for the sort job.
+ *
+ * Usage: teragen <num_records> [first_row] > <file>
+ * Each record is 100 bytes: a 10 byte random printable key, the 32 digit hex row id and a filler. The checksum of the
+ * records is printed to stderr, so the sorted output can be checked by teravalidate. Generating the rows of several
+ * files from different first_row gives distinct records with a summable checksum.
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+using namespace std;
+
+/// Order independent checksum of a record, the same as in teravalidate.
+uint64_t record_checksum(const string &record) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : record) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+int main(int argc, char *argv[]) {
+    ios_base::sync_with_stdio(false);
+    if (argc < 2) {
+        cerr << "Usage: teragen <num_records> [first_row]" << endl;
+        return 1;
+    }
+    uint64_t num_records = strtoull(argv[1], nullptr, 10);
+    uint64_t first_row = argc > 2 ? strtoull(argv[2], nullptr, 10) : 0;
+    uint64_t checksum = 0;
+    string record(99, ' ');
+    char row_id[33];
+
+    for (uint64_t row = first_row; row < first_row + num_records; row++) {
+        /// Keys use the 94 printable characters without space, so a key is the first field of its record.
+        uint64_t h = mix(row);
+        for (int i = 0; i < 10; i++) {
+            if (i == 5) h = mix(h);
+            record[i] = (char) ('!' + h % 94);
+            h /= 94;
+        }
+        snprintf(row_id, sizeof(row_id), "%016llx%016llx", 0ULL, (unsigned long long) row);
+        record.replace(11, 32, row_id);
+        for (int i = 44; i < 99; i++) record[i] = (char) ('A' + (row + i) % 26);
+        checksum += record_checksum(record);
+        cout << record << "\n";
+    }
+    cerr << "records " << num_records << " checksum " << hex << checksum << endl;
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * teravalidate.cpp
+ * Validate the output of the sort job.
+ *
+ * Usage: teravalidate <partition_file>... or teravalidate < <file>
+ * The partitions are given in the order listed by the sdfs_dest file of the sort job. Checks that the keys never go
+ * down within and across the partitions, and prints the number of records and their checksum, which matches the one
+ * of teragen if no record was lost or duplicated.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+/// Order independent checksum of a record, the same as in teragen.
+uint64_t record_checksum(const string &record) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : record) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int main(int argc, char *argv[]) {
+    ios_base::sync_with_stdio(false);
+    uint64_t num_records = 0, checksum = 0, num_errors = 0;
+    string record, key, previous_key;
+
+    for (int i = 1; i < argc || (argc == 1 && i == 1); i++) {
+        ifstream file;
+        if (argc > 1) {
+            file.open(argv[i]);
+            if (!file) {
+                cerr << "Cannot open " << argv[i] << endl;
+                return 1;
+            }
+        }
+        istream &input = argc > 1 ? file : cin;
+        while (getline(input, record)) {
+            key = record.substr(0, record.find_first_of(" \t"));
+            if (num_records > 0 && key < previous_key) {
+                if (num_errors++ < 10)
+                    cerr << "Misorder at record " << num_records << ": " << key << " after " << previous_key << endl;
+            }
+            previous_key = key;
+            checksum += record_checksum(record);
+            num_records++;
+        }
+    }
+    cout << "records " << num_records << " checksum " << hex << checksum << dec << " misorders " << num_errors << endl;
+    return num_errors == 0 ? 0 : 2;
+}
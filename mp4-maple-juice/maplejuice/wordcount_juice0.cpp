@@ -3,24 +3,20 @@
  * Juice 0 phase for wordcount.
  */
 
-#include <iostream>
-#include <sstream>
-#include <map>
-
-using namespace std;
+#include "mj_sdk.h"
 
 int main() {
-    map<string, int> mp;
-    ios_base::sync_with_stdio(false);
-    string input;
-    while (getline(cin, input)) {
-        stringstream ss(input);
-        string key;
-        ss >> key;
-        mp[key]++;
-    }
-    for (const auto &item : mp) {
-        cout << item.first << "\t" << item.second << endl;
+    mj::RecordReader reader;
+    mj::RecordWriter writer;
+    mj::HashAggregator<int64_t> counts;
+    std::string_view line, key, value;
+    while (reader.next(line)) {
+        if (!mj::next_field(line, key)) continue;
+        /// Sum the counts instead of counting lines, so partial outputs can be merged again.
+        int64_t count = 1;
+        if (mj::next_field(line, value) && !mj::parse_number(value, count)) count = 1;
+        counts[key] += count;
     }
+    counts.for_each_sorted([&writer](std::string_view word, int64_t count) { writer.write_pair(word, count); });
     return 0;
 }
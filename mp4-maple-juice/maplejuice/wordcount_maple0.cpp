@@ -3,16 +3,13 @@
  * Maple 0 phase for wordcount.
  */
 
-#include <iostream>
-#include <sstream>
-
-using namespace std;
+#include "mj_sdk.h"
 
 int main() {
-    ios_base::sync_with_stdio(false);
-    string input;
-    while (cin >> input) {
-        cout << input << "\t1" << endl;
-    }
+    mj::RecordReader reader;
+    mj::RecordWriter writer;
+    std::string_view line, word;
+    while (reader.next(line))
+        while (mj::next_field(line, word)) writer.write(word).write("\t1\n");
     return 0;
 }
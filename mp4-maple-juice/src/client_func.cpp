@@ -34,9 +34,24 @@ void client::console_message() {
     cout << "delete <sdfsfilename>" << endl;
     cout << "ls <sdfsfilename>" << endl;
     cout << "store" << endl;
-    cout << "maple <maple_exe> <num_maples> <sdfs_intermediate_filename_prefix> <sdfs_src_directory>" << endl;
-    cout << "juice <juice_exe> <num_juices> <sdfs_intermediate_filename_prefix> <sdfs_dest_filename> delete_input={0,1}"
-         << endl;
+    cout << "maple <maple_exe> <num_maples> <sdfs_intermediate_filename_prefix> <sdfs_src_directory> "
+            "[incremental={0,1}] [sample=<fraction>] [budget=<seconds>]" << endl;
+    cout << "juice <juice_exe|@sum|@count|@min|@max|@avg> <num_juices> <sdfs_intermediate_filename_prefix> "
+            "<sdfs_dest_filename> delete_input={0,1} [incremental={0,1}] [bucket={0,1}]" << endl;
+    cout << "join <hash|broadcast> <num_workers> <sdfs_left_prefix> <sdfs_right_prefix> <sdfs_dest_filename> "
+            "[bloom={0,1}]" << endl;
+    cout << "graph <pagerank|cc|bfs> <num_workers> <sdfs_edge_prefix> <sdfs_dest_filename> <max_supersteps> "
+            "[source_vertex]" << endl;
+    cout << "query <num_workers> <sdfs_dest_filename> SELECT <items> FROM <sdfs_prefix> [DELIMITER '<c>'] "
+            "[WHERE <predicates>] [GROUP BY <columns>] [ORDER BY <item> [ASC|DESC]] [LIMIT <n>]" << endl;
+    cout << "sort <num_workers> <num_partitions> <sdfs_src_directory> <sdfs_dest_filename>" << endl;
+    cout << "index <num_workers> <num_partitions> <sdfs_src_directory> <sdfs_dest_filename>" << endl;
+    cout << "sketch <distinct|topk|quantile> <num_workers> <sdfs_src_directory> <sdfs_dest_filename> "
+            "[column=<i>] [k=<n>]" << endl;
+    cout << "stream <maple_exe> <juice_exe> <num_workers> <interval_seconds> <window_batches> <sdfs_src_directory> "
+            "<sdfs_dest_filename>" << endl;
+    cout << "stream_stop <sdfs_dest_filename>" << endl;
+    cout << "Maple juice commands can start with priority=<high|normal|low>" << endl;
     cout << "help" << endl;
     cout << "exit" << endl;
     cout << "=======================================" << endl;
@@ -72,6 +87,16 @@ int client::run_client() {
             if (input.empty()) continue;
             stringstream ss(input);
             ss >> command;
+            /// A maple juice command may start with priority=<high|normal|low>.
+            string priority = "normal";
+            if (command.compare(0, 9, "priority=") == 0) {
+                priority = command.substr(9);
+                getline(ss >> ws, input);
+                ss.clear();
+                ss.str(input);
+                ss >> command;
+                if (priority != "high" && priority != "normal" && priority != "low") command = "";
+            }
             if (command == "exit") return 0;
             else if (command == "grep") {
                 /// Push the query message to a queue.
@@ -113,23 +138,122 @@ int client::run_client() {
             } else if (input == "store") {
                 send_sdfs_query(input);
             } else if (command == "maple") {
-                string maple_exe, sdfs_prefix, sdfs_src;
+                string maple_exe, sdfs_prefix, sdfs_src, option;
                 int num_maples = 0;
+                bool valid_options = true;
                 ss >> maple_exe >> num_maples >> sdfs_prefix >> sdfs_src;
-                if (maple_exe.empty() || num_maples <= 0 || sdfs_prefix.empty() || sdfs_src.empty()) {
+                while (ss >> option) {
+                    if (option.compare(0, 7, "sample=") == 0) {
+                        double fraction = atof(option.c_str() + 7);
+                        valid_options &= fraction > 0 && fraction <= 1;
+                    } else if (option.compare(0, 7, "budget=") == 0) {
+                        valid_options &= atof(option.c_str() + 7) > 0;
+                    } else {
+                        if (option.compare(0, 12, "incremental=") == 0) option = option.substr(12);
+                        valid_options &= option == "0" || option == "1";
+                    }
+                }
+                if (maple_exe.empty() || num_maples < 0 || sdfs_prefix.empty() || sdfs_src.empty() || !valid_options) {
                     cout << "Please enter the right command!" << endl;
                 } else {
-                    thread(&client::send_maplejuice_query, this, input).detach();
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
                 }
             } else if (command == "juice") {
-                string juice_exe, sdfs_prefix, sdfs_dest;
-                int num_juices = 0, delete_input = 0;
-                ss >> juice_exe >> num_juices >> sdfs_prefix >> sdfs_dest >> delete_input;
-                if (juice_exe.empty() || num_juices <= 0 || sdfs_prefix.empty() || sdfs_dest.empty() ||
-                    !(delete_input == 0 || delete_input == 1)) {
+                string juice_exe, sdfs_prefix, sdfs_dest, option;
+                int num_juices = 0, num_flags = 0;
+                bool valid_options = true;
+                ss >> juice_exe >> num_juices >> sdfs_prefix >> sdfs_dest;
+                while (ss >> option) {
+                    if (option.compare(0, 7, "bucket=") == 0) option = option.substr(7);
+                    else if (num_flags++ > 0 && option.compare(0, 12, "incremental=") == 0) option = option.substr(12);
+                    valid_options &= option == "0" || option == "1";
+                }
+                if (juice_exe.empty() || num_juices < 0 || sdfs_prefix.empty() || sdfs_dest.empty() || num_flags > 2 ||
+                    !valid_options) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "join") {
+                string mode, sdfs_left, sdfs_right, sdfs_dest;
+                int num_workers = 0, bloom = 0;
+                ss >> mode >> num_workers >> sdfs_left >> sdfs_right >> sdfs_dest >> bloom;
+                if (!(mode == "hash" || mode == "broadcast") || num_workers <= 0 || sdfs_left.empty() ||
+                    sdfs_right.empty() || sdfs_dest.empty() || !(bloom == 0 || bloom == 1)) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "graph") {
+                string algorithm, sdfs_prefix, sdfs_dest;
+                int num_workers = 0, max_supersteps = 0;
+                uint64_t source = 0;
+                ss >> algorithm >> num_workers >> sdfs_prefix >> sdfs_dest >> max_supersteps;
+                bool has_source = (bool) (ss >> source);
+                if (!(algorithm == "pagerank" || algorithm == "cc" || algorithm == "bfs") || num_workers <= 0 ||
+                    sdfs_prefix.empty() || sdfs_dest.empty() || max_supersteps <= 0 ||
+                    (algorithm == "bfs" && !has_source)) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "query") {
+                string sdfs_dest, select;
+                int num_workers = 0;
+                ss >> num_workers >> sdfs_dest >> select;
+                for (auto &c : select) c = (char) toupper((unsigned char) c);
+                if (num_workers <= 0 || sdfs_dest.empty() || select != "SELECT") {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "sort") {
+                string sdfs_src, sdfs_dest;
+                int num_workers = 0, num_partitions = 0;
+                ss >> num_workers >> num_partitions >> sdfs_src >> sdfs_dest;
+                if (num_workers <= 0 || num_partitions <= 0 || sdfs_src.empty() || sdfs_dest.empty()) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "index") {
+                string sdfs_src, sdfs_dest;
+                int num_workers = 0, num_partitions = 0;
+                ss >> num_workers >> num_partitions >> sdfs_src >> sdfs_dest;
+                if (num_workers <= 0 || num_partitions <= 0 || sdfs_src.empty() || sdfs_dest.empty()) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "sketch") {
+                string kind, sdfs_src, sdfs_dest;
+                int num_workers = 0;
+                ss >> kind >> num_workers >> sdfs_src >> sdfs_dest;
+                if ((kind != "distinct" && kind != "topk" && kind != "quantile") || num_workers <= 0 ||
+                    sdfs_src.empty() || sdfs_dest.empty()) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "stream") {
+                string maple_exe, juice_exe, sdfs_src, sdfs_dest;
+                int num_workers = 0, window_batches = -1;
+                double interval_seconds = 0;
+                ss >> maple_exe >> juice_exe >> num_workers >> interval_seconds >> window_batches >> sdfs_src >>
+                   sdfs_dest;
+                if (juice_exe.empty() || num_workers <= 0 || interval_seconds <= 0 || window_batches < 0 ||
+                    sdfs_src.empty() || sdfs_dest.empty()) {
                     cout << "Please enter the right command!" << endl;
                 } else {
-                    thread(&client::send_maplejuice_query, this, input).detach();
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
+                }
+            } else if (command == "stream_stop") {
+                string sdfs_dest;
+                ss >> sdfs_dest;
+                if (sdfs_dest.empty()) {
+                    cout << "Please enter the right command!" << endl;
+                } else {
+                    thread(&client::send_maplejuice_query, this, input, priority).detach();
                 }
             } else if (input == "help") {
                 console_message();
@@ -267,35 +391,57 @@ int client::send_sdfs_query(string input) {
     return 0;
 }
 
-int client::send_maplejuice_query(string input) {
-    int sock = 0;
-    char buffer[MAX_BUFFER_SIZE] = {0};
+int client::send_maplejuice_query(string input, string priority) {
+    /// The master queues jobs by user and priority class.
+    const char *user = getenv("USER");
+    input = "as " + string(user != nullptr && *user != '\0' ? user : "anonymous") + " " + priority + " " + input;
 
-    /// Initialize socket connection.
-    struct sockaddr_in serv_addr{};
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-        throw runtime_error("Failure in create socket");
+    /// Try the last known master first, then every other machine until the current master accepts the job.
+    vector<string> candidates = {maple_juice_master_ip};
+    for (int vm_id = 0; vm_id < MAX_VM_NUM; vm_id++)
+        if (ip_addresses[vm_id] != maple_juice_master_ip) candidates.push_back(ip_addresses[vm_id]);
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(this->query_port);
+    for (const auto &candidate : candidates) {
+        int sock = 0;
+        char buffer[MAX_BUFFER_SIZE] = {0};
 
-    if (inet_pton(AF_INET, maple_juice_master_ip.c_str(), &serv_addr.sin_addr) <= 0)
-        throw runtime_error("Invalid address");
+        /// Initialize socket connection.
+        struct sockaddr_in serv_addr{};
+        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            throw runtime_error("Failure in create socket");
 
-    /// Try to connect to the server of the same ip address and print the result.
-    if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-        throw runtime_error("Connection failed");
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(this->query_port);
 
-    const char *query = input.c_str();
-    send(sock, query, strlen(query), 0);
+        if (inet_pton(AF_INET, candidate.c_str(), &serv_addr.sin_addr) <= 0)
+            throw runtime_error("Invalid address");
 
-    while (read(sock, buffer, MAX_BUFFER_SIZE)) {
-        cout << buffer << endl;
-    }
+        /// Skip the machines that are down.
+        if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+            close(sock);
+            continue;
+        }
 
-    close(sock);
+        const char *query = input.c_str();
+        send(sock, query, strlen(query), 0);
 
-    return 0;
+        if (read(sock, buffer, MAX_BUFFER_SIZE) <= 0 || string(buffer) == "not_master") {
+            close(sock);
+            continue;
+        }
+
+        maple_juice_master_ip = candidate;
+        do {
+            cout << buffer << endl;
+            memset(buffer, 0, sizeof buffer);
+        } while (read(sock, buffer, MAX_BUFFER_SIZE));
+
+        close(sock);
+        return 0;
+    }
+
+    cout << "No maple juice master available!" << endl;
+    return -1;
 }
 
 
@@ -101,7 +101,7 @@ private:
 
     void send_put_query_second_part(string choice);
 
-    int send_maplejuice_query(string input);
+    int send_maplejuice_query(string input, string priority);
 
 public:
 
@@ -0,0 +1,107 @@
+/**
+ * server_bucket.cpp
+ * Implementation of bucketed output funcs in server_func.h, used by the jobs reading and writing outputs partitioned
+ * by their keys.
+ */
+
+#include "server_func.h"
+#include "server_maplejuice.h"
+#include "server_bucket.h"
+#include "general.h"
+
+string BucketLayout::serialize() const {
+    string text = "partitioner " + partitioner + "\npartitions " + to_string(num_partitions) + "\n";
+    for (const auto &item : buckets)
+        text += "bucket " + to_string(item.first) + " " + item.second.file + " " + to_string(item.second.records) +
+                " " + to_string(item.second.bytes) + " " + item.second.min_key + " " + item.second.max_key + "\n";
+    return text;
+}
+
+bool BucketLayout::deserialize(const string &text) {
+    stringstream ss(text);
+    string line, type;
+    buckets.clear();
+    while (getline(ss, line)) {
+        stringstream line_ss(line);
+        line_ss >> type;
+        if (type == "partitioner") {
+            line_ss >> partitioner;
+        } else if (type == "partitions") {
+            line_ss >> num_partitions;
+        } else if (type == "bucket") {
+            int partition = -1;
+            BucketRange range;
+            if (!(line_ss >> partition >> range.file >> range.records >> range.bytes >> range.min_key >>
+                           range.max_key))
+                return false;
+            buckets[partition] = range;
+        }
+    }
+    return !partitioner.empty() && num_partitions > 0;
+}
+
+bool BucketLayout::matches_maple_partitions() const {
+    return partitioner == BUCKET_PARTITIONER && num_partitions == NUM_PARTITIONS;
+}
+
+bool BucketLayout::may_overlap(const BucketLayout &other, int partition) const {
+    auto it = buckets.find(partition), other_it = other.buckets.find(partition);
+    if (it == buckets.end() || other_it == other.buckets.end()) return false;
+    return !(it->second.max_key < other_it->second.min_key || other_it->second.max_key < it->second.min_key);
+}
+
+BucketLayout server::write_bucketed_output(const string &local_path, const string &sdfs_dest) {
+    BucketLayout layout;
+    layout.partitioner = BUCKET_PARTITIONER;
+    layout.num_partitions = NUM_PARTITIONS;
+
+    /// Split the output by the maple partitioner of the first field of each line, the lines keep their order.
+    map<int, ofstream> bucket_files;
+    ifstream infile(local_path);
+    string line;
+    while (getline(infile, line)) {
+        size_t key_begin = 0;
+        while (key_begin < line.size() && isspace((unsigned char) line[key_begin])) key_begin++;
+        size_t key_end = key_begin;
+        while (key_end < line.size() && !isspace((unsigned char) line[key_end])) key_end++;
+        /// A blank line holds no record.
+        if (key_begin == key_end) continue;
+        string key = line.substr(key_begin, key_end - key_begin);
+        int partition = hash_string_to_int(key) % NUM_PARTITIONS;
+
+        BucketRange &range = layout.buckets[partition];
+        if (range.records == 0) {
+            range.file = sdfs_dest + BUCKET_INFIX + "_" + to_string(partition) + "_0";
+            range.min_key = range.max_key = key;
+            bucket_files[partition].open(curr_dir + "/files/fetched/" + range.file);
+        }
+        range.min_key = min(range.min_key, key);
+        range.max_key = max(range.max_key, key);
+        range.records++;
+        range.bytes += line.size() + 1;
+        bucket_files[partition] << line << "\n";
+    }
+    infile.close();
+
+    /// The buckets of an earlier run are replaced as a whole, so no stale bucket outlives the new layout.
+    delete_all_file_by_prefix(sdfs_dest + BUCKET_INFIX + "_");
+    for (auto &item : bucket_files) {
+        item.second.close();
+        string local_file = curr_dir + "/files/fetched/" + layout.buckets[item.first].file;
+        maple_juice_put(local_file, layout.buckets[item.first].file);
+        remove(local_file.c_str());
+    }
+    sdfs_write_text(sdfs_dest + PARTITIONING_SUFFIX, layout.serialize());
+    return layout;
+}
+
+bool server::load_bucket_layout(const string &sdfs_prefix, BucketLayout &layout) {
+    /// A bucketed output is named by its sdfs_dest, or by the prefix of its bucket files.
+    string sdfs_dest = sdfs_prefix;
+    size_t infix_size = strlen(BUCKET_INFIX);
+    if (sdfs_dest.size() > infix_size &&
+        sdfs_dest.compare(sdfs_dest.size() - infix_size, infix_size, BUCKET_INFIX) == 0)
+        sdfs_dest.resize(sdfs_dest.size() - infix_size);
+    string text = sdfs_read_text(sdfs_dest + PARTITIONING_SUFFIX);
+    return !text.empty() && layout.deserialize(text);
+}
@@ -0,0 +1,54 @@
+/**
+ * server_bucket.h
+ * Define bucketed output contents used in server.
+ */
+
+#ifndef SERVER_BUCKET_H
+#define SERVER_BUCKET_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+/// Infix of the bucket files of a bucketed output, "<sdfs_dest>.bucket_<partition>_0". The files are named like the
+/// intermediate files of the prefix "<sdfs_dest>.bucket", so a juice over that prefix reduces them without a maple.
+#define BUCKET_INFIX ".bucket"
+
+/// Suffix of the sdfs file describing how a bucketed output is partitioned.
+#define PARTITIONING_SUFFIX ".partitioning"
+
+/// The partitioner of maple output and of bucketed outputs, the hash of the first field modulo the partitions.
+#define BUCKET_PARTITIONER "hash"
+
+/// The records of one bucket, sorted by key.
+class BucketRange {
+public:
+    string file;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    string min_key;
+    string max_key;
+};
+
+/// How a bucketed output is partitioned, stored in "<sdfs_dest>.partitioning" as "partitioner <name>",
+/// "partitions <R>" and a line "bucket <partition> <file> <records> <bytes> <min_key> <max_key>" per non-empty bucket.
+class BucketLayout {
+public:
+    string partitioner;
+    int num_partitions = 0;
+    map<int, BucketRange> buckets;
+
+    string serialize() const;
+
+    /// Returns false if the text is not a layout.
+    bool deserialize(const string &text);
+
+    /// Whether the buckets match the partitions of maple output, so the partition p of a job is the bucket p.
+    bool matches_maple_partitions() const;
+
+    /// Whether the keys of bucket p in this layout and in the other can overlap.
+    bool may_overlap(const BucketLayout &other, int partition) const;
+};
+
+#endif //SERVER_BUCKET_H
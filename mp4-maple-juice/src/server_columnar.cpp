@@ -0,0 +1,218 @@
+/**
+ * server_columnar.cpp
+ * Implementation of built-in columnar numeric juice funcs in server_columnar.h.
+ */
+
+#include "server_columnar.h"
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/// Per key aggregates of a built-in juice, one column for each accumulator, indexed by the key id.
+class ColumnarAggregates {
+public:
+    vector<int64_t> int_sums, counts;
+    vector<double> double_sums, weights, extremes;
+    /// Whether all the values of a key are integers, so the aggregate is written as an integer.
+    vector<uint8_t> integral;
+
+    void resize(size_t num_keys, double initial_extreme) {
+        int_sums.resize(num_keys, 0);
+        counts.resize(num_keys, 0);
+        double_sums.resize(num_keys, 0);
+        weights.resize(num_keys, 0);
+        extremes.resize(num_keys, initial_extreme);
+        integral.resize(num_keys, 1);
+    }
+};
+
+uint32_t KeyDictionary::encode(const char *key, size_t length) {
+    auto inserted = ids.emplace(string(key, length), (uint32_t) keys.size());
+    if (inserted.second) keys.push_back(inserted.first->first);
+    return inserted.first->second;
+}
+
+/**
+ * Decode a number from [begin, end), integers without going through strtod.
+ *
+ * Returns:
+ *      Return false if the text is not a number.
+ */
+bool decode_number(const char *begin, const char *end, bool &is_integer, int64_t &int_value, double &double_value) {
+    const char *p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    /// At most 18 digits always fit in an int64_t.
+    if (p < end && end - p <= 18) {
+        int64_t value = 0;
+        const char *digit = p;
+        while (digit < end && *digit >= '0' && *digit <= '9') value = value * 10 + (*digit++ - '0');
+        if (digit == end) {
+            is_integer = true;
+            int_value = negative ? -value : value;
+            return true;
+        }
+    }
+    string text(begin, end);
+    char *parsed_end = nullptr;
+    double_value = strtod(text.c_str(), &parsed_end);
+    is_integer = false;
+    return !text.empty() && parsed_end == text.c_str() + text.size();
+}
+
+/**
+ * Aggregate a batch into the per key aggregates. Each kernel is a single pass over the typed columns, with no text
+ * left to parse and no branch on the type of a record.
+ */
+void aggregate_batch(BuiltinJuice juice, const ColumnarBatch &batch, ColumnarAggregates &aggregates) {
+    const uint32_t *keys = batch.keys.data();
+    size_t num_records = batch.keys.size();
+    if (juice == JUICE_COUNT) {
+        int64_t *counts = aggregates.counts.data();
+        for (size_t i = 0; i < num_records; i++) counts[keys[i]]++;
+        return;
+    }
+    if (!batch.integral) {
+        uint8_t *integral = aggregates.integral.data();
+        for (size_t i = 0; i < num_records; i++) integral[keys[i]] = 0;
+    }
+    if (juice == JUICE_SUM && batch.integral) {
+        const int64_t *values = batch.int_values.data();
+        int64_t *sums = aggregates.int_sums.data();
+        for (size_t i = 0; i < num_records; i++) sums[keys[i]] += values[i];
+        return;
+    }
+
+    /// The other kernels run on doubles, an integral batch is widened once.
+    vector<double> widened;
+    const double *values = batch.double_values.data();
+    if (batch.integral) {
+        widened.assign(batch.int_values.begin(), batch.int_values.end());
+        values = widened.data();
+    }
+    double *sums = aggregates.double_sums.data(), *extremes = aggregates.extremes.data();
+    if (juice == JUICE_SUM) {
+        for (size_t i = 0; i < num_records; i++) sums[keys[i]] += values[i];
+    } else if (juice == JUICE_MIN) {
+        for (size_t i = 0; i < num_records; i++) extremes[keys[i]] = min(extremes[keys[i]], values[i]);
+    } else if (juice == JUICE_MAX) {
+        for (size_t i = 0; i < num_records; i++) extremes[keys[i]] = max(extremes[keys[i]], values[i]);
+    } else {
+        const double *weights = batch.weights.data();
+        double *total_weights = aggregates.weights.data();
+        for (size_t i = 0; i < num_records; i++) {
+            sums[keys[i]] += values[i] * weights[i];
+            total_weights[keys[i]] += weights[i];
+        }
+    }
+}
+
+/**
+ * Format a double aggregate, or an integer one without a fraction.
+ */
+string format_aggregate(double value, bool integral) {
+    if (integral && value >= -9.2e18 && value <= 9.2e18) return to_string((int64_t) value);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+}
+
+bool run_builtin_juice(const string &juice_exe, const vector<string> &input_files, ostream &out) {
+    BuiltinJuice juice = parse_builtin_juice(juice_exe);
+    if (juice == JUICE_UNKNOWN) return false;
+    double initial_extreme = juice == JUICE_MIN ? numeric_limits<double>::infinity()
+                                                : -numeric_limits<double>::infinity();
+    KeyDictionary dictionary;
+    ColumnarBatch batch;
+    ColumnarAggregates aggregates;
+    auto flush_batch = [&]() {
+        aggregates.resize(dictionary.keys.size(), initial_extreme);
+        aggregate_batch(juice, batch, aggregates);
+        batch.clear();
+    };
+
+    for (const auto &input_file : input_files) {
+        int fd = open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat file_stat{};
+        fstat(fd, &file_stat);
+        size_t size = (size_t) file_stat.st_size;
+        void *mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        const char *data = (const char *) mapped, *end = data + size;
+
+        /// Decode the "<key> <value> [<weight>]" lines straight from the mapped file into the batch columns.
+        bool valid = true;
+        for (const char *line = data; valid && line < end;) {
+            const char *line_end = (const char *) memchr(line, '\n', (size_t) (end - line));
+            if (line_end == nullptr) line_end = end;
+            const char *fields[3][2] = {}, *p = line;
+            int num_fields = 0;
+            while (num_fields < 3) {
+                while (p < line_end && isspace((unsigned char) *p)) p++;
+                if (p == line_end) break;
+                fields[num_fields][0] = p;
+                while (p < line_end && !isspace((unsigned char) *p)) p++;
+                fields[num_fields++][1] = p;
+            }
+            line = line_end + 1;
+            if (num_fields == 0) continue;
+            if (num_fields < 2 && juice != JUICE_COUNT) {
+                valid = false;
+                break;
+            }
+
+            batch.keys.push_back(dictionary.encode(fields[0][0], (size_t) (fields[0][1] - fields[0][0])));
+            if (juice != JUICE_COUNT) {
+                bool is_integer = false;
+                int64_t int_value = 0;
+                double double_value = 0;
+                valid = decode_number(fields[1][0], fields[1][1], is_integer, int_value, double_value);
+                if (batch.integral && !is_integer) {
+                    /// Promote the batch to doubles.
+                    batch.double_values.assign(batch.int_values.begin(), batch.int_values.end());
+                    batch.int_values.clear();
+                    batch.integral = false;
+                }
+                if (batch.integral) batch.int_values.push_back(int_value);
+                else batch.double_values.push_back(is_integer ? (double) int_value : double_value);
+            }
+            if (juice == JUICE_AVG) {
+                bool is_integer = false;
+                int64_t int_weight = 1;
+                double weight = 1;
+                if (num_fields == 3)
+                    valid &= decode_number(fields[2][0], fields[2][1], is_integer, int_weight, weight);
+                batch.weights.push_back(is_integer ? (double) int_weight : weight);
+            }
+            if (batch.keys.size() == COLUMNAR_BATCH_RECORDS) flush_batch();
+        }
+        if (mapped != nullptr) munmap(mapped, size);
+        if (!valid) return false;
+    }
+    flush_batch();
+
+    for (uint32_t id = 0; id < dictionary.keys.size(); id++) {
+        bool integral = aggregates.integral[id] != 0;
+        out << dictionary.keys[id] << " ";
+        if (juice == JUICE_COUNT) out << aggregates.counts[id];
+        else if (juice == JUICE_SUM && integral) out << aggregates.int_sums[id];
+        else if (juice == JUICE_SUM) out << format_aggregate(aggregates.int_sums[id] + aggregates.double_sums[id], 0);
+        else if (juice == JUICE_AVG)
+            out << format_aggregate(aggregates.double_sums[id] / aggregates.weights[id], false) << " "
+                << format_aggregate(aggregates.weights[id], aggregates.weights[id] == floor(aggregates.weights[id]));
+        else out << format_aggregate(aggregates.extremes[id], integral);
+        out << "\n";
+    }
+    return true;
+}
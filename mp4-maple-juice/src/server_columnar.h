@@ -0,0 +1,90 @@
+/**
+ * server_columnar.h
+ * Define built-in columnar numeric juice contents used in server.
+ */
+
+#ifndef SERVER_COLUMNAR_H
+#define SERVER_COLUMNAR_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <unordered_map>
+#include <cstdint>
+
+/// A juice_exe starting with this character names a built-in juice instead of an executable on sdfs.
+#define BUILTIN_JUICE_PREFIX '@'
+
+/// The number of records decoded into one columnar batch before it is aggregated.
+#define COLUMNAR_BATCH_RECORDS 4096
+
+/// Built-in juices, each over "<key> <value>" lines, aggregating the values of each key.
+enum BuiltinJuice {
+    JUICE_SUM, JUICE_COUNT, JUICE_MIN, JUICE_MAX, JUICE_AVG, JUICE_UNKNOWN
+};
+
+/**
+ * Check whether a juice_exe names a built-in juice.
+ */
+inline bool is_builtin_juice(const std::string &juice_exe) {
+    return !juice_exe.empty() && juice_exe[0] == BUILTIN_JUICE_PREFIX;
+}
+
+/**
+ * Decode the name of a built-in juice: @sum, @count, @min, @max or @avg.
+ */
+inline BuiltinJuice parse_builtin_juice(const std::string &juice_exe) {
+    if (juice_exe == "@sum") return JUICE_SUM;
+    if (juice_exe == "@count") return JUICE_COUNT;
+    if (juice_exe == "@min") return JUICE_MIN;
+    if (juice_exe == "@max") return JUICE_MAX;
+    if (juice_exe == "@avg") return JUICE_AVG;
+    return JUICE_UNKNOWN;
+}
+
+/**
+ * Columnar batch of juice input records: the key column is dictionary encoded, and the values are a typed column,
+ * integers until the first value that is not an integer promotes the batch to doubles. The weight column is only
+ * filled by @avg, from the optional third field of a line.
+ */
+class ColumnarBatch {
+public:
+    std::vector<uint32_t> keys;
+    std::vector<int64_t> int_values;
+    std::vector<double> double_values;
+    std::vector<double> weights;
+    bool integral = true;
+
+    void clear() {
+        keys.clear();
+        int_values.clear();
+        double_values.clear();
+        weights.clear();
+        integral = true;
+    }
+};
+
+/**
+ * Dictionary of the keys of a built-in juice, assigning each distinct key a dense id in the order of first sight.
+ */
+class KeyDictionary {
+public:
+    uint32_t encode(const char *key, size_t length);
+
+    std::vector<std::string> keys;
+
+private:
+    std::unordered_map<std::string, uint32_t> ids;
+};
+
+/**
+ * Run a built-in juice over the given local input files, appending "<key> <aggregate>" lines to the output.
+ * @avg writes "<key> <average> <count>", so like the other built-in juices except @count, its output is valid input
+ * of itself.
+ *
+ * Returns:
+ *      Return false if the juice is unknown, an input cannot be read or a value is not a number.
+ */
+bool run_builtin_juice(const std::string &juice_exe, const std::vector<std::string> &input_files, std::ostream &out);
+
+#endif //SERVER_COLUMNAR_H
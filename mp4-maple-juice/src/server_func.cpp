@@ -18,6 +18,18 @@
 #define GetCurrentDir getcwd
 #endif
 
+/**
+ * Read a non-negative number from an environment variable.
+ *
+ * Returns:
+ *      Return default_value if the variable is not set or not a number.
+ */
+uint64_t read_env_number(const char *name, uint64_t default_value) {
+    const char *value = getenv(name);
+    if (value == nullptr || *value < '0' || *value > '9') return default_value;
+    return strtoull(value, nullptr, 10);
+}
+
 std::string current_working_directory() {
     char *cwd = GetCurrentDir(nullptr, 0);
     std::string working_directory(cwd);
@@ -47,6 +59,13 @@ server::server() {
     server::init_files_path(SDFS_PATH);
     server::init_files_path(FETCHED_PATH);
 
+    /// The task slots and UDF limits of this worker can be set per node.
+    this->task_slots = (int) max((uint64_t) 1, min(read_env_number("MJ_TASK_SLOTS", MJ_DEFAULT_TASK_SLOTS),
+                                                   (uint64_t) 64));
+    this->free_task_slots = this->task_slots;
+    this->task_limits.memory_mb = read_env_number("MJ_TASK_MEMORY_MB", MJ_DEFAULT_TASK_MEMORY_MB);
+    this->task_limits.cpu_seconds = read_env_number("MJ_TASK_CPU_SECONDS", MJ_DEFAULT_TASK_CPU_SECONDS);
+
 #ifdef DEBUG_MODE
     cout << "### My ip address is " << this->my_ip_address << endl;
     cout << "### Indicator ip address is " << indicator_ip << endl;
@@ -84,8 +103,8 @@ int server::run_server() {
     thread(&server::run_udp_receiver, this).detach();
     thread(&server::heartbeat_sender, this).detach();
     thread(&server::failure_detector, this).detach();
-    if (my_ip_address == indicator_ip)
-        thread(&server::run_maple_juice_handler, this).detach();
+    thread(&server::run_maple_juice_handler, this).detach();
+    thread(&server::run_journal_writer, this).detach();
 
     string input;
     console_message();
@@ -157,11 +176,25 @@ void server::run_tcp_query_receiver() {
             thread(&server::handle_ls_request, this, sock, query).detach();
         else if (query_type == "store")
             thread(&server::handle_store_request, this, sock, query).detach();
-        else if (query_type == "maple" || query_type == "juice") {
-            if (my_ip_address == indicator_ip) {
-                maple_juice_requests_lock.lock();
-                maple_juice_requests.push(make_pair(query, sock));
-                maple_juice_requests_lock.unlock();
+        else if (query_type == "as" || query_type == "maple" || query_type == "juice" || query_type == "join" ||
+                 query_type == "graph" || query_type == "query" || query_type == "sort" ||
+                 query_type == "index" || query_type == "sketch" || query_type == "stream" ||
+                 query_type == "stream_stop") {
+            /// A job may come as "as <user> <priority> <command>", otherwise it is anonymous and of normal priority.
+            string user = "anonymous", priority = "normal";
+            if (query_type == "as") {
+                ss >> user >> priority;
+                getline(ss >> ws, query);
+            }
+            if (parse_job_priority(priority) < 0) {
+                reply_to_client(sock, "No such priority: " + priority + "!");
+            } else if (is_maple_juice_master) {
+                submit_maple_juice_job(query, sock, user, parse_job_priority(priority));
+            } else {
+                /// Let the client try the next machine until it finds the current master.
+                string not_master = "not_master";
+                send(sock, not_master.c_str(), not_master.size(), 0);
+                close(sock);
             }
         } else close(sock);
     }
@@ -215,6 +248,8 @@ void server::run_tcp_sdfs_receiver() {
             thread(&server::handle_prefix_check_exist, this, sock, query).detach();
         else if (query_type == "prefix_delete")
             thread(&server::handle_prefix_delete, this, sock, query).detach();
+        else if (query_type == "prefix_size")
+            thread(&server::handle_prefix_size, this, sock, query).detach();
         else close(sock);
     }
 }
@@ -256,6 +291,12 @@ void server::run_tcp_maple_juice_receiver() {
             thread(&server::maple_task_processor, this, sock, query).detach();
         else if (query_type == "juice_start")
             thread(&server::juice_task_processor, this, sock, query).detach();
+        else if (query_type == "graph_start")
+            thread(&server::graph_task_processor, this, sock, query).detach();
+        else if (query_type == "graph_messages")
+            thread(&server::graph_message_receiver, this, sock, query).detach();
+        else if (query_type.size() > 6 && query_type.substr(query_type.size() - 6) == "_start")
+            thread(&server::native_task_processor, this, sock, query).detach();
         else close(sock);
     }
 }
@@ -9,7 +9,17 @@
 #include "grep.h"
 #include "server_membership.h"
 #include "server_maplejuice.h"
+#include "server_monitor.h"
 #include "server_sdfs.h"
+#include "server_join.h"
+#include "server_graph.h"
+#include "server_query.h"
+#include "server_sort.h"
+#include "server_stream.h"
+#include "server_index.h"
+#include "server_sketch.h"
+#include "server_history.h"
+#include "server_bucket.h"
 #include "general.h"
 #include <cstring>
 #include <atomic>
@@ -20,9 +30,11 @@
 #include <set>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
+#include <memory>
 
 
 class server {
@@ -79,16 +91,83 @@ private:
     };
 
     /// The maple juice queue received from client.
-    queue<pair<string, int>> maple_juice_requests;
+    vector<MapleJuiceJob> maple_juice_requests;
     mutex maple_juice_requests_lock;
 
+    /// When each user last had a job started, jobs of the same priority go to the user waiting the longest.
+    map<string, uint64_t> user_last_start;
+
+    /// The priority of the job the handler runs, -1 when idle. Only used by the maple juice handler thread.
+    int running_job_priority = -1;
+
+    /// The time the handler spent running preempting jobs, so a preempted job leaves it out of its own timing.
+    uint64_t preempted_milliseconds = 0;
+
+    /// Whether this node is currently the maple juice master.
+    atomic<bool> is_maple_juice_master{false};
+
+    /// The id of the last job submitted to this master.
+    uint64_t last_job_id = 0;
+
+    /// Maple throughput of one worker measured on the last maple job, used to turn a time budget into a sample.
+    double maple_bytes_per_second = MAPLE_DEFAULT_BYTES_PER_SECOND;
+
+    /// The in-memory copy of the maple juice journal on sdfs, only used by master node.
+    vector<string> maple_juice_journal;
+    mutex maple_juice_journal_lock;
+
+    /// The records waiting for the journal writer, and the segments on sdfs not compacted into the journal yet.
+    vector<string> pending_journal_records;
+    condition_variable journal_cv;
+    int first_journal_segment = 0;
+    int next_journal_segment = 0;
+    uint64_t journal_queued_records = 0;
+    uint64_t journal_written_records = 0;
+
     /// The job done count for maple or juice stage.
     int maple_juice_done_count;
     mutex maple_juice_done_count_lock;
 
-    /// The .
+    /// The workers ready to take over a failed mission.
     queue<string> free_worker;
     mutex free_worker_lock;
+    condition_variable free_worker_cv;
+
+    /// The free workers held back because they are blacklisted, and the number of workers running a mission.
+    set<string> parked_workers;
+    int leased_workers = 0;
+
+    /// Whether a mission of the running job gave up, guarded by maple_juice_done_count_lock.
+    bool maple_juice_aborted = false;
+
+    /// Failure accounting of the workers, only used by master node.
+    map<string, WorkerHealth> worker_health;
+    mutex worker_health_lock;
+
+    /// The missions running on this worker and their recent throughput in bytes per second, sent in heartbeats.
+    atomic<int> running_missions{0};
+    atomic<double> recent_throughput{0};
+
+    /// The task slots of this worker, the free ones, and the limits of the UDF in each slot.
+    int task_slots = MJ_DEFAULT_TASK_SLOTS;
+    int free_task_slots = MJ_DEFAULT_TASK_SLOTS;
+    mutex task_slot_lock;
+    condition_variable task_slot_cv;
+    TaskLimits task_limits;
+
+    /// The small side of the last broadcast join on this worker, kept in memory for the following missions.
+    string broadcast_table_key;
+    shared_ptr<const unordered_multimap<string, string>> broadcast_table;
+    mutex broadcast_table_lock;
+
+    /// The graph partition this worker holds for the running graph job.
+    shared_ptr<GraphPartition> graph_partition;
+    mutex graph_lock;
+    condition_variable graph_inbox_cv;
+
+    /// The members suspected or removed by the failure detector, their missions are reassigned right away.
+    set<string> failed_workers;
+    mutex failed_workers_lock;
 
     /// Hash table to transfer ips to VM nums.
     unordered_map<string, string> sorted_ips_map = {
@@ -202,6 +281,11 @@ private:
      */
     void heartbeat_sender();
 
+    /**
+     * Fill the load of this node into a heartbeat.
+     */
+    void fill_load_report(Member &member);
+
     /**
      * Print the current membership list to terminal.
      */
@@ -348,12 +432,101 @@ private:
     /**
      * Handle the maple query from user, should only be called by master node.
      */
-    void handle_maple_query(pair<string, int> query);
+    void handle_maple_query(MapleJuiceJob job);
 
     /**
      * Handle the juice query from user, should only be called by master node.
      */
-    void handle_juice_query(pair<string, int> query);
+    void handle_juice_query(MapleJuiceJob job);
+
+    /**
+     * Journal a maple/juice query from client and put it to the job queue, should only be called by master node.
+     * The job is rejected if its user has too many jobs waiting or the cluster is too busy for its priority.
+     */
+    void submit_maple_juice_job(const string &query, int sock, const string &user, int priority);
+
+    /**
+     * Journal a job and put it to the job queue without admission control, the next micro batch of a stream job is
+     * queued this way so a busy cluster delays the stream instead of ending it.
+     */
+    void enqueue_maple_juice_job(const string &query, int sock, const string &user, int priority);
+
+    /**
+     * The number of workers the cluster can currently run jobs on, busy workers count as a fraction.
+     */
+    double get_cluster_capacity();
+
+    /**
+     * Take the next job of at least the given priority from the queue: the highest priority first, then the user
+     * waiting the longest, then the oldest job.
+     *
+     * Returns:
+     *      Return false if there is no such job.
+     */
+    bool pop_maple_juice_job(int min_priority, MapleJuiceJob &job);
+
+    /**
+     * Run a job to its end and remove it from the journal, should only be called by master node.
+     */
+    void run_maple_juice_job(MapleJuiceJob &job);
+
+    /**
+     * Check whether a job of a higher priority than the running job waits to run.
+     */
+    bool has_preempting_job();
+
+    /**
+     * Run the waiting jobs of a higher priority than the running job first. Called between the stages of a job, or at
+     * a task boundary of a stage, when none of its missions is running. The done count and the free workers of the
+     * stage are kept for it.
+     */
+    void run_preempting_jobs();
+
+    /**
+     * Find the alive node that should be maple juice master if the current master fails.
+     * The indicator is preferred, then the other machines in sorted_ips order.
+     *
+     * Returns:
+     *      Return the ip address of the candidate, or an empty string if not joined.
+     */
+    string find_maple_juice_master_candidate();
+
+    /**
+     * Check whether this node should take over as maple juice master. The candidate only takes over if the master
+     * recorded in the journal is no longer alive, so a rejoined node does not steal a running master's role.
+     */
+    bool check_maple_juice_takeover();
+
+    /**
+     * Load the journal from sdfs and put every unfinished job back to the job queue.
+     */
+    void replay_maple_juice_journal();
+
+    /**
+     * Queue a record for the journal writer, the caller does not wait for sdfs.
+     */
+    void journal_append(const string &record);
+
+    /**
+     * Append the record dropping all records of a finished job from the journal.
+     */
+    void journal_finish_job(uint64_t job_id);
+
+    /**
+     * Wait until every record queued so far is written to sdfs.
+     */
+    void journal_sync();
+
+    /**
+     * Thread writing the queued records of the journal to sdfs, a segment file per batch, and compacting the
+     * segments into the journal file once there are MJ_JOURNAL_COMPACT_SEGMENTS of them.
+     */
+    void run_journal_writer();
+
+    /**
+     * Write the live records to the journal file and delete the segments it replaces.
+     */
+    void compact_maple_juice_journal();
 
     /**
      * Get the filenames on sdfs which starts by prefix.
@@ -378,41 +551,497 @@ private:
      */
     void handle_prefix_delete(int sock, const string &prefix_delete_command);
 
+    /**
+     * Get the sizes of the files on sdfs which start by prefix.
+     *
+     * Returns:
+     *      Return the map from each sdfs filename starting by prefix to its size in bytes.
+     */
+    map<string, uint64_t> get_file_sizes_by_prefix(string prefix);
+
+    /**
+     * Handle the prefix size query.
+     */
+    void handle_prefix_size(int sock, const string &prefix_size_command);
+
     /**
      * Assign maple jobs to nodes using range based strategy.
      */
     void range_based_assign(map<string, MapleMission> &worker_mission_pair,
                             map<string, Member> &curr_membership_list,
-                            vector<string> &sdfs_source_files);
+                            vector<string> &sdfs_source_files, int base_mission_id);
 
     /**
      * Assign maple jobs to nodes using hash based strategy.
      */
     void hash_based_assign(map<string, MapleMission> &worker_mission_pair,
                            map<string, Member> &curr_membership_list,
-                           vector<string> &sdfs_source_files);
+                           vector<string> &sdfs_source_files, int base_mission_id);
 
     /**
-     * Monitor the maple task from a slave, should only be called by master node.
+     * Assign maple jobs to nodes in proportion to their expected rates, by the sizes of the files.
      */
-    void maple_task_monitor(MapleMission &mission, string target_ip, string maple_exe, string sdfs_prefix);
+    void load_based_assign(map<string, MapleMission> &worker_mission_pair,
+                           map<string, Member> &curr_membership_list, vector<string> &sdfs_source_files,
+                           const map<string, uint64_t> &file_sizes, int base_mission_id);
 
     /**
-     * Process a maple job, should only be called by slave node.
+     * Read a small sdfs file as text.
+     *
+     * Returns:
+     *      Return the file content, or an empty string if the file is not on sdfs.
      */
-    void maple_task_processor(int sock, string process_command);
+    string sdfs_read_text(const string &sdfs_filename);
+
+    /**
+     * Write a small text content to sdfs, overwriting the old version.
+     */
+    void sdfs_write_text(const string &sdfs_filename, const string &content);
 
     /**
-     * Monitor the juice task from a slave, should only be called by master node.
+     * Load the incremental manifest of an intermediate prefix, empty if there is none yet.
      */
-    void
-    juice_task_monitor(JuiceMission &mission, string target_ip, string juice_exe, string sdfs_dest, int delete_input);
+    IncrementalManifest load_manifest(const string &sdfs_prefix);
+
+    /**
+     * Store the incremental manifest of an intermediate prefix to sdfs.
+     */
+    void store_manifest(const string &sdfs_prefix, const IncrementalManifest &manifest);
+
+    /**
+     * Aggregate the partition profiles of the given maple missions into the skew report of an intermediate prefix,
+     * flagging the partitions far above the mean and the keys too heavy for any number of partitions.
+     *
+     * Returns:
+     *      Return a summary of the report for the reply to the client, empty if no mission left a profile.
+     */
+    string write_skew_report(const string &sdfs_prefix, uint64_t job_id, int first_mission_id, int num_missions);
+
+    /**
+     * Write a juice output as buckets by the maple partitioner of its keys, replacing the buckets of an earlier run,
+     * and its layout to "<sdfs_dest>.partitioning".
+     *
+     * Parameters:
+     *      local_path: The local file holding the whole juice output.
+     *
+     * Returns:
+     *      Return the layout written.
+     */
+    BucketLayout write_bucketed_output(const string &local_path, const string &sdfs_dest);
+
+    /**
+     * Load the layout of a bucketed output, named by its sdfs_dest or by "<sdfs_dest>.bucket".
+     *
+     * Returns:
+     *      Return false if the prefix is not a bucketed output.
+     */
+    bool load_bucket_layout(const string &sdfs_prefix, BucketLayout &layout);
+
+    /**
+     * Load the past runs of a job signature from the job history on sdfs, the oldest first.
+     */
+    vector<JobRun> load_job_history(const string &signature);
+
+    /**
+     * Append a finished run to the job history on sdfs, dropping the oldest runs of its signature beyond
+     * HISTORY_RUNS_PER_SIGNATURE.
+     */
+    void record_job_run(const JobRun &run);
+
+    /**
+     * Plan the tasks of a job from the past runs of its signature. The task durations are fitted to a start-up cost
+     * plus a processing rate, and a task gets at least HISTORY_WORK_TO_OVERHEAD_RATIO times its start-up cost of work.
+     *
+     * Parameters:
+     *      max_tasks: The most tasks the job can run, also the number of tasks without a history.
+     *
+     * Returns:
+     *      Return the tuning, with num_runs 0 if the signature has no history.
+     */
+    JobTuning tune_from_history(const string &signature, uint64_t input_bytes, int max_tasks);
+
+    /**
+     * Describe a tuning for the reply to the client: the number of tasks chosen or suggested, and for maple whether
+     * a combiner would pay off.
+     *
+     * Parameters:
+     *      num_name: "num_maples" or "num_juices".
+     *      requested: The number of tasks given by the user.
+     *      applied: Whether the job runs with the tuned number of tasks.
+     */
+    string describe_tuning(const JobTuning &tuning, const string &num_name, int requested, bool applied);
+
+    /**
+     * Durably record the outputs of a finished mission before acking the master, should only be called by slave node.
+     */
+    void commit_mission(const string &commit_filename, uint64_t job_id, const vector<string> &output_files);
+
+    /**
+     * Check whether a mission of the given job has committed outputs that are all still on sdfs.
+     */
+    bool check_mission_committed(const string &commit_filename, uint64_t job_id);
+
+    /**
+     * Block until a worker neither suspected by the failure detector nor blacklisted becomes free, then take it.
+     *
+     * Returns:
+     *      Return an empty string if all other workers are blacklisted and none is running a mission.
+     */
+    string acquire_free_worker(uint64_t job_id);
+
+    /**
+     * Put a worker that finished its mission to the free worker queue and wake up a waiting mission.
+     */
+    void release_free_worker(const string &worker_ip);
+
+    /**
+     * Empty the free worker queue before the first missions of a job are sent to num_leased workers.
+     */
+    void reset_free_workers(int num_leased);
+
+    /**
+     * Count a failed mission against its worker, which no longer runs a mission, and blacklist the worker if it
+     * keeps failing.
+     */
+    void record_worker_failure(const string &worker_ip, uint64_t job_id);
+
+    /**
+     * Expected processing rate of a worker in bytes per second, from the load in its last heartbeat.
+     */
+    double expected_worker_rate(const Member &member);
+
+    /**
+     * Assign items to workers in proportion to their expected rates: larger items first, each to the worker that
+     * would finish it the earliest.
+     *
+     * Returns:
+     *      Return the items of each worker, workers without an item are left out.
+     */
+    map<string, vector<string>> assign_by_expected_rate(const map<string, Member> &workers, vector<string> items,
+                                                        const map<string, uint64_t> &item_sizes);
+
+    /**
+     * Fold the throughput of a finished mission into the recent throughput of this worker.
+     */
+    void record_mission_throughput(uint64_t num_bytes, uint64_t elapsed_milliseconds);
+
+    /**
+     * Check whether a worker is blacklisted for the given job or cluster-wide.
+     */
+    bool is_blacklisted_worker(const string &worker_ip, uint64_t job_id);
+
+    /**
+     * Schedule the retry of a failed mission, later after each failure.
+     *
+     * Parameters:
+     *      retry_at: Set to the timestamp in milliseconds the mission is retried at.
+     *
+     * Returns:
+     *      Return false if the mission has used up its attempts, then it is aborted.
+     */
+    bool backoff_mission_retry(int &attempts, const string &kind, int mission_id, uint64_t &retry_at);
+
+    /**
+     * Give up a mission, so the job fails once its other missions are done.
+     */
+    void abort_mission(const string &kind, int mission_id);
+
+    /**
+     * Wait for all missions of the running stage to be done or aborted.
+     */
+    void wait_missions_done(int num_missions);
+
+    /**
+     * Put the alive members not assigned to the current job to the free worker queue, once per task slot.
+     */
+    void release_idle_workers(const set<string> &busy_workers);
+
+    /**
+     * Put the workers assigned to the current job to the free worker queue once per task slot beyond the first, so
+     * the missions waiting for a worker also run on the spare slots of the busy ones.
+     */
+    void release_spare_slots(const vector<string> &workers);
+
+    /**
+     * Called by the failure detector when a member is suspected, fails or leaves.
+     */
+    void notify_member_failure(const string &ip);
+
+    /**
+     * Called by the failure detector when a member joins again or is no longer suspected.
+     */
+    void notify_member_recovery(const string &ip);
+
+    /**
+     * Check whether a member is suspected or removed by the failure detector.
+     */
+    bool is_failed_worker(const string &ip);
+
+    /**
+     * Connect to the maple juice port of a worker with socket deadlines set.
+     *
+     * Returns:
+     *      Return the connected socket.
+     */
+    int connect_mission_worker(const string &target_ip);
+
+    /**
+     * Wait for a phase ack of a mission. Reading is done in MISSION_POLL_MILLISECONDS slices, so a worker
+     * suspected by the failure detector or missing the deadline fails the mission without waiting for TCP.
+     *
+     * Parameters:
+     *      pending: The bytes read but not consumed yet, acks can arrive in a single read.
+     */
+    void wait_mission_ack(int sock, const string &target_ip, const string &expected_ack, string &pending);
+
+    /**
+     * Wait for a newline terminated message on a mission socket, with the same checks as wait_mission_ack.
+     *
+     * Returns:
+     *      Return the line without the newline.
+     */
+    string read_mission_line(int sock, const string &target_ip, string &pending);
+
+    /**
+     * Read once from a mission socket into pending, throw if the peer is suspected, the deadline is exceeded or
+     * the connection is closed.
+     */
+    void read_mission_socket(int sock, const string &target_ip, const string &waiting_for, uint64_t deadline,
+                             string &pending);
+
+    /**
+     * Watch the missions of a stage until all are done or aborted, should only be called by master node. A single
+     * epoll loop on the calling thread drives every mission through connecting, sending its request and its three
+     * phase acks, with the deadlines and the failure detector checked once per poll slice. A dispatcher thread takes
+     * free workers for the missions beyond the given workers and for the retries, and MISSION_RECOVERY_THREADS
+     * threads recover the failed missions, so a stage uses a bounded number of threads whatever its missions.
+     *
+     * Parameters:
+     *      workers: The workers of the first missions, already leased by reset_free_workers.
+     *
+     * Returns:
+     *      Return the milliseconds of the successful attempt of each mission, 0 if the mission was found committed
+     *      after a failure.
+     */
+    vector<uint64_t> monitor_missions(vector<MonitoredMission> &missions, const vector<string> &workers,
+                                      uint64_t job_id);
+
+    /**
+     * Process a maple job, should only be called by slave node.
+     */
+    void maple_task_processor(int sock, string process_command);
 
     /**
      * Process a juice job, should only be called by slave node.
      */
     void juice_task_processor(int sock, string process_command);
 
+    /**
+     * Choose the workers of a job: the alive members other than this node, not blacklisted and with enough free disk,
+     * at most num_workers of them with the highest expected rates.
+     */
+    vector<string> select_mission_workers(int num_workers, uint64_t job_id);
+
+    /**
+     * Run native missions on the workers and wait for all of them to finish, should only be called by master node.
+     * Missions beyond the number of workers wait for a worker to become free.
+     *
+     * Parameters:
+     *      replayed: Whether the job is replayed from the journal, then committed missions are skipped.
+     */
+    void run_native_missions(vector<NativeMission> &missions, uint64_t job_id, int num_workers, bool replayed);
+
+    /**
+     * Process a native mission: run its operator, upload and commit the outputs, should only be called by slave node.
+     */
+    void native_task_processor(int sock, string process_command);
+
+    /**
+     * Run the built-in operator of a native mission, should only be called by slave node.
+     *
+     * Parameters:
+     *      mission_dir: The directory of the mission under files/fetched, for its inputs and outputs.
+     *
+     * Returns:
+     *      Return the sdfs names of the outputs, written to the mission directory under the same names.
+     */
+    vector<string> run_native_operator(const string &kind, int mission_id, const string &mission_dir,
+                                       stringstream &args);
+
+    /**
+     * Fetch a sdfs file to files/fetched.
+     *
+     * Parameters:
+     *      local_dir: The directory under files/fetched to fetch the file to, with a trailing '/'.
+     *
+     * Returns:
+     *      Return the local path of the fetched file.
+     */
+    string fetch_sdfs_file(const string &sdfs_filename, const string &local_dir = "");
+
+    /**
+     * Combine the outputs of missions into one sorted sdfs file and delete the outputs, should only be called by
+     * master node.
+     */
+    void combine_mission_outputs(const vector<string> &sdfs_outputs, const string &sdfs_dest);
+
+    /**
+     * Handle the join query from user, should only be called by master node.
+     */
+    void handle_join_query(MapleJuiceJob job);
+
+    /**
+     * Tag and hash partition the records of one side of a reduce side join.
+     */
+    vector<string> join_map_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Join the tagged records of one partition of a reduce side join.
+     */
+    vector<string> join_reduce_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Probe the records of large side files against the in-memory hash table of the small side.
+     */
+    vector<string> broadcast_join_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Handle the declarative query from user, compiled to map and reduce missions, should only be called by master
+     * node.
+     */
+    void handle_sql_query(MapleJuiceJob job);
+
+    /**
+     * Filter, project and partially aggregate a source file of a query.
+     */
+    vector<string> query_map_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Merge the partial aggregates of one partition of a query.
+     */
+    vector<string> query_reduce_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Apply ORDER BY and LIMIT to the mission outputs of a query and write the result to sdfs, should only be called
+     * by master node.
+     */
+    void finalize_query_output(const QueryPlan &plan, const vector<string> &sdfs_outputs, const string &sdfs_dest);
+
+    /**
+     * Handle the iterative graph query from user, should only be called by master node.
+     */
+    void handle_graph_query(MapleJuiceJob job);
+
+    /**
+     * Run a graph job on the workers from its last checkpoint to convergence, should only be called by master node.
+     *
+     * Returns:
+     *      Return false if a worker fails, then the job has to be restarted from its last checkpoint.
+     */
+    bool run_graph_supersteps(uint64_t job_id, const string &algorithm, const vector<string> &edge_files,
+                              const string &sdfs_dest, int num_workers, int max_supersteps, uint64_t source);
+
+    /**
+     * Hold a graph partition and run the commands of the master on it, should only be called by slave node.
+     */
+    void graph_task_processor(int sock, string process_command);
+
+    /**
+     * Receive the messages of a superstep from another worker, should only be called by slave node.
+     */
+    void graph_message_receiver(int sock, string process_command);
+
+    /**
+     * Fetch the edge files of this worker, shuffle the edges to the owners of their vertices and build the CSR layout.
+     */
+    string load_graph_partition(GraphPartition &partition);
+
+    /**
+     * Set the initial vertex state, or restore it from a checkpoint.
+     */
+    string init_graph_partition(GraphPartition &partition, stringstream &args);
+
+    /**
+     * Send the messages of the active vertices, combined per target vertex, and apply the received ones.
+     */
+    string run_graph_superstep(GraphPartition &partition, stringstream &args);
+
+    /**
+     * Write the vertex state of this worker to a sdfs file, as a checkpoint or as the job output.
+     */
+    void write_graph_state(GraphPartition &partition, const string &sdfs_filename);
+
+    /**
+     * Send the messages of a superstep to all other workers and wait for theirs.
+     *
+     * Parameters:
+     *      outgoing: The (vertex, value bits) pairs for each worker.
+     *
+     * Returns:
+     *      Return the pairs received by this worker, including its own.
+     */
+    vector<uint64_t> exchange_graph_messages(GraphPartition &partition, int superstep,
+                                             vector<vector<uint64_t>> &outgoing);
+
+    /**
+     * Send the length prefixed messages of a superstep to another worker.
+     */
+    void send_graph_messages(GraphPartition &partition, int superstep, int target_index,
+                             const vector<uint64_t> &messages);
+
+    /**
+     * Handle the total order sort query from user, should only be called by master node.
+     */
+    void handle_sort_query(MapleJuiceJob job);
+
+    /**
+     * Sample the keys of a source file of a sort job.
+     */
+    vector<string> sort_sample_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Range partition a source file of a sort job by the split points, and sort each range.
+     */
+    vector<string> sort_map_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Merge the sorted runs of one range of a sort job into an output partition.
+     */
+    vector<string> sort_reduce_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Handle the inverted index query from user, should only be called by master node.
+     */
+    void handle_index_query(MapleJuiceJob job);
+
+    /**
+     * Partition the (term, document) pairs of a source file of an index job by term, as runs sorted by term.
+     */
+    vector<string> index_map_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Merge the runs of one partition of an index job into its term dictionary and compressed posting lists.
+     */
+    vector<string> index_reduce_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Handle the sketch query from user, should only be called by master node. Each source file is summarized by a
+     * distinct count, heavy hitter or quantile sketch on a worker, the master merges the sketches into sdfs_dest.
+     */
+    void handle_sketch_query(MapleJuiceJob job);
+
+    /**
+     * Summarize a column of a source file of a sketch job into a sketch.
+     */
+    vector<string> sketch_map_operator(int mission_id, const string &mission_dir, stringstream &args);
+
+    /**
+     * Handle a micro batch of a stream job, or stop a stream job, should only be called by master node. A batch maps
+     * the source files added since the previous batch, reduces them to the partial aggregate of the batch, emits the
+     * aggregate of the window to sdfs_dest and queues the next batch one interval later.
+     */
+    void handle_stream_query(MapleJuiceJob job);
+
     /**
      * Receive maple juice requests, should only be called by slave node.
      */
@@ -0,0 +1,597 @@
+/**
+ * server_graph.cpp
+ * Implementation of iterative graph funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_graph.h"
+#include "general.h"
+#include <endian.h>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+
+/**
+ * Format a double without losing precision, aggregates and ranks are exchanged as text.
+ */
+string format_graph_double(double value) {
+    ostringstream oss;
+    oss << setprecision(17) << value;
+    return oss.str();
+}
+
+/// Vertex values travel in the message pairs as their bit patterns.
+uint64_t graph_double_to_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double graph_bits_to_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Send a newline terminated command or reply on a graph control socket.
+ */
+void send_graph_line(int sock, const string &line) {
+    string message = line + "\n";
+    if (send(sock, message.c_str(), message.size(), MSG_NOSIGNAL) == -1)
+        throw runtime_error("Sending graph message failed: " + line);
+}
+
+/**
+ * Find the index of an owned vertex in the CSR layout.
+ *
+ * Returns:
+ *      Return the index, or -1 if the vertex is not in this partition.
+ */
+int64_t find_local_vertex(const GraphPartition &partition, uint64_t vertex) {
+    auto it = lower_bound(partition.vertex_ids.begin(), partition.vertex_ids.end(), vertex);
+    if (it == partition.vertex_ids.end() || *it != vertex) return -1;
+    return it - partition.vertex_ids.begin();
+}
+
+/**
+ * Sum the rank of the owned vertices without out edges, it is spread over all vertices in the next superstep.
+ */
+double local_dangling_rank(const GraphPartition &partition) {
+    double dangling = 0;
+    if (partition.algorithm != "pagerank") return dangling;
+    for (size_t i = 0; i < partition.vertex_ids.size(); i++)
+        if (partition.offsets[i] == partition.offsets[i + 1]) dangling += partition.values[i];
+    return dangling;
+}
+
+void server::handle_graph_query(MapleJuiceJob job) {
+    string command = job.command, phase, algorithm, sdfs_prefix, sdfs_dest;
+    int num_workers = 0, max_supersteps = 0;
+    uint64_t source = 0;
+    cout << "### Receive graph query:" << command << endl;
+
+    try {
+        /// Decode graph command.
+        stringstream ss(command);
+        ss >> phase >> algorithm >> num_workers >> sdfs_prefix >> sdfs_dest >> max_supersteps >> source;
+
+        /// Conduct error handling.
+        if (phase != "graph" || (algorithm != "pagerank" && algorithm != "cc" && algorithm != "bfs") ||
+            max_supersteps <= 0)
+            throw runtime_error("Command type error!");
+
+        vector<string> edge_files = check_all_exist_file_by_prefix(sdfs_prefix);
+        if (edge_files.empty())
+            throw runtime_error("No such sdfs edge file prefix!");
+
+        /// A failed run is restarted on the alive workers from the last checkpoint.
+        int num_restarts = 0;
+        while (!run_graph_supersteps(job.job_id, algorithm, edge_files, sdfs_dest, num_workers, max_supersteps,
+                                     source)) {
+            if (++num_restarts > GRAPH_MAX_RESTARTS)
+                throw runtime_error("Graph job failed after " + to_string(GRAPH_MAX_RESTARTS) + " restarts!");
+            cout << "### Restart graph job from its last checkpoint..." << endl;
+        }
+
+        delete_all_file_by_prefix(sdfs_dest + GRAPH_STATE_INFIX);
+        delete_all_file_by_prefix(sdfs_dest + GRAPH_CHECKPOINT_SUFFIX);
+
+        reply_to_client(job.sock, "Graph job: (" + command + ") finished!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+bool server::run_graph_supersteps(uint64_t job_id, const string &algorithm, const vector<string> &edge_files,
+                                  const string &sdfs_dest, int num_workers, int max_supersteps, uint64_t source) {
+    vector<string> workers = select_mission_workers(num_workers, job_id);
+    if (workers.empty())
+        throw runtime_error("No enough workers!");
+    int num = (int) workers.size();
+    uint64_t run_id = get_curr_timestamp_milliseconds();
+
+    /// A replayed or restarted job resumes from its last checkpoint.
+    int superstep = 0, checkpoint_superstep = 0;
+    uint64_t checkpoint_job_id = 0;
+    stringstream checkpoint(sdfs_read_text(sdfs_dest + GRAPH_CHECKPOINT_SUFFIX));
+    if (checkpoint >> checkpoint_job_id >> checkpoint_superstep && checkpoint_job_id == job_id)
+        superstep = checkpoint_superstep;
+    else checkpoint_superstep = 0;
+
+    vector<int> socks(num, -1);
+    vector<string> pending(num);
+    vector<string> outputs;
+
+    /// Every command runs on all workers in parallel, then the replies are collected.
+    auto collect_replies = [&](const string &expected_reply) {
+        vector<string> replies;
+        for (int i = 0; i < num; i++) {
+            string reply = read_mission_line(socks[i], workers[i], pending[i]);
+            if (reply.compare(0, expected_reply.size(), expected_reply) != 0)
+                throw runtime_error("Unexpected reply from " + workers[i] + ": " + reply);
+            replies.push_back(reply.substr(expected_reply.size()));
+        }
+        return replies;
+    };
+    auto run_command = [&](const string &graph_command, const string &expected_reply) {
+        for (int i = 0; i < num; i++) send_graph_line(socks[i], graph_command);
+        return collect_replies(expected_reply);
+    };
+
+    try {
+        /// Start the workers, the edge files are spread over them round robin.
+        string worker_list;
+        for (const auto &ip : workers) worker_list += " " + ip;
+        for (int i = 0; i < num; i++) {
+            socks[i] = connect_mission_worker(workers[i]);
+            string request = "graph_start " + to_string(run_id) + " " + to_string(i) + " " + algorithm + " " +
+                             sdfs_dest + " " + to_string(num) + worker_list;
+            for (size_t file = i; file < edge_files.size(); file += num) request += " " + edge_files[file];
+            send_graph_line(socks[i], request);
+        }
+        collect_replies("graph_started");
+
+        uint64_t num_vertices = 0, num_edges = 0;
+        for (const auto &reply : run_command("graph_load", "graph_loaded")) {
+            stringstream ss(reply);
+            uint64_t worker_vertices = 0, worker_edges = 0;
+            ss >> worker_vertices >> worker_edges;
+            num_vertices += worker_vertices;
+            num_edges += worker_edges;
+        }
+        cout << "### Graph loaded: " << num_vertices << " vertices, " << num_edges << " edges on " << num
+             << " workers" << endl;
+
+        double dangling = 0;
+        for (const auto &reply : run_command("graph_init " + to_string(num_vertices) + " " + to_string(source) + " " +
+                                             to_string(checkpoint_superstep), "graph_ready")) {
+            stringstream ss(reply);
+            double worker_dangling = 0;
+            ss >> worker_dangling;
+            dangling += worker_dangling;
+        }
+
+        while (superstep < max_supersteps) {
+            superstep++;
+            uint64_t num_changed = 0;
+            double next_dangling = 0, delta = 0;
+            for (const auto &reply : run_command("graph_superstep " + to_string(superstep) + " " +
+                                                 format_graph_double(dangling), "graph_superstep_done")) {
+                stringstream ss(reply);
+                uint64_t worker_changed = 0;
+                double worker_dangling = 0, worker_delta = 0;
+                ss >> worker_changed >> worker_dangling >> worker_delta;
+                num_changed += worker_changed;
+                next_dangling += worker_dangling;
+                delta += worker_delta;
+            }
+            dangling = next_dangling;
+            cout << "### Graph superstep " << superstep << ": " << num_changed << " vertices changed" << endl;
+
+            bool converged = algorithm == "pagerank" ? delta < GRAPH_PAGERANK_TOLERANCE : num_changed == 0;
+            if (converged || superstep == max_supersteps) break;
+
+            if (superstep % GRAPH_CHECKPOINT_SUPERSTEPS == 0) {
+                run_command("graph_checkpoint " + to_string(superstep), "graph_checkpointed");
+                sdfs_write_text(sdfs_dest + GRAPH_CHECKPOINT_SUFFIX, to_string(job_id) + " " + to_string(superstep));
+                if (checkpoint_superstep > 0)
+                    delete_all_file_by_prefix(sdfs_dest + GRAPH_STATE_INFIX + to_string(checkpoint_superstep) + "_");
+                checkpoint_superstep = superstep;
+                cout << "### Graph checkpoint written at superstep " << superstep << endl;
+            }
+        }
+
+        run_command("graph_output", "graph_output_done");
+        for (int i = 0; i < num; i++) outputs.push_back(sdfs_dest + "_" + to_string(i));
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        for (int sock : socks) if (sock >= 0) close(sock);
+        return false;
+    }
+
+    for (int sock : socks) close(sock);
+    combine_mission_outputs(outputs, sdfs_dest);
+    return true;
+}
+
+void server::graph_task_processor(int sock, string process_command) {
+    /// Decode the received graph command.
+    auto partition = make_shared<GraphPartition>();
+    stringstream ss(process_command);
+    string command, item, pending;
+    int num_workers = 0;
+    ss >> command >> partition->run_id >> partition->worker_index >> partition->algorithm >> partition->sdfs_dest
+       >> num_workers;
+    for (int i = 0; i < num_workers && ss >> item; i++) partition->worker_ips.push_back(item);
+    while (ss >> item) partition->edge_files.push_back(item);
+
+    /// Commands are read in slices like acks on the master, so a failed master drops the partition.
+    struct sockaddr_in master_addr{};
+    socklen_t addr_len = sizeof(master_addr);
+    getpeername(sock, (struct sockaddr *) &master_addr, &addr_len);
+    string master_ip = inet_ntoa(master_addr.sin_addr);
+    struct timeval poll_timeout{0, MISSION_POLL_MILLISECONDS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &poll_timeout, sizeof(poll_timeout));
+
+    graph_lock.lock();
+    graph_partition = partition;
+    graph_lock.unlock();
+    graph_inbox_cv.notify_all();
+
+    string state_prefix = partition->sdfs_dest + GRAPH_STATE_INFIX;
+    string worker_index = to_string(partition->worker_index);
+    try {
+        send_graph_line(sock, "graph_started");
+        while (true) {
+            stringstream args(read_mission_line(sock, master_ip, pending));
+            string reply;
+            args >> command;
+            if (command == "graph_load") {
+                reply = load_graph_partition(*partition);
+            } else if (command == "graph_init") {
+                reply = init_graph_partition(*partition, args);
+            } else if (command == "graph_superstep") {
+                reply = run_graph_superstep(*partition, args);
+            } else if (command == "graph_checkpoint") {
+                string superstep;
+                args >> superstep;
+                write_graph_state(*partition, state_prefix + superstep + "_" + worker_index);
+                reply = "graph_checkpointed";
+            } else if (command == "graph_output") {
+                write_graph_state(*partition, partition->sdfs_dest + "_" + worker_index);
+                send_graph_line(sock, "graph_output_done");
+                cout << "### Graph partition " << worker_index << " output uploaded!" << endl;
+                break;
+            } else {
+                throw runtime_error("No such graph command: " + command);
+            }
+            send_graph_line(sock, reply);
+        }
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+
+    graph_lock.lock();
+    if (graph_partition == partition) graph_partition.reset();
+    graph_lock.unlock();
+    close(sock);
+}
+
+void server::graph_message_receiver(int sock, string process_command) {
+    stringstream ss(process_command);
+    string command, pending;
+    uint64_t run_id = 0, num_bytes = 0;
+    int superstep = 0, from_index = -1;
+    ss >> command >> run_id >> superstep >> from_index >> num_bytes;
+
+    graph_lock.lock();
+    shared_ptr<GraphPartition> partition = graph_partition;
+    graph_lock.unlock();
+
+    try {
+        if (!partition || partition->run_id != run_id || from_index < 0 ||
+            from_index >= (int) partition->worker_ips.size() || num_bytes % sizeof(uint64_t) != 0)
+            throw runtime_error("Unexpected graph messages: " + process_command);
+
+        string response = "graph_messages_ready";
+        send(sock, response.c_str(), response.size(), MSG_NOSIGNAL);
+
+        /// Read the length prefixed block, then convert it back from network byte order.
+        struct timeval poll_timeout{0, MISSION_POLL_MILLISECONDS * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &poll_timeout, sizeof(poll_timeout));
+        auto deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+        pending.reserve(num_bytes);
+        while (pending.size() < num_bytes)
+            read_mission_socket(sock, partition->worker_ips[from_index], "graph messages", deadline, pending);
+        vector<uint64_t> messages(num_bytes / sizeof(uint64_t));
+        memcpy(messages.data(), pending.data(), num_bytes);
+        for (auto &value : messages) value = be64toh(value);
+
+        graph_lock.lock();
+        vector<uint64_t> &inbox = partition->inbox[superstep];
+        inbox.insert(inbox.end(), messages.begin(), messages.end());
+        partition->inbox_count[superstep]++;
+        graph_lock.unlock();
+        graph_inbox_cv.notify_all();
+
+        response = "graph_messages_received";
+        send(sock, response.c_str(), response.size(), MSG_NOSIGNAL);
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+    close(sock);
+}
+
+string server::load_graph_partition(GraphPartition &partition) {
+    int num_workers = (int) partition.worker_ips.size();
+    bool undirected = partition.algorithm == "cc";
+    vector<vector<uint64_t>> outgoing(num_workers);
+    string line;
+
+    /// Each edge goes to the owner of its source, its target is registered on its own owner.
+    for (const auto &file : partition.edge_files) {
+        string local_file = fetch_sdfs_file(file);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            stringstream ss(line);
+            uint64_t src = 0, dst = 0;
+            if (line.empty() || line[0] == '#' || !(ss >> src >> dst)) continue;
+            vector<uint64_t> &to_src = outgoing[graph_vertex_owner(src, num_workers)];
+            to_src.push_back(src);
+            to_src.push_back(dst);
+            vector<uint64_t> &to_dst = outgoing[graph_vertex_owner(dst, num_workers)];
+            to_dst.push_back(dst);
+            to_dst.push_back(undirected ? src : GRAPH_NO_EDGE);
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+
+    vector<uint64_t> received = exchange_graph_messages(partition, 0, outgoing);
+    outgoing.clear();
+
+    /// Sort the edges by source to lay them out as CSR, a duplicated edge is kept once.
+    vector<pair<uint64_t, uint64_t>> edges(received.size() / 2);
+    for (size_t i = 0; i < edges.size(); i++) edges[i] = {received[2 * i], received[2 * i + 1]};
+    vector<uint64_t>().swap(received);
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+    partition.vertex_ids.clear();
+    partition.offsets.clear();
+    partition.targets.clear();
+    for (const auto &edge : edges) {
+        if (partition.vertex_ids.empty() || partition.vertex_ids.back() != edge.first) {
+            partition.vertex_ids.push_back(edge.first);
+            partition.offsets.push_back(partition.targets.size());
+        }
+        if (edge.second != GRAPH_NO_EDGE) partition.targets.push_back(edge.second);
+    }
+    partition.offsets.push_back(partition.targets.size());
+
+    return "graph_loaded " + to_string(partition.vertex_ids.size()) + " " + to_string(partition.targets.size());
+}
+
+string server::init_graph_partition(GraphPartition &partition, stringstream &args) {
+    uint64_t source = 0;
+    int checkpoint_superstep = 0;
+    args >> partition.num_vertices >> source >> checkpoint_superstep;
+    size_t num_local = partition.vertex_ids.size();
+    const double unreached = numeric_limits<double>::infinity();
+
+    /// PageRank starts uniform, components start with their own id as label, bfs starts from the source only.
+    if (partition.algorithm == "pagerank") {
+        partition.values.assign(num_local, 1.0 / (double) max<uint64_t>(partition.num_vertices, 1));
+        partition.active.assign(num_local, true);
+    } else if (partition.algorithm == "cc") {
+        partition.values.resize(num_local);
+        for (size_t i = 0; i < num_local; i++) partition.values[i] = (double) partition.vertex_ids[i];
+        partition.active.assign(num_local, true);
+    } else {
+        partition.values.assign(num_local, unreached);
+        partition.active.assign(num_local, false);
+        int64_t index = find_local_vertex(partition, source);
+        if (index >= 0) {
+            partition.values[index] = 0;
+            partition.active[index] = true;
+        }
+    }
+
+    /// Restore the owned vertices from all state files of the checkpoint, the number of workers may have changed.
+    if (checkpoint_superstep > 0) {
+        int num_workers = (int) partition.worker_ips.size();
+        string prefix = partition.sdfs_dest + GRAPH_STATE_INFIX + to_string(checkpoint_superstep) + "_";
+        for (const auto &file : check_all_exist_file_by_prefix(prefix)) {
+            string local_file = fetch_sdfs_file(file);
+            ifstream infile(local_file);
+            uint64_t vertex = 0;
+            double value = 0;
+            while (infile >> vertex >> value) {
+                if (graph_vertex_owner(vertex, num_workers) != partition.worker_index) continue;
+                int64_t index = find_local_vertex(partition, vertex);
+                if (index >= 0) partition.values[index] = value;
+            }
+            infile.close();
+            remove(local_file.c_str());
+        }
+        /// Reached vertices send their distance again, taking the minimum makes it harmless.
+        if (partition.algorithm == "bfs")
+            for (size_t i = 0; i < num_local; i++) partition.active[i] = partition.values[i] != unreached;
+    }
+
+    return "graph_ready " + format_graph_double(local_dangling_rank(partition));
+}
+
+string server::run_graph_superstep(GraphPartition &partition, stringstream &args) {
+    int superstep = 0;
+    double dangling = 0;
+    args >> superstep >> dangling;
+    int num_workers = (int) partition.worker_ips.size();
+    size_t num_local = partition.vertex_ids.size();
+    bool pagerank = partition.algorithm == "pagerank";
+    bool bfs = partition.algorithm == "bfs";
+
+    /// Messages to the same target are combined before sending: rank shares are summed, labels and distances
+    /// keep the minimum.
+    vector<unordered_map<uint64_t, double>> combined(num_workers);
+    for (size_t i = 0; i < num_local; i++) {
+        uint64_t begin = partition.offsets[i], end = partition.offsets[i + 1];
+        if (begin == end || !partition.active[i]) continue;
+        double message = pagerank ? partition.values[i] / (double) (end - begin) :
+                         bfs ? partition.values[i] + 1 : partition.values[i];
+        for (uint64_t edge = begin; edge < end; edge++) {
+            uint64_t target = partition.targets[edge];
+            auto &slot = combined[graph_vertex_owner(target, num_workers)];
+            auto it = slot.find(target);
+            if (it == slot.end()) slot.emplace(target, message);
+            else if (pagerank) it->second += message;
+            else it->second = min(it->second, message);
+        }
+    }
+
+    vector<vector<uint64_t>> outgoing(num_workers);
+    for (int worker = 0; worker < num_workers; worker++) {
+        outgoing[worker].reserve(combined[worker].size() * 2);
+        for (const auto &item : combined[worker]) {
+            outgoing[worker].push_back(item.first);
+            outgoing[worker].push_back(graph_double_to_bits(item.second));
+        }
+        unordered_map<uint64_t, double>().swap(combined[worker]);
+    }
+
+    vector<uint64_t> received = exchange_graph_messages(partition, superstep, outgoing);
+
+    vector<double> incoming(num_local, pagerank ? 0 : numeric_limits<double>::infinity());
+    for (size_t i = 0; i + 1 < received.size(); i += 2) {
+        int64_t index = find_local_vertex(partition, received[i]);
+        if (index < 0) continue;
+        double value = graph_bits_to_double(received[i + 1]);
+        if (pagerank) incoming[index] += value;
+        else incoming[index] = min(incoming[index], value);
+    }
+
+    uint64_t num_changed = 0;
+    double delta = 0;
+    double num_vertices = (double) max<uint64_t>(partition.num_vertices, 1);
+    for (size_t i = 0; i < num_local; i++) {
+        if (pagerank) {
+            double rank = (1 - GRAPH_PAGERANK_DAMPING) / num_vertices +
+                          GRAPH_PAGERANK_DAMPING * (incoming[i] + dangling / num_vertices);
+            delta += fabs(rank - partition.values[i]);
+            if (rank != partition.values[i]) num_changed++;
+            partition.values[i] = rank;
+        } else {
+            partition.active[i] = incoming[i] < partition.values[i];
+            if (partition.active[i]) {
+                partition.values[i] = incoming[i];
+                num_changed++;
+            }
+        }
+    }
+
+    return "graph_superstep_done " + to_string(num_changed) + " " +
+           format_graph_double(local_dangling_rank(partition)) + " " + format_graph_double(delta);
+}
+
+void server::write_graph_state(GraphPartition &partition, const string &sdfs_filename) {
+    string local_file = curr_dir + "/files/fetched/" + sdfs_filename;
+    ofstream ofs(local_file);
+    ofs << setprecision(17);
+    for (size_t i = 0; i < partition.vertex_ids.size(); i++) {
+        double value = partition.values[i];
+        if (std::isinf(value)) continue;
+        ofs << partition.vertex_ids[i] << "\t";
+        if (partition.algorithm == "pagerank") ofs << value;
+        else ofs << (uint64_t) value;
+        ofs << "\n";
+    }
+    ofs.close();
+    maple_juice_put(local_file, sdfs_filename);
+    remove(local_file.c_str());
+}
+
+vector<uint64_t> server::exchange_graph_messages(GraphPartition &partition, int superstep,
+                                                 vector<vector<uint64_t>> &outgoing) {
+    int num_workers = (int) partition.worker_ips.size();
+    atomic<bool> send_failed{false};
+    vector<thread> senders;
+    for (int worker = 0; worker < num_workers; worker++) {
+        if (worker == partition.worker_index) continue;
+        senders.emplace_back([this, &partition, &outgoing, &send_failed, superstep, worker]() {
+            try {
+                send_graph_messages(partition, superstep, worker, outgoing[worker]);
+            } catch (runtime_error &e) {
+                std::cerr << "error: " << e.what() << std::endl;
+                send_failed = true;
+            }
+        });
+    }
+    for (auto &sender : senders) sender.join();
+    if (send_failed)
+        throw runtime_error("Sending graph messages of superstep " + to_string(superstep) + " failed");
+
+    /// Every other worker sends exactly one block per superstep, even an empty one.
+    vector<uint64_t> received;
+    {
+        unique_lock<mutex> lock(graph_lock);
+        auto deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+        while (partition.inbox_count[superstep] < num_workers - 1) {
+            if (graph_partition.get() != &partition)
+                throw runtime_error("Graph job restarted in superstep " + to_string(superstep));
+            for (const auto &ip : partition.worker_ips)
+                if (is_failed_worker(ip))
+                    throw runtime_error("Failure detected on " + ip + " in superstep " + to_string(superstep));
+            if (get_curr_timestamp_milliseconds() > deadline)
+                throw runtime_error("Deadline exceeded in superstep " + to_string(superstep));
+            graph_inbox_cv.wait_for(lock, chrono::milliseconds(MISSION_POLL_MILLISECONDS));
+        }
+        received.swap(partition.inbox[superstep]);
+        partition.inbox.erase(superstep);
+        partition.inbox_count.erase(superstep);
+    }
+
+    vector<uint64_t> &own = outgoing[partition.worker_index];
+    received.insert(received.end(), own.begin(), own.end());
+    return received;
+}
+
+void server::send_graph_messages(GraphPartition &partition, int superstep, int target_index,
+                                 const vector<uint64_t> &messages) {
+    const string &target_ip = partition.worker_ips[target_index];
+    vector<uint64_t> payload(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) payload[i] = htobe64(messages[i]);
+    size_t num_bytes = payload.size() * sizeof(uint64_t);
+    string pending;
+
+    int sock = connect_mission_worker(target_ip);
+    try {
+        /// #1 Send: the header with the length of the block.
+        string header = "graph_messages " + to_string(partition.run_id) + " " + to_string(superstep) + " " +
+                        to_string(partition.worker_index) + " " + to_string(num_bytes);
+        if (send(sock, header.c_str(), header.size(), MSG_NOSIGNAL) == -1)
+            throw runtime_error("Sending graph messages header to " + target_ip + " failed");
+        wait_mission_ack(sock, target_ip, "graph_messages_ready", pending);
+
+        /// #2 Send: the block of (vertex, value bits) pairs.
+        const char *data = (const char *) payload.data();
+        size_t num_sent = 0;
+        auto deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+        while (num_sent < num_bytes) {
+            ssize_t num = send(sock, data + num_sent, num_bytes - num_sent, MSG_NOSIGNAL);
+            if (num < 0) {
+                if ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && !is_failed_worker(target_ip) &&
+                    get_curr_timestamp_milliseconds() < deadline)
+                    continue;
+                throw runtime_error("Sending graph messages to " + target_ip + " failed");
+            }
+            num_sent += num;
+        }
+        wait_mission_ack(sock, target_ip, "graph_messages_received", pending);
+    } catch (runtime_error &e) {
+        close(sock);
+        throw;
+    }
+    close(sock);
+}
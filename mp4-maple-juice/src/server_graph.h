@@ -0,0 +1,72 @@
+/**
+ * server_graph.h
+ * Define iterative graph contents used in server.
+ */
+
+#ifndef SERVER_GRAPH_H
+#define SERVER_GRAPH_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+/// Record of the last checkpoint of a graph job on sdfs: "<job_id> <superstep>".
+#define GRAPH_CHECKPOINT_SUFFIX ".graph_checkpoint"
+
+/// Infix of the vertex state files of a checkpoint, followed by "<superstep>_<worker>".
+#define GRAPH_STATE_INFIX ".graph_state_"
+
+/// Write a checkpoint every this number of supersteps.
+#define GRAPH_CHECKPOINT_SUPERSTEPS 5
+
+/// Give up a graph job after this number of restarts from its checkpoint.
+#define GRAPH_MAX_RESTARTS 3
+
+#define GRAPH_PAGERANK_DAMPING 0.85
+
+/// PageRank converges when the sum of rank changes in a superstep is below this value.
+#define GRAPH_PAGERANK_TOLERANCE 1e-6
+
+/// Target of the placeholder edge registering a vertex without out edges on its owner.
+#define GRAPH_NO_EDGE UINT64_MAX
+
+/// The graph partition loaded by a worker, kept in memory across the supersteps of a graph job.
+class GraphPartition {
+public:
+    /// Id of this run of the job, a restarted job gets a new one so late messages of the old run are dropped.
+    uint64_t run_id = 0;
+    int worker_index = 0;
+    vector<string> worker_ips;
+    string algorithm;
+    string sdfs_dest;
+    vector<string> edge_files;
+    /// The number of vertices of the whole graph.
+    uint64_t num_vertices = 0;
+
+    /// CSR layout: the sorted ids of the owned vertices, the out edges of the i-th vertex are
+    /// targets[offsets[i]] to targets[offsets[i + 1] - 1].
+    vector<uint64_t> vertex_ids;
+    vector<uint64_t> offsets;
+    vector<uint64_t> targets;
+
+    /// Vertex state, and whether a vertex changed in the last superstep and has to send messages.
+    vector<double> values;
+    vector<bool> active;
+
+    /// Messages from the other workers of each superstep as flat (vertex, value bits) pairs, guarded by graph_lock.
+    map<int, vector<uint64_t>> inbox;
+    map<int, int> inbox_count;
+};
+
+/**
+ * Find the worker owning a vertex, the id is mixed first so consecutive ids spread over the workers.
+ */
+inline int graph_vertex_owner(uint64_t vertex, int num_workers) {
+    vertex ^= vertex >> 33;
+    vertex *= 0xff51afd7ed558ccdULL;
+    vertex ^= vertex >> 33;
+    return (int) (vertex % num_workers);
+}
+
+#endif //SERVER_GRAPH_H
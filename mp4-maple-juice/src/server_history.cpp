@@ -0,0 +1,130 @@
+/**
+ * server_history.cpp
+ * Implementation of the job history funcs in server_func.h, used by the master to plan recurring jobs.
+ */
+
+#include "server_func.h"
+#include "server_history.h"
+#include "general.h"
+#include <iomanip>
+
+string JobRun::serialize() const {
+    string line = signature + " " + to_string(job_id) + " " + to_string(input_bytes) + " " + to_string(shuffle_bytes) +
+                  " " + to_string(elapsed_milliseconds) + " " + to_string(tasks.size());
+    for (const auto &task : tasks) line += " " + to_string(task.first) + " " + to_string(task.second);
+    return line;
+}
+
+bool JobRun::deserialize(const string &line) {
+    stringstream ss(line);
+    size_t num_tasks = 0;
+    if (!(ss >> signature >> job_id >> input_bytes >> shuffle_bytes >> elapsed_milliseconds >> num_tasks))
+        return false;
+    tasks.clear();
+    for (size_t i = 0; i < num_tasks; i++) {
+        pair<uint64_t, uint64_t> task;
+        if (!(ss >> task.first >> task.second)) return false;
+        tasks.push_back(task);
+    }
+    return true;
+}
+
+vector<JobRun> server::load_job_history(const string &signature) {
+    vector<JobRun> runs;
+    stringstream ss(sdfs_read_text(MJ_HISTORY_FILE));
+    string line;
+    while (getline(ss, line)) {
+        JobRun run;
+        if (run.deserialize(line) && run.signature == signature) runs.push_back(run);
+    }
+    return runs;
+}
+
+void server::record_job_run(const JobRun &run) {
+    /// Only the last runs of each signature are kept, the file holds the runs in the order they finished.
+    stringstream ss(sdfs_read_text(MJ_HISTORY_FILE));
+    vector<string> lines;
+    map<string, int> num_runs;
+    string line;
+    while (getline(ss, line)) {
+        JobRun recorded;
+        if (!recorded.deserialize(line)) continue;
+        lines.push_back(line);
+        num_runs[recorded.signature]++;
+    }
+    lines.push_back(run.serialize());
+    num_runs[run.signature]++;
+
+    string content;
+    for (const auto &recorded_line : lines) {
+        string signature = recorded_line.substr(0, recorded_line.find(' '));
+        if (signature == run.signature && num_runs[signature] > HISTORY_RUNS_PER_SIGNATURE) {
+            num_runs[signature]--;
+            continue;
+        }
+        content += recorded_line + "\n";
+    }
+    sdfs_write_text(MJ_HISTORY_FILE, content);
+}
+
+JobTuning server::tune_from_history(const string &signature, uint64_t input_bytes, int max_tasks) {
+    JobTuning tuning;
+    vector<JobRun> runs = load_job_history(signature);
+    tuning.num_runs = (int) runs.size();
+    tuning.num_tasks = max(max_tasks, 1);
+    if (runs.empty()) return tuning;
+
+    /// Fit the duration of a task to "overhead + bytes / rate" over the tasks of all runs by least squares.
+    double num_points = 0, sum_bytes = 0, sum_milliseconds = 0, sum_bytes_squared = 0, sum_product = 0;
+    double num_ratios = 0, sum_ratios = 0;
+    for (const auto &run : runs) {
+        for (const auto &task : run.tasks) {
+            if (task.first == 0 || task.second == 0) continue;
+            double bytes = (double) task.first, milliseconds = (double) task.second;
+            num_points++;
+            sum_bytes += bytes;
+            sum_milliseconds += milliseconds;
+            sum_bytes_squared += bytes * bytes;
+            sum_product += bytes * milliseconds;
+        }
+        if (run.input_bytes > 0) {
+            num_ratios++;
+            sum_ratios += (double) run.shuffle_bytes / (double) run.input_bytes;
+        }
+    }
+    if (num_ratios > 0) tuning.shuffle_ratio = sum_ratios / num_ratios;
+    if (num_points == 0) return tuning;
+
+    double variance = sum_bytes_squared / num_points - pow(sum_bytes / num_points, 2);
+    double slope = variance > 0 ?
+                   (sum_product / num_points - sum_bytes / num_points * sum_milliseconds / num_points) / variance : 0;
+    if (slope > 0) {
+        tuning.overhead_milliseconds = max(0.0, sum_milliseconds / num_points - slope * sum_bytes / num_points);
+    } else {
+        /// Tasks of the same size, or noise hiding the rate: count all of the time as processing, and assume the
+        /// default start-up cost on top of it.
+        slope = sum_milliseconds / sum_bytes;
+        tuning.overhead_milliseconds = HISTORY_DEFAULT_TASK_OVERHEAD_MILLISECONDS;
+    }
+    tuning.bytes_per_millisecond = 1 / slope;
+    tuning.task_bytes = (uint64_t) (HISTORY_WORK_TO_OVERHEAD_RATIO * tuning.overhead_milliseconds *
+                                    tuning.bytes_per_millisecond);
+    if (tuning.task_bytes > 0)
+        tuning.num_tasks = (int) max((uint64_t) 1, min((uint64_t) tuning.num_tasks,
+                                                       (input_bytes + tuning.task_bytes - 1) / tuning.task_bytes));
+    return tuning;
+}
+
+string server::describe_tuning(const JobTuning &tuning, const string &num_name, int requested, bool applied) {
+    if (tuning.num_runs == 0) return "";
+    ostringstream summary;
+    summary << fixed << setprecision(2);
+    if (applied)
+        summary << ", " << num_name << " tuned to " << tuning.num_tasks << " from " << tuning.num_runs << " past runs";
+    else if (tuning.task_bytes > 0 && requested != tuning.num_tasks)
+        summary << ", past runs suggest " << num_name << "=" << tuning.num_tasks;
+    if (num_name == "num_maples" && tuning.shuffle_ratio > HISTORY_COMBINER_SHUFFLE_RATIO)
+        summary << ", maple output was " << tuning.shuffle_ratio << "x its input, a combiner in the maple_exe "
+                << "would shrink the shuffle";
+    return summary.str();
+}
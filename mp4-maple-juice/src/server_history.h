@@ -0,0 +1,63 @@
+/**
+ * server_history.h
+ * Define job history contents used in server.
+ */
+
+#ifndef SERVER_HISTORY_H
+#define SERVER_HISTORY_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/// Sdfs file holding the history of finished maple and juice jobs, one run per line.
+#define MJ_HISTORY_FILE "maplejuice.history"
+
+/// The runs kept per job signature, the oldest run is dropped first.
+#define HISTORY_RUNS_PER_SIGNATURE 8
+
+/// A task is planned for at least this number of times its start-up cost of work, so the start-up stays under a
+/// fifth of the task.
+#define HISTORY_WORK_TO_OVERHEAD_RATIO 4.0
+
+/// The start-up cost of a task in milliseconds assumed when the history cannot tell it from the processing time.
+#define HISTORY_DEFAULT_TASK_OVERHEAD_MILLISECONDS 500
+
+/// A combiner is advised when maple output exceeds this fraction of maple input.
+#define HISTORY_COMBINER_SHUFFLE_RATIO 0.5
+
+/// One finished maple or juice job, recorded as
+/// "<signature> <job_id> <input_bytes> <shuffle_bytes> <elapsed_ms> <num_tasks> (<task_bytes> <task_ms>)...".
+class JobRun {
+public:
+    /// "<phase>:<exe>:<input>", the same for every run of a recurring job.
+    string signature;
+    uint64_t job_id = 0;
+    uint64_t input_bytes = 0;
+    /// The bytes of intermediate files written by maple, or read by juice.
+    uint64_t shuffle_bytes = 0;
+    uint64_t elapsed_milliseconds = 0;
+    /// The input bytes and the duration in milliseconds of each task, a task recovered from its commit has 0.
+    vector<pair<uint64_t, uint64_t>> tasks;
+
+    string serialize() const;
+
+    /// Returns false if the line is not a run.
+    bool deserialize(const string &line);
+};
+
+/// Task planning learned from the past runs of a job signature.
+class JobTuning {
+public:
+    int num_runs = 0;
+    /// The fitted start-up cost of a task, and its processing rate.
+    double overhead_milliseconds = 0;
+    double bytes_per_millisecond = 0;
+    /// The fewest bytes worth a task of its own, and the number of tasks for the input.
+    uint64_t task_bytes = 0;
+    int num_tasks = 0;
+    /// The maple output of the past runs over their input.
+    double shuffle_ratio = 0;
+};
+
+#endif //SERVER_HISTORY_H
@@ -0,0 +1,184 @@
+/**
+ * server_index.cpp
+ * Implementation of inverted index funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_index.h"
+#include "general.h"
+#include <iomanip>
+
+string index_partition_filename(const string &sdfs_dest, const string &infix, int partition) {
+    ostringstream oss;
+    oss << sdfs_dest << infix << setw(5) << setfill('0') << partition;
+    return oss.str();
+}
+
+void server::handle_index_query(MapleJuiceJob job) {
+    string command = job.command, phase, sdfs_src, sdfs_dest;
+    int num_workers = 0, num_partitions = 0;
+    uint64_t total_bytes = 0, index_bytes = 0, start_time = get_curr_timestamp_milliseconds();
+    cout << "### Receive index:" << command << endl;
+
+    try {
+        /// Decode index command.
+        stringstream ss(command);
+        ss >> phase >> num_workers >> num_partitions >> sdfs_src >> sdfs_dest;
+
+        /// Conduct error handling.
+        if (phase != "index" || num_workers <= 0 || num_partitions <= 0 || sdfs_src.empty() || sdfs_dest.empty())
+            throw runtime_error("Command type error!");
+        vector<string> source_files = check_all_exist_file_by_prefix(sdfs_src);
+        if (source_files.empty())
+            throw runtime_error("No such sdfs source prefix!");
+        map<string, uint64_t> file_sizes = get_file_sizes_by_prefix(sdfs_src);
+        for (const auto &file : source_files) total_bytes += file_sizes[file];
+
+        /// Map: partition the (term, document) pairs of each source file by term, each partition is shipped as a
+        /// run sorted by term with the sorted documents of each term on one line.
+        string job_id = to_string(job.job_id);
+        vector<NativeMission> missions;
+        string map_commit = sdfs_dest + INDEX_INFIX + "map" + COMMIT_SUFFIX;
+        for (const auto &file : source_files) {
+            int mission_id = (int) missions.size();
+            string commit_filename = map_commit + to_string(mission_id);
+            missions.push_back({mission_id, PHASE_I,
+                                "index_map_start " + to_string(mission_id) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + file + " " + to_string(num_partitions), commit_filename});
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// Reduce: merge the runs of each partition into its term dictionary and compressed posting lists.
+        missions.clear();
+        string partition_list = "partitions " + to_string(num_partitions) + "\n";
+        for (int partition = 0; partition < num_partitions; partition++) {
+            string commit_filename = sdfs_dest + COMMIT_SUFFIX + to_string(partition);
+            missions.push_back({partition, PHASE_I,
+                                "index_reduce_start " + to_string(partition) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + to_string(partition), commit_filename});
+            partition_list += index_partition_filename(sdfs_dest, INDEX_TERMS_INFIX, partition) + " " +
+                              index_partition_filename(sdfs_dest, INDEX_POSTINGS_INFIX, partition) + "\n";
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// sdfs_dest lists the number of partitions and the dictionary and postings of each.
+        sdfs_write_text(sdfs_dest, partition_list);
+        delete_all_file_by_prefix(sdfs_dest + INDEX_INFIX);
+        delete_all_file_by_prefix(sdfs_dest + COMMIT_SUFFIX);
+        for (const auto &item : get_file_sizes_by_prefix(sdfs_dest + "_")) index_bytes += item.second;
+
+        double elapsed_seconds = (double) (get_curr_timestamp_milliseconds() - start_time) / 1000;
+        ostringstream summary;
+        summary << fixed << setprecision(2) << (double) total_bytes / (1 << 20) << " MB of text indexed into "
+                << (double) index_bytes / (1 << 20) << " MB in " << elapsed_seconds << " s";
+        reply_to_client(job.sock, "Index job: (" + command + ") finished, " + summary.str() + "!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+vector<string> server::index_map_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, file, line, term;
+    int num_partitions = 0;
+    args >> sdfs_dest >> file >> num_partitions;
+
+    /// A line is "<document_id> <term>...", the document id is an unsigned integer, so an edge list "<from> <to>"
+    /// indexes the links into each page.
+    string local_file = fetch_sdfs_file(file, mission_dir);
+    ifstream infile(local_file);
+    vector<vector<pair<string, uint64_t>>> partitions((size_t) num_partitions);
+    uint64_t skipped_lines = 0;
+    while (getline(infile, line)) {
+        stringstream line_ss(line);
+        string document;
+        char *end = nullptr;
+        if (!(line_ss >> document)) continue;
+        uint64_t document_id = strtoull(document.c_str(), &end, 10);
+        if (end != document.c_str() + document.size() || document[0] == '-') {
+            skipped_lines++;
+            continue;
+        }
+        while (line_ss >> term)
+            partitions[index_term_hash(term) % num_partitions].emplace_back(term, document_id);
+    }
+    infile.close();
+    remove(local_file.c_str());
+    if (skipped_lines > 0)
+        cout << "### Index " << file << ": " << skipped_lines << " lines without a numeric document id skipped" << endl;
+
+    vector<string> outputs;
+    for (int partition = 0; partition < num_partitions; partition++) {
+        vector<pair<string, uint64_t>> &pairs = partitions[partition];
+        if (pairs.empty()) continue;
+        sort(pairs.begin(), pairs.end());
+        pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+        string out_file = sdfs_dest + INDEX_INFIX + to_string(partition) + "_" + to_string(mission_id);
+        ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (i == 0 || pairs[i].first != pairs[i - 1].first) ofs << (i == 0 ? "" : "\n") << pairs[i].first;
+            ofs << " " << pairs[i].second;
+        }
+        ofs << "\n";
+        ofs.close();
+        outputs.push_back(out_file);
+    }
+    return outputs;
+}
+
+vector<string> server::index_reduce_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, line;
+    int partition = 0;
+    args >> sdfs_dest >> partition;
+
+    vector<string> local_files;
+    for (const auto &file : check_all_exist_file_by_prefix(sdfs_dest + INDEX_INFIX + to_string(partition) + "_"))
+        local_files.push_back(fetch_sdfs_file(file, mission_dir));
+
+    /// K-way merge of the runs by term, the documents of a term from all runs are merged into one posting list.
+    vector<ifstream> runs(local_files.size());
+    typedef pair<string, size_t> MergeHead;
+    priority_queue<MergeHead, vector<MergeHead>, greater<MergeHead>> heads;
+    vector<string> head_lines(runs.size());
+    for (size_t i = 0; i < runs.size(); i++) {
+        runs[i].open(local_files[i]);
+        if (getline(runs[i], head_lines[i])) heads.emplace(head_lines[i].substr(0, head_lines[i].find(' ')), i);
+    }
+
+    string terms_file = index_partition_filename(sdfs_dest, INDEX_TERMS_INFIX, mission_id);
+    string postings_file = index_partition_filename(sdfs_dest, INDEX_POSTINGS_INFIX, mission_id);
+    ofstream terms_ofs(curr_dir + "/files/fetched/" + mission_dir + terms_file);
+    ofstream postings_ofs(curr_dir + "/files/fetched/" + mission_dir + postings_file, ofstream::binary);
+    uint64_t offset = 0, num_terms = 0, num_postings = 0;
+    vector<uint64_t> documents;
+    while (!heads.empty()) {
+        string term = heads.top().first;
+        documents.clear();
+        while (!heads.empty() && heads.top().first == term) {
+            size_t run = heads.top().second;
+            heads.pop();
+            stringstream line_ss(head_lines[run].substr(term.size()));
+            uint64_t document_id;
+            while (line_ss >> document_id) documents.push_back(document_id);
+            if (getline(runs[run], head_lines[run]))
+                heads.emplace(head_lines[run].substr(0, head_lines[run].find(' ')), run);
+        }
+        sort(documents.begin(), documents.end());
+        documents.erase(unique(documents.begin(), documents.end()), documents.end());
+        string posting_list = encode_posting_list(documents);
+        postings_ofs.write(posting_list.data(), (streamsize) posting_list.size());
+        terms_ofs << term << " " << documents.size() << " " << offset << " " << posting_list.size() << "\n";
+        offset += posting_list.size();
+        num_terms++;
+        num_postings += documents.size();
+    }
+    terms_ofs.close();
+    postings_ofs.close();
+    for (size_t i = 0; i < runs.size(); i++) {
+        runs[i].close();
+        remove(local_files[i].c_str());
+    }
+    cout << "### Index partition " << partition << ": " << num_terms << " terms, " << num_postings << " postings in "
+         << offset << " bytes" << endl;
+    return {terms_file, postings_file};
+}
@@ -0,0 +1,72 @@
+/**
+ * server_index.h
+ * Define inverted index contents used in server.
+ */
+
+#ifndef SERVER_INDEX_H
+#define SERVER_INDEX_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+/// Infix of the sorted (term, documents) runs shipped from the map missions, followed by "<partition>_<mission>".
+#define INDEX_INFIX ".index_"
+
+/// Infixes of the output of each partition, followed by the zero padded partition number: the term dictionary with
+/// lines "<term> <num_documents> <offset> <length>", and the posting lists it points into.
+#define INDEX_TERMS_INFIX "_terms_"
+#define INDEX_POSTINGS_INFIX "_postings_"
+
+/// The number of postings in a block of a posting list, a lookup skips whole blocks by their headers.
+#define INDEX_BLOCK_POSTINGS 128
+
+/**
+ * The partition of a term is its FNV-1a hash modulo the number of partitions, so the lookup tool can find it too.
+ */
+inline uint64_t index_term_hash(const std::string &term) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : term) h = (h ^ c) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * Append an unsigned integer in LEB128 varint form, 7 bits a byte with the high bit marking a following byte.
+ */
+inline void append_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char) value);
+}
+
+/**
+ * Encode the sorted, distinct document ids of a term as a posting list:
+ *      varint(num_documents), then for each block of INDEX_BLOCK_POSTINGS documents
+ *      varint(last document - last document of the previous block), varint(byte length of the gaps), and
+ *      the varint gaps of its documents, the first one from the last document of the previous block.
+ * The last document and byte length of a block let a lookup skip it without decoding its gaps.
+ */
+inline std::string encode_posting_list(const std::vector<uint64_t> &documents) {
+    std::string out;
+    append_varint(out, documents.size());
+    uint64_t previous_block_last = 0;
+    for (size_t begin = 0; begin < documents.size(); begin += INDEX_BLOCK_POSTINGS) {
+        size_t end = std::min(begin + INDEX_BLOCK_POSTINGS, documents.size());
+        std::string gaps;
+        uint64_t previous = previous_block_last;
+        for (size_t i = begin; i < end; i++) {
+            append_varint(gaps, documents[i] - previous);
+            previous = documents[i];
+        }
+        append_varint(out, documents[end - 1] - previous_block_last);
+        append_varint(out, gaps.size());
+        out += gaps;
+        previous_block_last = documents[end - 1];
+    }
+    return out;
+}
+
+#endif //SERVER_INDEX_H
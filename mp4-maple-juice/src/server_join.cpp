@@ -0,0 +1,300 @@
+/**
+ * server_join.cpp
+ * Implementation of join funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_maplejuice.h"
+#include "server_join.h"
+#include "server_bucket.h"
+#include "general.h"
+
+/**
+ * Split a record into its join key (the first field) and the rest of the line.
+ *
+ * Returns:
+ *      Return false if the record is empty.
+ */
+bool split_join_record(const string &line, string &key, string &rest) {
+    size_t key_begin = line.find_first_not_of(" \t");
+    if (key_begin == string::npos) return false;
+    size_t key_end = line.find_first_of(" \t", key_begin);
+    key = line.substr(key_begin, key_end - key_begin);
+    size_t rest_begin = key_end == string::npos ? string::npos : line.find_first_not_of(" \t", key_end);
+    rest = rest_begin == string::npos ? "" : line.substr(rest_begin);
+    return true;
+}
+
+void server::handle_join_query(MapleJuiceJob job) {
+    string command = job.command, phase, mode, sdfs_left, sdfs_right, sdfs_dest;
+    int num_workers = 0, bloom = 0;
+    cout << "### Receive join query:" << command << endl;
+
+    try {
+        /// Decode join command.
+        stringstream ss(command);
+        ss >> phase >> mode >> num_workers >> sdfs_left >> sdfs_right >> sdfs_dest >> bloom;
+
+        /// Conduct error handling.
+        if (phase != "join" || (mode != "hash" && mode != "broadcast"))
+            throw runtime_error("Command type error!");
+
+        /// A bucketed side is read from its buckets, which are partitioned like the map output of a hash join.
+        BucketLayout left_layout, right_layout;
+        bool left_bucketed = load_bucket_layout(sdfs_left, left_layout) && left_layout.matches_maple_partitions();
+        bool right_bucketed = load_bucket_layout(sdfs_right, right_layout) && right_layout.matches_maple_partitions();
+        auto input_files = [&](const string &prefix, const BucketLayout &layout, bool bucketed) {
+            if (!bucketed) return check_all_exist_file_by_prefix(prefix);
+            vector<string> files;
+            for (const auto &item : layout.buckets) files.push_back(item.second.file);
+            return files;
+        };
+        vector<string> left_files = input_files(sdfs_left, left_layout, left_bucketed);
+        vector<string> right_files = input_files(sdfs_right, right_layout, right_bucketed);
+        if ((left_files.empty() && !left_bucketed) || (right_files.empty() && !right_bucketed))
+            throw runtime_error("No such sdfs join input prefix!");
+
+        string job_id = to_string(job.job_id), summary;
+        vector<NativeMission> missions;
+        vector<string> outputs;
+
+        if (mode == "broadcast") {
+            /// One mission per large side file, every mission carries the small side and needs no shuffle.
+            string right_list = to_string(right_files.size());
+            for (const auto &file : right_files) right_list += " " + file;
+            for (const auto &file : left_files) {
+                int mission_id = (int) missions.size();
+                string commit_filename = sdfs_dest + COMMIT_SUFFIX + to_string(mission_id);
+                missions.push_back({mission_id, PHASE_I,
+                                    "broadcast_join_start " + to_string(mission_id) + " " + job_id + " " +
+                                    commit_filename + " " + sdfs_dest + " " + job_id + " " + right_list + " " + file,
+                                    commit_filename});
+                outputs.push_back(sdfs_dest + "_" + to_string(mission_id));
+            }
+            run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+        } else {
+            /// Map: tag and partition both sides. With bloom=1 the right side is mapped first and builds a bloom
+            /// filter of its keys, then the left side drops the records whose key can not match before the shuffle.
+            /// A bucketed side is not mapped, and the bloom filter needs both sides shuffled.
+            if (bloom == 1 && (left_bucketed || right_bucketed)) {
+                cout << "### Skip the bloom filter, a bucketed side is not shuffled" << endl;
+                bloom = 0;
+            }
+            string map_commit = sdfs_dest + JOIN_INFIX + "map" + COMMIT_SUFFIX;
+            int next_mission_id = 0;
+            auto add_map_missions = [&](const vector<string> &files, const string &side, const string &bloom_mode) {
+                for (const auto &file : files) {
+                    int mission_id = next_mission_id++;
+                    string commit_filename = map_commit + to_string(mission_id);
+                    missions.push_back({mission_id, PHASE_I,
+                                        "join_map_start " + to_string(mission_id) + " " + job_id + " " +
+                                        commit_filename + " " + sdfs_dest + " " + side + " " + bloom_mode + " " +
+                                        file, commit_filename});
+                }
+            };
+            if (bloom == 1) {
+                add_map_missions(right_files, "R", "build");
+                run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+                BloomFilter merged;
+                for (const auto &file : check_all_exist_file_by_prefix(sdfs_dest + JOIN_BLOOM_INFIX + "_")) {
+                    BloomFilter partial;
+                    string local_file = fetch_sdfs_file(file);
+                    if (partial.load(local_file)) merged.merge(partial);
+                    remove(local_file.c_str());
+                }
+                string merged_file = curr_dir + "/files/fetched/" + sdfs_dest + JOIN_BLOOM_INFIX;
+                merged.save(merged_file);
+                maple_juice_put(merged_file, sdfs_dest + JOIN_BLOOM_INFIX);
+                remove(merged_file.c_str());
+
+                missions.clear();
+                add_map_missions(left_files, "L", "probe");
+            } else {
+                if (!right_bucketed) add_map_missions(right_files, "R", "none");
+                if (!left_bucketed) add_map_missions(left_files, "L", "none");
+            }
+            if (!missions.empty()) run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+            /// Reduce: join the tagged records of each partition, with the bucket of each bucketed side. A partition
+            /// is skipped when a bucketed side has no record in it, or the key ranges of two buckets do not overlap.
+            missions.clear();
+            int num_skipped = 0;
+            for (int partition = 0; partition < NUM_PARTITIONS; partition++) {
+                if ((left_bucketed && left_layout.buckets.count(partition) == 0) ||
+                    (right_bucketed && right_layout.buckets.count(partition) == 0) ||
+                    (left_bucketed && right_bucketed && !left_layout.may_overlap(right_layout, partition))) {
+                    num_skipped++;
+                    continue;
+                }
+                string buckets;
+                if (left_bucketed) buckets += " L " + left_layout.buckets[partition].file;
+                if (right_bucketed) buckets += " R " + right_layout.buckets[partition].file;
+                string commit_filename = sdfs_dest + COMMIT_SUFFIX + to_string(partition);
+                missions.push_back({partition, PHASE_I,
+                                    "join_reduce_start " + to_string(partition) + " " + job_id + " " +
+                                    commit_filename + " " + sdfs_dest + " " + to_string(partition) + buckets,
+                                    commit_filename});
+                outputs.push_back(sdfs_dest + "_" + to_string(partition));
+            }
+            if (!missions.empty()) run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+            if (left_bucketed || right_bucketed)
+                summary = string(", shuffled ") + (left_bucketed && right_bucketed ? "neither side" :
+                                                   left_bucketed ? "only the right side" : "only the left side") +
+                          ", skipped " + to_string(num_skipped) + " of " + to_string(NUM_PARTITIONS) + " partitions";
+        }
+
+        combine_mission_outputs(outputs, sdfs_dest);
+        delete_all_file_by_prefix(sdfs_dest + JOIN_INFIX);
+        delete_all_file_by_prefix(sdfs_dest + COMMIT_SUFFIX);
+
+        reply_to_client(job.sock, "Join job: (" + command + ") finished" + summary + "!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+vector<string> server::join_map_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, side, bloom_mode, file, line, key, rest;
+    args >> sdfs_dest >> side >> bloom_mode;
+
+    BloomFilter bloom;
+    if (bloom_mode == "probe") {
+        string bloom_file = fetch_sdfs_file(sdfs_dest + JOIN_BLOOM_INFIX, mission_dir);
+        bool loaded = bloom.load(bloom_file);
+        remove(bloom_file.c_str());
+        if (!loaded)
+            throw runtime_error("Bad join bloom filter");
+    }
+
+    map<int, ofstream> of_map;
+    vector<string> outputs;
+    uint64_t num_records = 0, num_pruned = 0;
+    while (args >> file) {
+        string local_file = fetch_sdfs_file(file, mission_dir);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            if (!split_join_record(line, key, rest)) continue;
+            num_records++;
+            if (bloom_mode == "probe" && !bloom.contains(key)) {
+                num_pruned++;
+                continue;
+            }
+            if (bloom_mode == "build") bloom.insert(key);
+            int partition = hash_string_to_int(key) % NUM_PARTITIONS;
+            if (of_map.find(partition) == of_map.end()) {
+                string out_file = sdfs_dest + JOIN_INFIX + to_string(partition) + "_" + to_string(mission_id);
+                of_map[partition].open(curr_dir + "/files/fetched/" + mission_dir + out_file);
+                outputs.push_back(out_file);
+            }
+            of_map[partition] << key << "\t" << side << "\t" << rest << "\n";
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+    for (auto &item : of_map) item.second.close();
+
+    if (bloom_mode == "build") {
+        string bloom_file = sdfs_dest + JOIN_BLOOM_INFIX + "_" + to_string(mission_id);
+        bloom.save(curr_dir + "/files/fetched/" + mission_dir + bloom_file);
+        outputs.push_back(bloom_file);
+    }
+    cout << "### Join map: " << num_records << " records, " << num_pruned << " pruned by bloom filter" << endl;
+    return outputs;
+}
+
+vector<string> server::join_reduce_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, line, key, side, rest, bucket_side, bucket_file;
+    int partition = 0;
+    args >> sdfs_dest >> partition;
+
+    /// Group the tagged records of this partition by key, the right side first.
+    unordered_map<string, pair<vector<string>, vector<string>>> groups;
+    for (const auto &file : check_all_exist_file_by_prefix(sdfs_dest + JOIN_INFIX + to_string(partition) + "_")) {
+        string local_file = fetch_sdfs_file(file, mission_dir);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            size_t key_end = line.find('\t');
+            if (key_end == string::npos || key_end + 2 >= line.size()) continue;
+            key = line.substr(0, key_end);
+            side = line.substr(key_end + 1, 1);
+            rest = line.substr(min(key_end + 3, line.size()));
+            if (side == "L") groups[key].first.push_back(rest);
+            else groups[key].second.push_back(rest);
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+
+    /// The bucket of a bucketed side holds the untagged records of this partition.
+    while (args >> bucket_side >> bucket_file) {
+        string local_file = fetch_sdfs_file(bucket_file, mission_dir);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            if (!split_join_record(line, key, rest)) continue;
+            if (bucket_side == "L") groups[key].first.push_back(rest);
+            else groups[key].second.push_back(rest);
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+
+    string out_file = sdfs_dest + "_" + to_string(mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+    for (const auto &group : groups)
+        for (const auto &left : group.second.first)
+            for (const auto &right : group.second.second)
+                ofs << group.first << "\t" << left << "\t" << right << "\n";
+    ofs.close();
+    return {out_file};
+}
+
+vector<string> server::broadcast_join_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, job_id, file, line, key, rest;
+    int num_right_files = 0;
+    args >> sdfs_dest >> job_id >> num_right_files;
+    vector<string> right_files;
+    /// A later job may rewrite the same files, so the table only serves the missions of its own job.
+    string table_key = job_id + " ";
+    for (int i = 0; i < num_right_files && args >> file; i++) {
+        right_files.push_back(file);
+        table_key += file + " ";
+    }
+
+    /// The small side is fetched once per job and kept in memory for the following missions on this worker.
+    shared_ptr<const unordered_multimap<string, string>> table;
+    broadcast_table_lock.lock();
+    if (broadcast_table_key != table_key) {
+        auto new_table = make_shared<unordered_multimap<string, string>>();
+        for (const auto &right_file : right_files) {
+            string local_file = fetch_sdfs_file(right_file, mission_dir);
+            ifstream infile(local_file);
+            while (getline(infile, line))
+                if (split_join_record(line, key, rest)) new_table->emplace(key, rest);
+            infile.close();
+            remove(local_file.c_str());
+        }
+        broadcast_table = new_table;
+        broadcast_table_key = table_key;
+    }
+    table = broadcast_table;
+    broadcast_table_lock.unlock();
+
+    string out_file = sdfs_dest + "_" + to_string(mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+    while (args >> file) {
+        string local_file = fetch_sdfs_file(file, mission_dir);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            if (!split_join_record(line, key, rest)) continue;
+            auto range = table->equal_range(key);
+            for (auto it = range.first; it != range.second; it++)
+                ofs << key << "\t" << rest << "\t" << it->second << "\n";
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+    ofs.close();
+    return {out_file};
+}
@@ -0,0 +1,73 @@
+/**
+ * server_join.h
+ * Define join contents used in server.
+ */
+
+#ifndef SERVER_JOIN_H
+#define SERVER_JOIN_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+
+/// Infix of the sdfs files of a reduce side join: tagged partitions, partial and merged bloom filters.
+#define JOIN_INFIX ".join_"
+#define JOIN_BLOOM_INFIX ".join_bloom"
+
+/// Size of the bloom filter for semi-join pruning, 8 Mbit keeps about 1% false positives for 800k keys.
+#define JOIN_BLOOM_BITS (1 << 23)
+#define JOIN_BLOOM_HASHES 7
+
+/// Bloom filter over join keys, partial filters of several workers are merged by OR.
+class BloomFilter {
+public:
+    BloomFilter() : bits(JOIN_BLOOM_BITS / 64, 0) {}
+
+    void insert(const std::string &key) {
+        uint64_t h1, h2;
+        hash_key(key, h1, h2);
+        for (int i = 0; i < JOIN_BLOOM_HASHES; i++) {
+            uint64_t bit = (h1 + i * h2) % JOIN_BLOOM_BITS;
+            bits[bit / 64] |= (uint64_t) 1 << (bit % 64);
+        }
+    }
+
+    bool contains(const std::string &key) const {
+        uint64_t h1, h2;
+        hash_key(key, h1, h2);
+        for (int i = 0; i < JOIN_BLOOM_HASHES; i++) {
+            uint64_t bit = (h1 + i * h2) % JOIN_BLOOM_BITS;
+            if (!(bits[bit / 64] & ((uint64_t) 1 << (bit % 64)))) return false;
+        }
+        return true;
+    }
+
+    void merge(const BloomFilter &other) {
+        for (size_t i = 0; i < bits.size(); i++) bits[i] |= other.bits[i];
+    }
+
+    void save(const std::string &path) const {
+        std::ofstream ofs(path, std::ofstream::binary);
+        ofs.write((const char *) bits.data(), bits.size() * sizeof(uint64_t));
+    }
+
+    bool load(const std::string &path) {
+        std::ifstream ifs(path, std::ifstream::binary);
+        return (bool) ifs.read((char *) bits.data(), bits.size() * sizeof(uint64_t));
+    }
+
+private:
+    std::vector<uint64_t> bits;
+
+    /// Double hashing: std::hash and FNV-1a give the two base hashes.
+    static void hash_key(const std::string &key, uint64_t &h1, uint64_t &h2) {
+        h1 = std::hash<std::string>()(key);
+        h2 = 14695981039346656037ULL;
+        for (unsigned char c : key) h2 = (h2 ^ c) * 1099511628211ULL;
+        h2 |= 1;
+    }
+};
+
+#endif //SERVER_JOIN_H
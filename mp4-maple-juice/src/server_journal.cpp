@@ -0,0 +1,302 @@
+/**
+ * server_journal.cpp
+ * Implementation of maple juice journal and master failover funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_maplejuice.h"
+#include "server_stream.h"
+#include "general.h"
+
+void server::submit_maple_juice_job(const string &query, int sock, const string &user, int priority) {
+    /// Admission control on the queue length, so a burst of batch jobs cannot delay interactive ones for hours.
+    double capacity = get_cluster_capacity();
+    maple_juice_requests_lock.lock();
+    int queued_jobs = (int) maple_juice_requests.size(), user_jobs = 0;
+    for (const auto &queued : maple_juice_requests)
+        if (queued.user == user) user_jobs++;
+    maple_juice_requests_lock.unlock();
+    string rejection;
+    if (capacity <= 0)
+        rejection = "no worker available";
+    else if (user_jobs >= MJ_MAX_QUEUED_JOBS_PER_USER)
+        rejection = user + " already has " + to_string(user_jobs) + " jobs waiting";
+    else if (priority < PRIORITY_HIGH &&
+             queued_jobs >= capacity * MJ_QUEUED_JOBS_PER_WORKER * (priority == PRIORITY_LOW ? 1 : 2))
+        rejection = "the cluster is busy with " + to_string(queued_jobs) + " waiting jobs, retry later or use a " +
+                    "higher priority";
+    if (!rejection.empty()) {
+        cout << "### Reject job (" << query << "): " << rejection << endl;
+        reply_to_client(sock, "Job rejected: " + rejection + "!");
+        return;
+    }
+    enqueue_maple_juice_job(query, sock, user, priority);
+}
+
+void server::enqueue_maple_juice_job(const string &query, int sock, const string &user, int priority) {
+    MapleJuiceJob job;
+    /// Job ids are submit timestamps, kept unique even for several jobs in the same millisecond.
+    job.job_id = max(last_job_id + 1, get_curr_timestamp_milliseconds());
+    last_job_id = job.job_id;
+    job.command = query;
+    job.sock = sock;
+    job.user = user;
+    job.priority = priority;
+    job.start_after = parse_stream_start_after(query);
+    journal_append("submit " + to_string(job.job_id) + " " + job_priority_name(priority) + " " + user + " " + query);
+    maple_juice_requests_lock.lock();
+    maple_juice_requests.push_back(job);
+    maple_juice_requests_lock.unlock();
+}
+
+double server::get_cluster_capacity() {
+    double capacity = 0;
+    vector<string> workers = select_mission_workers(NUM_VMS, 0);
+    membership_list_lock.lock();
+    for (const auto &worker : workers) {
+        auto it = membership_list.find(worker);
+        if (it == membership_list.end()) continue;
+        capacity += 1 / (1 + max(it->second.cpu_load / 100.0, (double) it->second.running_missions));
+    }
+    membership_list_lock.unlock();
+    return capacity;
+}
+
+bool server::pop_maple_juice_job(int min_priority, MapleJuiceJob &job) {
+    lock_guard<mutex> lock(maple_juice_requests_lock);
+    auto best = maple_juice_requests.end();
+    uint64_t now = get_curr_timestamp_milliseconds();
+    for (auto it = maple_juice_requests.begin(); it != maple_juice_requests.end(); it++) {
+        if (it->priority < min_priority || it->start_after > now) continue;
+        if (best == maple_juice_requests.end() || it->priority > best->priority ||
+            (it->priority == best->priority &&
+             make_pair(user_last_start[it->user], it->job_id) < make_pair(user_last_start[best->user], best->job_id)))
+            best = it;
+    }
+    if (best == maple_juice_requests.end()) return false;
+    job = *best;
+    maple_juice_requests.erase(best);
+    user_last_start[job.user] = now;
+    return true;
+}
+
+/**
+ * Check whether a member is in the list and not suspected or leaving.
+ */
+bool is_alive_member(map<string, Member> &list, const string &ip) {
+    auto it = list.find(ip);
+    return it != list.end() && it->second.updated_time != FAILURE && it->second.updated_time != LEAVE;
+}
+
+string server::find_maple_juice_master_candidate() {
+    string candidate;
+    membership_list_lock.lock();
+    if (is_joined) {
+        if (is_alive_member(membership_list, indicator_ip)) candidate = indicator_ip;
+        else
+            for (const auto &ip : sorted_ips)
+                if (is_alive_member(membership_list, ip)) {
+                    candidate = ip;
+                    break;
+                }
+    }
+    membership_list_lock.unlock();
+    return candidate;
+}
+
+bool server::check_maple_juice_takeover() {
+    if (find_maple_juice_master_candidate() != my_ip_address) return false;
+
+    /// The journal starts with the master that wrote it, only take over if that master is gone.
+    stringstream ss(sdfs_read_text(MJ_JOURNAL_FILE));
+    string record_type, recorded_master;
+    ss >> record_type >> recorded_master;
+    if (record_type == "master" && recorded_master != my_ip_address) {
+        membership_list_lock.lock();
+        bool master_alive = is_alive_member(membership_list, recorded_master);
+        membership_list_lock.unlock();
+        if (master_alive) return false;
+    }
+
+    cout << "### Take over as maple juice master." << endl;
+    write_log_file("Take over as maple juice master", 0);
+    is_maple_juice_master = true;
+    return true;
+}
+
+/**
+ * Get the sdfs filename of a journal segment.
+ */
+string journal_segment_filename(int segment) {
+    return MJ_JOURNAL_SEGMENT_PREFIX + to_string(segment) + MJ_JOURNAL_SEGMENT_SUFFIX;
+}
+
+/**
+ * Apply an appended record to the live records of the journal, a "finish <job_id>" record drops the records of
+ * its job.
+ */
+void apply_journal_record(vector<string> &records, const string &record) {
+    stringstream ss(record);
+    string record_type;
+    uint64_t job_id = 0;
+    ss >> record_type >> job_id;
+    if (record_type != "finish") {
+        records.push_back(record);
+        return;
+    }
+    vector<string> remaining;
+    for (const auto &item : records) {
+        stringstream item_ss(item);
+        uint64_t item_job_id = 0;
+        item_ss >> record_type >> item_job_id;
+        if (record_type == "master" || item_job_id != job_id) remaining.push_back(item);
+    }
+    records = remaining;
+}
+
+void server::replay_maple_juice_journal() {
+    stringstream journal_ss(sdfs_read_text(MJ_JOURNAL_FILE));
+    string line, record_type;
+    vector<string> records;
+    vector<MapleJuiceJob> jobs;
+    map<uint64_t, size_t> job_index;
+
+    /// The journal file names the first segment not compacted into it, the later segments are applied in order.
+    int first_segment = 0;
+    while (getline(journal_ss, line)) {
+        stringstream line_ss(line);
+        line_ss >> record_type;
+        if (record_type == "segment") line_ss >> first_segment;
+        else if (!line.empty()) apply_journal_record(records, line);
+    }
+    set<int> segments;
+    size_t prefix_size = strlen(MJ_JOURNAL_SEGMENT_PREFIX);
+    for (const auto &file : check_all_exist_file_by_prefix(MJ_JOURNAL_SEGMENT_PREFIX))
+        segments.insert(atoi(file.c_str() + prefix_size));
+    for (int segment : segments) {
+        if (segment < first_segment) continue;
+        stringstream segment_ss(sdfs_read_text(journal_segment_filename(segment)));
+        while (getline(segment_ss, line))
+            if (!line.empty()) apply_journal_record(records, line);
+    }
+
+    /// Records are "master <ip>", "submit <job_id> <priority> <user> <command>" and
+    /// "assign <job_id> <mission_id> <inputs>".
+    for (const auto &record : records) {
+        stringstream line_ss(record);
+        uint64_t job_id = 0;
+        line_ss >> record_type >> job_id;
+        if (record_type == "submit") {
+            MapleJuiceJob job;
+            job.job_id = job_id;
+            job.sock = -1;
+            string priority;
+            line_ss >> priority >> job.user;
+            getline(line_ss >> ws, job.command);
+            job.priority = parse_job_priority(priority);
+            if (job.priority < 0) {
+                /// A record without priority and user, the job runs as an anonymous normal priority job.
+                job.command = priority + " " + job.user + " " + job.command;
+                job.user = "anonymous";
+                job.priority = PRIORITY_NORMAL;
+            }
+            job.start_after = parse_stream_start_after(job.command);
+            job_index[job_id] = jobs.size();
+            jobs.push_back(job);
+        } else if (record_type == "assign" && job_index.find(job_id) != job_index.end()) {
+            int mission_id = 0;
+            string input;
+            line_ss >> mission_id;
+            vector<string> &inputs = jobs[job_index[job_id]].recorded_missions[mission_id];
+            while (line_ss >> input) inputs.push_back(input);
+        }
+    }
+
+    maple_juice_journal_lock.lock();
+    maple_juice_journal.clear();
+    maple_juice_journal.push_back("master " + my_ip_address);
+    for (const auto &job : jobs) {
+        maple_juice_journal.push_back("submit " + to_string(job.job_id) + " " + job_priority_name(job.priority) + " " +
+                                      job.user + " " + job.command);
+        for (const auto &mission : job.recorded_missions) {
+            string record = "assign " + to_string(job.job_id) + " " + to_string(mission.first);
+            for (const auto &input : mission.second) record += " " + input;
+            maple_juice_journal.push_back(record);
+        }
+        last_job_id = max(last_job_id, job.job_id);
+    }
+    first_journal_segment = next_journal_segment = segments.empty() ? 0 : *segments.rbegin() + 1;
+    maple_juice_journal_lock.unlock();
+    compact_maple_juice_journal();
+    for (int segment : segments) delete_all_file_by_prefix(journal_segment_filename(segment));
+
+    maple_juice_requests_lock.lock();
+    for (const auto &job : jobs) {
+        cout << "### Replay maple juice job: " << job.command << endl;
+        maple_juice_requests.push_back(job);
+    }
+    maple_juice_requests_lock.unlock();
+}
+
+void server::journal_append(const string &record) {
+    maple_juice_journal_lock.lock();
+    pending_journal_records.push_back(record);
+    journal_queued_records++;
+    maple_juice_journal_lock.unlock();
+    journal_cv.notify_all();
+}
+
+void server::journal_finish_job(uint64_t job_id) {
+    journal_append("finish " + to_string(job_id));
+}
+
+void server::journal_sync() {
+    unique_lock<mutex> lock(maple_juice_journal_lock);
+    uint64_t queued_records = journal_queued_records;
+    journal_cv.wait(lock, [this, queued_records] { return journal_written_records >= queued_records; });
+}
+
+void server::run_journal_writer() {
+    while (true) {
+        /// All records queued while the previous segment was written go to the next segment at once.
+        unique_lock<mutex> lock(maple_juice_journal_lock);
+        journal_cv.wait(lock, [this] { return !pending_journal_records.empty(); });
+        vector<string> records;
+        records.swap(pending_journal_records);
+        uint64_t queued_records = journal_queued_records;
+        int segment = next_journal_segment++;
+        lock.unlock();
+
+        string content;
+        for (const auto &record : records) content += record + "\n";
+        sdfs_write_text(journal_segment_filename(segment), content);
+
+        lock.lock();
+        for (const auto &record : records) apply_journal_record(maple_juice_journal, record);
+        journal_written_records = queued_records;
+        bool compact = next_journal_segment - first_journal_segment >= MJ_JOURNAL_COMPACT_SEGMENTS;
+        lock.unlock();
+        journal_cv.notify_all();
+        if (compact) compact_maple_juice_journal();
+    }
+}
+
+void server::compact_maple_juice_journal() {
+    maple_juice_journal_lock.lock();
+    int first_segment = first_journal_segment, next_segment = next_journal_segment;
+    string content;
+    for (size_t i = 0; i < maple_juice_journal.size(); i++) {
+        content += maple_juice_journal[i] + "\n";
+        /// The master record stays first, the takeover check only reads the first record.
+        if (i == 0) content += "segment " + to_string(next_segment) + "\n";
+    }
+    maple_juice_journal_lock.unlock();
+
+    /// The journal file is written before the segments are deleted, so a failover in between reads no record twice.
+    sdfs_write_text(MJ_JOURNAL_FILE, content);
+    for (int segment = first_segment; segment < next_segment; segment++)
+        delete_all_file_by_prefix(journal_segment_filename(segment));
+    maple_juice_journal_lock.lock();
+    first_journal_segment = next_segment;
+    maple_juice_journal_lock.unlock();
+}
@@ -5,72 +5,594 @@
 
 #include "server_func.h"
 #include "server_maplejuice.h"
+#include "server_columnar.h"
 #include "general.h"
+#include <cmath>
+#include <iomanip>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <csignal>
+#include <fcntl.h>
 
 #define TEN_LINES_READ false
 #define USE_RANGE_BASED_PARTITION true
+#define USE_LOAD_BASED_PARTITION true
 
-void server::run_maple_juice_handler() {
-    while (true) {
-        maple_juice_requests_lock.lock();
-        if (maple_juice_requests.empty()) {
-            maple_juice_requests_lock.unlock();
+/**
+ * Send the result of a job back to client, jobs replayed from the journal have no client to answer.
+ */
+void reply_to_client(int sock, const string &response) {
+    if (sock < 0) return;
+    const char *res = response.c_str();
+    send(sock, res, strlen(res), 0);
+    close(sock);
+}
+
+/**
+ * Create a memfd holding the given content, positioned at its start.
+ *
+ * Returns:
+ *      Return the descriptor, -1 on failure.
+ */
+int create_memfd(const char *name, const string &content) {
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t n = write(fd, content.data() + written, content.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        written += (size_t) n;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/**
+ * Confine a UDF in the forked child before its exec. Its heap and CPU time are capped, so a runaway UDF fails fast
+ * instead of pushing the node into swap, and it runs niced and first in line for the OOM killer, so the heartbeats and
+ * sdfs transfers of the worker keep running under load. Only async-signal-safe calls, the parent has threads.
+ */
+void limit_udf_resources(const TaskLimits &limits) {
+    if (limits.memory_mb > 0) {
+        struct rlimit memory_limit{};
+        memory_limit.rlim_cur = memory_limit.rlim_max = (rlim_t) limits.memory_mb << 20;
+        setrlimit(RLIMIT_DATA, &memory_limit);
+    }
+    if (limits.cpu_seconds > 0) {
+        /// SIGXCPU at the soft limit, SIGKILL a second later if the UDF handles it.
+        struct rlimit cpu_limit{};
+        cpu_limit.rlim_cur = (rlim_t) limits.cpu_seconds;
+        cpu_limit.rlim_max = (rlim_t) limits.cpu_seconds + 1;
+        setrlimit(RLIMIT_CPU, &cpu_limit);
+    }
+    setpriority(PRIO_PROCESS, 0, MJ_TASK_NICE);
+    int oom_fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+    if (oom_fd >= 0) {
+        ssize_t num_written = write(oom_fd, "1000", 4);
+        (void) num_written;
+        close(oom_fd);
+    }
+}
+
+/**
+ * Run a UDF on the given descriptors as its stdin and stdout, within the limits of a task slot. Only the descriptors
+ * are passed to the child, there is no shell and no temp file in between.
+ *
+ * Returns:
+ *      Return false if the UDF cannot be started, is killed or does not exit with 0.
+ */
+bool run_udf(const string &exe_path, int input_fd, int output_fd, const TaskLimits &limits) {
+    const char *path = exe_path.c_str();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        /// dup2 clears close-on-exec, so the memfds survive the exec as stdin and stdout.
+        if (dup2(input_fd, STDIN_FILENO) < 0 || dup2(output_fd, STDOUT_FILENO) < 0) _exit(127);
+        limit_udf_resources(limits);
+        execl(path, path, (char *) nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return false;
+    if (WIFSIGNALED(status))
+        std::cerr << "error: " << exe_path << " killed by " << strsignal(WTERMSIG(status)) << ", a task slot allows "
+                  << limits.memory_mb << " MB and " << limits.cpu_seconds << " CPU seconds" << std::endl;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Run a UDF over the concatenation of the given files, fed through a socket so that a UDF exiting early cannot raise
+ * SIGPIPE in the worker.
+ *
+ * Returns:
+ *      Return false if a file cannot be read, or the UDF fails.
+ */
+bool run_udf_over_files(const string &exe_path, const vector<string> &input_paths, int output_fd,
+                        const TaskLimits &limits) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) return false;
+    bool inputs_read = true;
+    thread feeder([&]() {
+        vector<char> buffer(1 << 20);
+        for (const auto &path : input_paths) {
+            int input_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (input_fd < 0) {
+                inputs_read = false;
+                break;
+            }
+            ssize_t num_read;
+            bool sending = true;
+            while (sending && (num_read = read(input_fd, buffer.data(), buffer.size())) != 0) {
+                if (num_read < 0) {
+                    if (errno == EINTR) continue;
+                    inputs_read = false;
+                    break;
+                }
+                for (ssize_t num_sent = 0; num_sent < num_read;) {
+                    ssize_t num_bytes = send(fds[1], buffer.data() + num_sent, num_read - num_sent, MSG_NOSIGNAL);
+                    if (num_bytes < 0 && errno == EINTR) continue;
+                    if (num_bytes < 0) {
+                        sending = false;
+                        break;
+                    }
+                    num_sent += num_bytes;
+                }
+            }
+            close(input_fd);
+            if (!sending) break;
+        }
+        shutdown(fds[1], SHUT_WR);
+    });
+    bool success = run_udf(exe_path, fds[0], output_fd, limits);
+    /// A UDF exiting before its input ends fails the sends, which ends the feeder.
+    close(fds[0]);
+    feeder.join();
+    close(fds[1]);
+    return success && inputs_read;
+}
+
+/**
+ * The task slots a member reported in its heartbeats, one if it has not reported any.
+ */
+int reported_task_slots(const Member &member) {
+    return member.load_reported && member.task_slots > 0 ? member.task_slots : 1;
+}
+
+/**
+ * Format a sample fraction without losing precision.
+ */
+string format_sample_fraction(double fraction) {
+    ostringstream oss;
+    oss << setprecision(17) << fraction;
+    return oss.str();
+}
+
+/**
+ * Decide whether a record is in the sample. The decision only depends on the job, the file and the line, so a
+ * redistributed mission maps exactly the same records.
+ */
+bool keep_sampled_record(uint64_t seed, uint64_t line_number, double fraction) {
+    uint64_t x = seed + line_number * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (double) (x >> 11) / (double) (1ULL << 53) < fraction;
+}
+
+/**
+ * Scale the values of a juice output over a sample up to the whole input, and write their confidence intervals.
+ * A value is taken as a count of sampled records, so the estimate is value / p with a standard error of
+ * sqrt(value * (1 - p)) / p. Only lines "key value" with a numeric value are counts or sums, any other line is kept
+ * as it is.
+ */
+void scale_sampled_output(const string &output_path, const string &error_path, double fraction) {
+    ifstream infile(output_path);
+    ofstream scaled_ofs(output_path + ".scaled"), error_ofs(error_path);
+    string line, key, value, extra;
+    while (getline(infile, line)) {
+        stringstream ss(line);
+        char *end = nullptr;
+        if (!(ss >> key >> value) || ss >> extra ||
+            (strtod(value.c_str(), &end), end != value.c_str() + value.size())) {
+            scaled_ofs << line << "\n";
             continue;
         }
-        pair<string, int> query = maple_juice_requests.front();
-        maple_juice_requests.pop();
-        maple_juice_requests_lock.unlock();
-        string query_type;
-        stringstream ss(query.first);
-        ss >> query_type;
-        if (query_type == "maple") handle_maple_query(query);
-        else handle_juice_query(query);
+        double count = strtod(value.c_str(), nullptr);
+        double estimate = count / fraction;
+        double half_width = SAMPLE_CONFIDENCE_Z * sqrt(max(count, 0.0) * (1 - fraction)) / fraction;
+        /// Integer counts stay integers.
+        int precision = value.find_first_of(".eE") == string::npos ? 0 : 6;
+        scaled_ofs << fixed << setprecision(precision) << key << " " << estimate << "\n";
+        error_ofs << fixed << setprecision(precision) << key << " " << estimate << " "
+                  << max(estimate - half_width, 0.0) << " " << estimate + half_width << "\n";
+    }
+    infile.close();
+    scaled_ofs.close();
+    error_ofs.close();
+    rename((output_path + ".scaled").c_str(), output_path.c_str());
+}
+
+/**
+ * Create a private directory under files/fetched for the local files of one mission, so the missions of a job
+ * sharing a worker never touch each other's files.
+ *
+ * Returns:
+ *      Return the directory relative to files/fetched with a trailing '/', or an empty string on failure.
+ */
+string create_mission_dir(const string &kind, uint64_t job_id, int mission_id) {
+    string dir_template = "files/fetched/" + kind + "_" + to_string(job_id) + "_" + to_string(mission_id) + "_XXXXXX";
+    vector<char> path(dir_template.begin(), dir_template.end());
+    path.push_back('\0');
+    if (mkdtemp(path.data()) == nullptr) return "";
+    return string(path.data()).substr(strlen("files/fetched/")) + "/";
+}
+
+/**
+ * Delete the directory of a mission with all its local files.
+ */
+void remove_mission_dir(const string &mission_dir) {
+    string sys_command = "rm -rf files/fetched/" + mission_dir;
+    system(sys_command.c_str());
+}
+
+/**
+ * Run the maple_exe over one fetched split, or over its sampled records when sample_fraction < 1, appending the output
+ * to output_fd.
+ *
+ * Returns:
+ *      Return false if the maple_exe fails on any part of the split.
+ */
+bool run_maple_split(const string &exe_path, const string &file_to_read, double sample_fraction, uint64_t seed,
+                     int output_fd, const TaskLimits &limits) {
+    int input_fd;
+    if (sample_fraction < 1) {
+        /// Only feed the sampled records to the maple_exe.
+        ifstream full_file(file_to_read);
+        string line, sampled_records;
+        uint64_t line_number = 0;
+        while (getline(full_file, line))
+            if (keep_sampled_record(seed, line_number++, sample_fraction)) sampled_records += line + "\n";
+        full_file.close();
+        input_fd = create_memfd("maple_sample", sampled_records);
+    } else {
+        input_fd = open(file_to_read.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (input_fd < 0) return false;
+
+    bool success = true;
+    if (TEN_LINES_READ) {
+        /// Feed the maple_exe ten lines at a time.
+        FILE *input = fdopen(dup(input_fd), "r");
+        char *buffer = nullptr;
+        size_t capacity = 0;
+        string chunk;
+        int line_count = 0;
+        bool more = input != nullptr;
+        while (more) {
+            more = ::getline(&buffer, &capacity, input) >= 0;
+            if (more) {
+                chunk += buffer;
+                line_count++;
+            }
+            if ((line_count == 10 || !more) && !chunk.empty()) {
+                int chunk_fd = create_memfd("maple_exe_input", chunk);
+                success &= chunk_fd >= 0 && run_udf(exe_path, chunk_fd, output_fd, limits);
+                if (chunk_fd >= 0) close(chunk_fd);
+                chunk.clear();
+                line_count = 0;
+            }
+        }
+        free(buffer);
+        if (input != nullptr) fclose(input);
+    } else {
+        success = run_udf(exe_path, input_fd, output_fd, limits);
+    }
+    close(input_fd);
+    return success;
+}
+
+/**
+ * Partition the maple output held in a memfd by the hash_key of the first field of each line, appending the lines to
+ * the partition files "<sdfs_prefix>_<partition>_<mission_id>" in local_dir, which are opened on their first line.
+ *
+ * Returns:
+ *      Return false if the memfd cannot be mapped.
+ */
+bool partition_maple_output(int fd, int (*hash_key)(const string &), const string &local_dir,
+                            const string &sdfs_prefix, int mission_id, map<int, ofstream> &partitions,
+                            PartitionProfile &profile) {
+    struct stat result_stat{};
+    if (fstat(fd, &result_stat) != 0) return false;
+    size_t result_size = (size_t) result_stat.st_size;
+    if (result_size == 0) return true;
+    void *mapped = mmap(nullptr, result_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) return false;
+    const char *result = (const char *) mapped;
+
+    for (size_t begin = 0; begin < result_size;) {
+        const char *newline = (const char *) memchr(result + begin, '\n', result_size - begin);
+        size_t end = newline != nullptr ? (size_t) (newline - result) : result_size;
+        /// The key is the first field of the line.
+        size_t key_begin = begin;
+        while (key_begin < end && isspace((unsigned char) result[key_begin])) key_begin++;
+        size_t key_end = key_begin;
+        while (key_end < end && !isspace((unsigned char) result[key_end])) key_end++;
+        string key(result + key_begin, key_end - key_begin);
+        int hashed_key = hash_key(key) % NUM_PARTITIONS;
+        profile.add(hashed_key, key, end - begin + 1);
+        if (partitions.find(hashed_key) == partitions.end()) {
+            string out_file = local_dir + sdfs_prefix + "_" + to_string(hashed_key) + "_" + to_string(mission_id);
+            partitions[hashed_key].open(out_file);
+        }
+        partitions[hashed_key].write(result + begin, (streamsize) (end - begin)) << "\n";
+        begin = end + 1;
+    }
+    munmap(mapped, result_size);
+    return true;
+}
+
+/**
+ * The request, acks and commit file of a maple mission, for the mission event loop.
+ */
+MonitoredMission monitored_maple_mission(MapleMission &mission, const string &maple_exe, const string &sdfs_prefix,
+                                         uint64_t job_id, double sample_fraction) {
+    string request = "maple_start " + maple_exe + " " + sdfs_prefix + " " + to_string(mission.mission_id) + " " +
+                     to_string(job_id) + " " + format_sample_fraction(sample_fraction);
+    for (const auto &file : mission.files) request += " " + file;
+    return {"maple", mission.mission_id, request,
+            {"maple_mission_receive", "maple_mission_finished", "maple_mission_uploaded"},
+            sdfs_prefix + COMMIT_SUFFIX + to_string(mission.mission_id), &mission.phase_id, &mission.attempts};
+}
+
+/**
+ * The request, acks and commit file of a juice mission, for the mission event loop.
+ */
+MonitoredMission monitored_juice_mission(JuiceMission &mission, const string &juice_exe, const string &sdfs_dest,
+                                         int delete_input, int min_mission_id, uint64_t job_id) {
+    string request = "juice_start " + juice_exe + " " + sdfs_dest + " " + to_string(mission.mission_id) + " " +
+                     to_string(delete_input) + " " + to_string(min_mission_id) + " " + to_string(job_id);
+    for (const auto &prefix : mission.prefixes) request += " " + prefix;
+    return {"juice", mission.mission_id, request,
+            {"juice_mission_receive", "juice_mission_finished", "juice_result_uploaded"},
+            sdfs_dest + COMMIT_SUFFIX + to_string(mission.mission_id), &mission.phase_id, &mission.attempts};
+}
+
+/**
+ * Plan the juice inputs from the sizes of the partitions: a partition above JUICE_SPLIT_RATIO times the planned bytes
+ * of a task is split into key ranges of about the planned bytes each, the others are kept whole and are merged into
+ * tasks by the assignment.
+ *
+ * Returns:
+ *      Return the juice inputs, and their expected sizes in input_sizes.
+ */
+vector<string> plan_juice_inputs(const map<string, uint64_t> &partition_sizes, int num_tasks,
+                                 map<string, uint64_t> &input_sizes) {
+    uint64_t total_bytes = 0;
+    for (const auto &item : partition_sizes) total_bytes += item.second;
+    double task_bytes = max((double) total_bytes / max(num_tasks, 1), 1.0);
+    vector<string> inputs;
+    for (const auto &item : partition_sizes) {
+        if ((double) item.second <= JUICE_SPLIT_RATIO * task_bytes) {
+            inputs.push_back(item.first);
+            input_sizes[item.first] = item.second;
+            continue;
+        }
+        int num_ranges = (int) ceil((double) item.second / task_bytes);
+        for (int range = 0; range < num_ranges; range++) {
+            string input = item.first + JUICE_RANGE_SEPARATOR + to_string(range) + "/" + to_string(num_ranges);
+            inputs.push_back(input);
+            input_sizes[input] = item.second / num_ranges;
+        }
+    }
+    return inputs;
+}
+
+/**
+ * Copy the records of an intermediate file whose keys fall into the given range of a split partition.
+ */
+void filter_key_range(const string &input_path, const string &output_path, uint64_t range, uint64_t num_ranges) {
+    ifstream infile(input_path);
+    ofstream outfile(output_path);
+    string line;
+    while (getline(infile, line)) {
+        size_t key_begin = 0;
+        while (key_begin < line.size() && isspace((unsigned char) line[key_begin])) key_begin++;
+        size_t key_end = key_begin;
+        while (key_end < line.size() && !isspace((unsigned char) line[key_end])) key_end++;
+        if (juice_range_hash(line.data() + key_begin, key_end - key_begin) % num_ranges == range)
+            outfile << line << "\n";
+    }
+}
+
+void PartitionProfile::add(int partition, const string &key, uint64_t num_bytes) {
+    records[partition]++;
+    bytes[partition] += num_bytes;
+    if (key.empty()) return;
+    auto it = heavy_keys.find(key);
+    if (it != heavy_keys.end()) {
+        it->second++;
+    } else if (heavy_keys.size() < PROFILE_HEAVY_KEYS) {
+        heavy_keys[key] = 1;
+    } else {
+        auto lightest = heavy_keys.begin();
+        for (auto candidate = heavy_keys.begin(); candidate != heavy_keys.end(); candidate++)
+            if (candidate->second < lightest->second) lightest = candidate;
+        uint64_t count = lightest->second + 1;
+        heavy_keys.erase(lightest);
+        heavy_keys[key] = count;
+    }
+}
+
+void PartitionProfile::merge(const PartitionProfile &other) {
+    for (int i = 0; i < NUM_PARTITIONS; i++) {
+        records[i] += other.records[i];
+        bytes[i] += other.bytes[i];
+    }
+    for (const auto &item : other.heavy_keys) heavy_keys[item.first] += item.second;
+}
+
+string PartitionProfile::serialize() const {
+    string content;
+    for (int i = 0; i < NUM_PARTITIONS; i++)
+        content += "partition " + to_string(i) + " " + to_string(records[i]) + " " + to_string(bytes[i]) + "\n";
+    for (const auto &item : heavy_keys) content += "key " + to_string(item.second) + " " + item.first + "\n";
+    return content;
+}
+
+bool PartitionProfile::deserialize(const string &text) {
+    stringstream ss(text);
+    string line, type, key;
+    int partition = 0, num_partitions = 0;
+    uint64_t count = 0;
+    while (getline(ss, line)) {
+        stringstream line_ss(line);
+        line_ss >> type;
+        if (type == "partition" && line_ss >> partition && partition >= 0 && partition < NUM_PARTITIONS) {
+            line_ss >> records[partition] >> bytes[partition];
+            num_partitions++;
+        } else if (type == "key" && line_ss >> count >> key) {
+            heavy_keys[key] = count;
+        }
+    }
+    return num_partitions == NUM_PARTITIONS;
+}
 
+void server::run_maple_juice_handler() {
+    while (true) {
+        if (!is_maple_juice_master) {
+            if (!check_maple_juice_takeover()) {
+                this_thread::sleep_for(chrono::milliseconds(MASTER_CHECK_MILLISECONDS));
+                continue;
+            }
+            replay_maple_juice_journal();
+        }
+        MapleJuiceJob job;
+        if (!pop_maple_juice_job(PRIORITY_LOW, job)) continue;
+        run_maple_juice_job(job);
     }
 }
 
-void server::handle_maple_query(pair<string, int> query) {
-    string command = query.first, phase, maple_exe, sdfs_prefix, sdfs_src;
+void server::run_maple_juice_job(MapleJuiceJob &job) {
+    int preempted_priority = running_job_priority;
+    running_job_priority = job.priority;
+    cout << "### Run " << job_priority_name(job.priority) << " priority job of " << job.user << endl;
+    string query_type;
+    stringstream ss(job.command);
+    ss >> query_type;
+    if (query_type == "maple") handle_maple_query(job);
+    else if (query_type == "join") handle_join_query(job);
+    else if (query_type == "graph") handle_graph_query(job);
+    else if (query_type == "query") handle_sql_query(job);
+    else if (query_type == "sort") handle_sort_query(job);
+    else if (query_type == "index") handle_index_query(job);
+    else if (query_type == "sketch") handle_sketch_query(job);
+    else if (query_type == "stream" || query_type == "stream_stop") handle_stream_query(job);
+    else handle_juice_query(job);
+    journal_finish_job(job.job_id);
+    running_job_priority = preempted_priority;
+}
+
+bool server::has_preempting_job() {
+    if (running_job_priority < 0) return false;
+    lock_guard<mutex> lock(maple_juice_requests_lock);
+    uint64_t now = get_curr_timestamp_milliseconds();
+    for (const auto &queued : maple_juice_requests)
+        if (queued.priority > running_job_priority && queued.start_after <= now) return true;
+    return false;
+}
+
+void server::run_preempting_jobs() {
+    MapleJuiceJob job;
+    if (running_job_priority < 0 || !pop_maple_juice_job(running_job_priority + 1, job)) return;
+
+    /// The preempting jobs reset the done count and the free workers for their own stages.
+    maple_juice_done_count_lock.lock();
+    int done_count = maple_juice_done_count;
+    bool aborted = maple_juice_aborted;
+    maple_juice_done_count_lock.unlock();
+    free_worker_lock.lock();
+    queue<string> free_workers = free_worker;
+    set<string> held_workers = parked_workers;
+    int num_leased = leased_workers;
+    free_worker_lock.unlock();
+    uint64_t start_time = get_curr_timestamp_milliseconds(), preempted_before = preempted_milliseconds;
+
+    do {
+        cout << "### Preempt the running job for job " << job.job_id << endl;
+        run_maple_juice_job(job);
+    } while (pop_maple_juice_job(running_job_priority + 1, job));
+
+    /// Nested preemptions are already part of this time.
+    preempted_milliseconds = preempted_before + get_curr_timestamp_milliseconds() - start_time;
+    maple_juice_done_count_lock.lock();
+    maple_juice_done_count = done_count;
+    maple_juice_aborted = aborted;
+    maple_juice_done_count_lock.unlock();
+    free_worker_lock.lock();
+    free_worker = free_workers;
+    parked_workers = held_workers;
+    leased_workers = num_leased;
+    free_worker_lock.unlock();
+    free_worker_cv.notify_all();
+}
+
+void server::handle_maple_query(MapleJuiceJob job) {
+    string command = job.command, phase, maple_exe, sdfs_prefix, sdfs_src;
     cout << "### Receive maple query:" << command << endl;
-    int sock = query.second, num_maples = 0, available_workers = 0;
+    int sock = job.sock, num_maples = 0, available_workers = 0, incremental = 0, num_missions = 0;
+    uint64_t job_id = job.job_id, total_bytes = 0, start_time = get_curr_timestamp_milliseconds();
+    uint64_t preempted_before = preempted_milliseconds;
+    double sample_fraction = 1, budget_seconds = 0;
     map<string, Member> curr_membership_list;
     vector<string> sdfs_source_files;
+    IncrementalManifest manifest;
 
     map<string, MapleMission> worker_mission_pair;
-
-    while (!free_worker.empty()) free_worker.pop();
+    vector<MapleMission> pending_missions;
 
     maple_juice_done_count = 0;
+    maple_juice_aborted = false;
 
     try {
 
         /// Decode maple command.
         stringstream ss(command);
         ss >> phase >> maple_exe >> num_maples >> sdfs_prefix >> sdfs_src;
+        string option;
+        while (ss >> option) {
+            if (option.compare(0, 7, "sample=") == 0) sample_fraction = atof(option.c_str() + 7);
+            else if (option.compare(0, 7, "budget=") == 0) budget_seconds = atof(option.c_str() + 7);
+            else {
+                string value = option.compare(0, 12, "incremental=") == 0 ? option.substr(12) : option;
+                if (!(value == "0" || value == "1"))
+                    throw runtime_error("Unknown maple option: " + option);
+                incremental = atoi(value.c_str());
+            }
+        }
 
         /// Conduct error handling.
         if (phase != "maple")
             throw runtime_error("Command type error!");
+        if (sample_fraction <= 0 || sample_fraction > 1 || budget_seconds < 0)
+            throw runtime_error("Sample fraction must be in (0, 1] and budget must be positive!");
+        if (num_maples < 0)
+            throw runtime_error("num_maples must be positive, or 0 to plan it from the past runs!");
 
         cout << "begin membership to curr membership list" << endl;
 
+        /// Choose the workers with the highest expected rates, all usable ones when the job plans its own number.
+        vector<string> workers = select_mission_workers(num_maples > 0 ? num_maples : NUM_VMS, job_id);
         membership_list_lock.lock();
-        if ((int) membership_list.size() <= num_maples + 1) {
-            cout << "simple copy the membership list " << endl;
-            curr_membership_list = membership_list;
-            curr_membership_list.erase(my_ip_address);
-        } else {
-            cout << "begin choose the first num of members" << endl;
-            auto it = membership_list.begin();
-            while ((int) curr_membership_list.size() < num_maples) {
-                cout << it->first << endl;
-                if (it->first != my_ip_address) {
-                    curr_membership_list[it->first] = it->second;
-                }
-                it++;
-                cout << curr_membership_list.size() << endl;
-            }
-        }
+        for (const auto &worker : workers)
+            if (membership_list.find(worker) != membership_list.end())
+                curr_membership_list[worker] = membership_list[worker];
         membership_list_lock.unlock();
 
         available_workers = (int) curr_membership_list.size();
@@ -81,15 +603,103 @@ void server::handle_maple_query(pair<string, int> query) {
         if (check_file_exist(maple_exe) == "-1")
             throw runtime_error("No such maple_exe, please first put it onto sdfs!");
 
-        sdfs_source_files = check_all_exist_file_by_prefix(sdfs_src);
-        if (sdfs_source_files.empty())
-            throw runtime_error("No such sdfs intermediate filename prefix!");
+        if (incremental == 1) manifest = load_manifest(sdfs_prefix);
+
+        if (!job.recorded_missions.empty()) {
+            /// A job replayed from the journal keeps its recorded missions, the committed ones are not redone.
+            pending_missions.reserve(job.recorded_missions.size());
+            auto worker_it = curr_membership_list.begin();
+            for (const auto &item : job.recorded_missions) {
+                MapleMission mission = {item.first, PHASE_I, item.second};
+                sdfs_source_files.insert(sdfs_source_files.end(), item.second.begin(), item.second.end());
+                num_missions++;
+                if (check_mission_committed(sdfs_prefix + COMMIT_SUFFIX + to_string(item.first), job_id)) {
+                    maple_juice_done_count++;
+                } else if (worker_it != curr_membership_list.end()) {
+                    worker_mission_pair[(worker_it++)->first] = mission;
+                } else {
+                    pending_missions.push_back(mission);
+                }
+            }
+        } else {
+            sdfs_source_files = check_all_exist_file_by_prefix(sdfs_src);
+            if (sdfs_source_files.empty())
+                throw runtime_error("No such sdfs intermediate filename prefix!");
+        }
 
-        /// Use selected partition strategy to assign files.
-        if (USE_RANGE_BASED_PARTITION)
-            range_based_assign(worker_mission_pair, curr_membership_list, sdfs_source_files);
-        else
-            hash_based_assign(worker_mission_pair, curr_membership_list, sdfs_source_files);
+        /// In incremental mode only map the source files not mapped by previous runs, and give the new
+        /// missions fresh ids so that their intermediate files do not overwrite the old ones.
+        if (incremental == 1 && job.recorded_missions.empty()) {
+            vector<string> new_source_files;
+            for (const auto &file : sdfs_source_files)
+                if (manifest.mapped_files.find(file) == manifest.mapped_files.end())
+                    new_source_files.push_back(file);
+            if (new_source_files.empty()) {
+                reply_to_client(sock, "Maple job: (" + command + ") finished, no new input files!");
+                return;
+            }
+            sdfs_source_files = new_source_files;
+        }
+
+        /// Approximate mode: the workers only map a random sample of the records. A time budget lowers the
+        /// sample fraction to what the workers are expected to map in time at the last measured throughput.
+        map<string, uint64_t> file_sizes = get_file_sizes_by_prefix(sdfs_src);
+        for (const auto &file : sdfs_source_files) total_bytes += file_sizes[file];
+
+        /// Plan the number of missions from the past runs of the job. With num_maples 0 the job runs with the planned
+        /// number, otherwise the planned number is only suggested.
+        string signature = "maple:" + maple_exe + ":" + sdfs_src;
+        JobTuning tuning = tune_from_history(signature, total_bytes, available_workers);
+        bool tuned = num_maples == 0 && job.recorded_missions.empty();
+        if (tuned && tuning.num_tasks < available_workers) {
+            int num_kept = 0;
+            for (const auto &worker : workers)
+                if (curr_membership_list.count(worker) && num_kept++ >= tuning.num_tasks)
+                    curr_membership_list.erase(worker);
+            available_workers = (int) curr_membership_list.size();
+        }
+        string tuning_summary = describe_tuning(tuning, "num_maples", num_maples, tuned);
+
+        stringstream sample_record(sdfs_read_text(sdfs_prefix + SAMPLE_SUFFIX));
+        uint64_t sample_job_id = 0;
+        double recorded_fraction = 1;
+        bool has_sample_record = (bool) (sample_record >> sample_job_id >> recorded_fraction);
+        if (has_sample_record && sample_job_id == job_id) {
+            /// A replayed job keeps the fraction chosen before the failover.
+            sample_fraction = recorded_fraction;
+        } else if (incremental == 1 && manifest.next_mission_id > 0) {
+            /// The new files of an incremental run are sampled like the files mapped before.
+            sample_fraction = has_sample_record ? recorded_fraction : 1;
+        } else if (budget_seconds > 0 && total_bytes > 0) {
+            double affordable_bytes = budget_seconds * maple_bytes_per_second * available_workers;
+            sample_fraction = min(sample_fraction, max(SAMPLE_MIN_FRACTION, affordable_bytes / (double) total_bytes));
+        }
+        if (sample_fraction < 1 || has_sample_record)
+            sdfs_write_text(sdfs_prefix + SAMPLE_SUFFIX,
+                            to_string(job_id) + " " + format_sample_fraction(sample_fraction));
+        if (sample_fraction < 1)
+            cout << "### Maple over a sample of fraction " << sample_fraction << endl;
+
+        /// Use selected partition strategy to assign files, and journal the missions for a master failover.
+        if (job.recorded_missions.empty()) {
+            if (USE_LOAD_BASED_PARTITION)
+                load_based_assign(worker_mission_pair, curr_membership_list, sdfs_source_files, file_sizes,
+                                  manifest.next_mission_id);
+            else if (USE_RANGE_BASED_PARTITION)
+                range_based_assign(worker_mission_pair, curr_membership_list, sdfs_source_files,
+                                   manifest.next_mission_id);
+            else
+                hash_based_assign(worker_mission_pair, curr_membership_list, sdfs_source_files,
+                                  manifest.next_mission_id);
+            num_missions = (int) worker_mission_pair.size();
+            for (const auto &item : worker_mission_pair) {
+                string record = "assign " + to_string(job_id) + " " + to_string(item.second.mission_id);
+                for (const auto &file : item.second.files) record += " " + file;
+                journal_append(record);
+            }
+            /// A failover must find all missions of the job, or none of them.
+            journal_sync();
+        }
 
         cout << "### Maple workers assigned:" << endl;
         for (const auto &item : worker_mission_pair) {
@@ -98,79 +708,140 @@ void server::handle_maple_query(pair<string, int> query) {
             cout << endl;
         }
 
-        /// Assign maple missions to selected slaves.
-        for (auto &item: worker_mission_pair) {
-            thread(&server::maple_task_monitor, this, ref(item.second), item.first, maple_exe, sdfs_prefix).detach();
+        /// Assign maple missions to selected slaves, and wait for them to all finish.
+        reset_free_workers((int) worker_mission_pair.size());
+        vector<MonitoredMission> monitored_missions;
+        vector<string> assigned_workers;
+        set<string> busy_workers;
+        JobRun run;
+        auto add_mission = [&](MapleMission &mission) {
+            uint64_t mission_bytes = 0;
+            for (const auto &file : mission.files) mission_bytes += file_sizes[file];
+            run.tasks.emplace_back(mission_bytes, 0);
+            monitored_missions.push_back(monitored_maple_mission(mission, maple_exe, sdfs_prefix, job_id,
+                                                                 sample_fraction));
+        };
+        for (auto &item : worker_mission_pair) {
+            assigned_workers.push_back(item.first);
+            busy_workers.insert(item.first);
+            add_mission(item.second);
         }
-
-        /// Wait for maple missions to all finish.
-        while (true) {
-            maple_juice_done_count_lock.lock();
-            if (maple_juice_done_count == (int) worker_mission_pair.size()) {
-                maple_juice_done_count_lock.unlock();
-                break;
+        for (auto &mission : pending_missions) add_mission(mission);
+        release_idle_workers(busy_workers);
+        release_spare_slots(assigned_workers);
+        vector<uint64_t> durations = monitor_missions(monitored_missions, assigned_workers, job_id);
+        /// The jobs preempting this one do not count in its timing.
+        uint64_t preempted_time = preempted_milliseconds - preempted_before;
+
+        /// The missions of this run are numbered from the first id the manifest left free.
+        string skew_summary = write_skew_report(sdfs_prefix, job_id, manifest.next_mission_id, num_missions);
+
+        /// Record the run for the planning of the next runs, a replayed job only timed part of its missions.
+        if (job.recorded_missions.empty()) {
+            run.signature = signature;
+            run.job_id = job_id;
+            run.input_bytes = (uint64_t) ((double) total_bytes * sample_fraction);
+            for (const auto &item : get_file_sizes_by_prefix(sdfs_prefix + "_")) {
+                int mission_id = atoi(item.first.substr(item.first.rfind('_') + 1).c_str());
+                if (mission_id >= manifest.next_mission_id && mission_id < manifest.next_mission_id + num_missions)
+                    run.shuffle_bytes += item.second;
             }
-            maple_juice_done_count_lock.unlock();
+            run.elapsed_milliseconds = get_curr_timestamp_milliseconds() - start_time - preempted_time;
+            for (size_t i = 0; i < run.tasks.size(); i++)
+                run.tasks[i].second = durations[i];
+            record_job_run(run);
         }
 
-        string over_write_response = "Maple job: (" + command + ") finished!";
-        const char *res = over_write_response.c_str();
-        send(sock, res, strlen(res), 0);
-        close(sock);
+        /// Record the mapped files. A full run starts a new manifest since it rewrites the mission ids from 0.
+        if (incremental != 1) manifest = IncrementalManifest();
+        manifest.next_mission_id += num_missions;
+        for (const auto &file : sdfs_source_files) manifest.mapped_files.insert(file);
+        store_manifest(sdfs_prefix, manifest);
+        delete_all_file_by_prefix(sdfs_prefix + COMMIT_SUFFIX);
+
+        /// Measure the throughput for the next time budget.
+        double elapsed_seconds = (double) (get_curr_timestamp_milliseconds() - start_time - preempted_time) / 1000;
+        if (total_bytes > 0 && elapsed_seconds > 0)
+            maple_bytes_per_second = (double) total_bytes * sample_fraction / elapsed_seconds / available_workers;
+
+        if (sample_fraction < 1)
+            reply_to_client(sock, "Maple job: (" + command + ") finished over a sample of fraction " +
+                                  format_sample_fraction(sample_fraction) + skew_summary + tuning_summary + "!");
+        else reply_to_client(sock, "Maple job: (" + command + ") finished" + skew_summary + tuning_summary + "!");
     } catch (runtime_error &e) {
         std::cerr << "error: " << e.what() << std::endl;
-        string error = e.what();
-        const char *res = error.c_str();
-        send(sock, res, strlen(res), 0);
-        close(sock);
+        reply_to_client(sock, e.what());
     }
 
 }
 
-void server::handle_juice_query(pair<string, int> query) {
-    string command = query.first, phase, juice_exe, sdfs_prefix, sdfs_dest;
-    int delete_input = 0;
+void server::handle_juice_query(MapleJuiceJob job) {
+    string command = job.command, phase, juice_exe, sdfs_prefix, sdfs_dest;
+    int delete_input = 0, incremental = 0, bucket = 0, min_mission_id = 0;
+    uint64_t job_id = job.job_id, start_time = get_curr_timestamp_milliseconds();
+    uint64_t preempted_before = preempted_milliseconds;
     cout << "### Receive juice query:" << command << endl;
 
-    int sock = query.second, num_juices = 0, available_workers = 0;
+    int sock = job.sock, num_juices = 0, available_workers = 0;
     map<string, Member> curr_membership_list;
     vector<string> sdfs_source_files;
+    IncrementalManifest manifest;
 
     map<string, JuiceMission> worker_mission_pair;
-
-    while (!free_worker.empty()) free_worker.pop();
+    vector<JuiceMission> pending_missions;
 
     maple_juice_done_count = 0;
+    maple_juice_aborted = false;
 
     try {
 
         /// Decode juice command.
         stringstream ss(command);
-        ss >> phase >> juice_exe >> num_juices >> sdfs_prefix >> sdfs_dest >> delete_input;
+        ss >> phase >> juice_exe >> num_juices >> sdfs_prefix >> sdfs_dest;
+        /// The options are delete_input, then incremental as a number or "incremental=", and "bucket=" anywhere.
+        string option;
+        int num_flags = 0;
+        while (ss >> option) {
+            string value = option;
+            int *flag = nullptr;
+            if (option.compare(0, 7, "bucket=") == 0) {
+                flag = &bucket;
+                value = option.substr(7);
+            } else if (num_flags++ == 0) {
+                flag = &delete_input;
+            } else if (num_flags == 2) {
+                flag = &incremental;
+                if (option.compare(0, 12, "incremental=") == 0) value = option.substr(12);
+            }
+            if (flag == nullptr || !(value == "0" || value == "1"))
+                throw runtime_error("Unknown juice option: " + option);
+            *flag = atoi(value.c_str());
+        }
 
         /// Conduct error handling.
         if (phase != "juice")
             throw runtime_error("Command type error!");
+        if (num_juices < 0)
+            throw runtime_error("num_juices must be positive, or 0 to plan it from the past runs!");
+        if (bucket == 1 && incremental == 1)
+            throw runtime_error("Incremental juice into a bucketed output is not supported!");
+
+        /// Intermediate files mapped over a sample give an approximate output scaled up to the whole input.
+        stringstream sample_record(sdfs_read_text(sdfs_prefix + SAMPLE_SUFFIX));
+        uint64_t sample_job_id = 0;
+        double sample_fraction = 1;
+        if (!(sample_record >> sample_job_id >> sample_fraction)) sample_fraction = 1;
+        if (sample_fraction < 1 && incremental == 1)
+            throw runtime_error("Incremental juice over a sampled maple is not supported!");
 
         cout << "begin membership to curr membership list" << endl;
 
+        /// Choose the workers with the highest expected rates.
+        vector<string> workers = select_mission_workers(num_juices > 0 ? num_juices : NUM_VMS, job_id);
         membership_list_lock.lock();
-        if ((int) membership_list.size() <= num_juices + 1) {
-            cout << "simple copy the membership list " << endl;
-            curr_membership_list = membership_list;
-            curr_membership_list.erase(my_ip_address);
-        } else {
-            cout << "begin choose the first num of members" << endl;
-            auto it = membership_list.begin();
-            while ((int) curr_membership_list.size() < num_juices) {
-                cout << it->first << endl;
-                if (it->first != my_ip_address) {
-                    curr_membership_list[it->first] = it->second;
-                }
-                it++;
-                cout << curr_membership_list.size() << endl;
-            }
-        }
+        for (const auto &worker : workers)
+            if (membership_list.find(worker) != membership_list.end())
+                curr_membership_list[worker] = membership_list[worker];
         membership_list_lock.unlock();
 
         available_workers = (int) curr_membership_list.size();
@@ -178,28 +849,92 @@ void server::handle_juice_query(pair<string, int> query) {
         if (available_workers <= 0)
             throw runtime_error("No enough workers!");
 
-        if (check_file_exist(juice_exe) == "-1")
+        if (is_builtin_juice(juice_exe) && parse_builtin_juice(juice_exe) == JUICE_UNKNOWN)
+            throw runtime_error("No such built-in juice, use @sum, @count, @min, @max or @avg!");
+        if (!is_builtin_juice(juice_exe) && check_file_exist(juice_exe) == "-1")
             throw runtime_error("No such juice_exe, please first put it onto sdfs!");
+        if (sample_fraction < 1 && is_builtin_juice(juice_exe) && juice_exe != "@count" && juice_exe != "@sum")
+            throw runtime_error("Only counts and sums scale to the whole input, use @count or @sum over a sample!");
+        if (juice_exe == "@count" && incremental == 1)
+            throw runtime_error("Incremental juice needs a juice_exe whose output is valid input of itself, use @sum "
+                                "over a count of 1 per record instead of @count!");
 
         sdfs_source_files = check_all_exist_file_by_prefix(sdfs_prefix);
         if (sdfs_source_files.empty())
             throw runtime_error("No such sdfs intermediate filename prefix!");
 
+        /// In incremental mode only reduce the maple missions not merged into sdfs_dest yet.
+        if (incremental == 1) {
+            manifest = load_manifest(sdfs_prefix);
+            auto watermark = manifest.juiced_until.find(sdfs_dest);
+            /// Without a watermark every mission would be merged again into the values it already holds.
+            if (watermark == manifest.juiced_until.end() && check_file_exist(sdfs_dest) != "-1")
+                throw runtime_error("sdfs_dest was not written by a juice over this prefix, run a full juice first!");
+            min_mission_id = watermark == manifest.juiced_until.end() ? 0 : watermark->second;
+            if (min_mission_id >= manifest.next_mission_id) {
+                reply_to_client(sock, "Juice job: (" + command + ") finished, no new intermediate files!");
+                return;
+            }
+        }
 
-        /// Use range based partition strategy to assign files.
-        vector<string> membership;
-        membership.reserve(curr_membership_list.size());
-        for (const auto &item : curr_membership_list) membership.push_back(item.first);
         int mission_id = 0;
-        int cnt = 0;
-        for (int i = 0; i < NUM_VMS; i++) {
-            if (worker_mission_pair.find(membership[cnt]) == worker_mission_pair.end()) {
-                JuiceMission new_mission = {mission_id++, PHASE_I, {sdfs_prefix + "_" + to_string(i)}};
-                worker_mission_pair[membership[cnt]] = new_mission;
-            } else {
-                worker_mission_pair[membership[cnt]].prefixes.push_back(sdfs_prefix + "_" + to_string(i));
+        string signature = "juice:" + juice_exe + ":" + sdfs_prefix, tuning_summary;
+        map<string, uint64_t> input_sizes;
+        JobRun run;
+        if (!job.recorded_missions.empty()) {
+            /// A job replayed from the journal keeps its recorded missions, the committed ones are not redone.
+            pending_missions.reserve(job.recorded_missions.size());
+            auto worker_it = curr_membership_list.begin();
+            for (const auto &item : job.recorded_missions) {
+                JuiceMission mission = {item.first, PHASE_I, item.second};
+                mission_id = max(mission_id, item.first + 1);
+                if (check_mission_committed(sdfs_dest + COMMIT_SUFFIX + to_string(item.first), job_id)) {
+                    maple_juice_done_count++;
+                } else if (worker_it != curr_membership_list.end()) {
+                    worker_mission_pair[(worker_it++)->first] = mission;
+                } else {
+                    pending_missions.push_back(mission);
+                }
+            }
+        } else {
+            /// Plan the juice tasks from the sizes of the intermediate files: a partition much larger than a task is
+            /// split into key ranges. With num_juices 0 a small job runs on fewer workers, by the least bytes of a
+            /// task learned from the past runs of the job if there are any, otherwise the requested number of tasks
+            /// runs and the planned number is only suggested. The inputs are assigned in proportion to the expected
+            /// rates of the workers, and the missions are journaled for a master failover.
+            map<string, uint64_t> partition_sizes;
+            uint64_t total_bytes = 0;
+            for (const auto &item : get_file_sizes_by_prefix(sdfs_prefix + "_")) {
+                string partition = item.first.substr(0, item.first.rfind('_'));
+                if (atoi(item.first.substr(item.first.rfind('_') + 1).c_str()) >= min_mission_id) {
+                    partition_sizes[partition] += item.second;
+                    total_bytes += item.second;
+                }
             }
-            cnt = (cnt + 1) % (int) membership.size();
+            JobTuning tuning = tune_from_history(signature, total_bytes, available_workers);
+            bool tuned = num_juices == 0 && job.recorded_missions.empty();
+            int num_tasks = available_workers;
+            if (tuned)
+                num_tasks = tuning.num_runs > 0 ? tuning.num_tasks :
+                            max(1, (int) min((uint64_t) available_workers,
+                                             (total_bytes + JUICE_MIN_TASK_BYTES - 1) / JUICE_MIN_TASK_BYTES));
+            tuning_summary = describe_tuning(tuning, "num_juices", num_juices, tuned);
+            run.input_bytes = total_bytes;
+            run.shuffle_bytes = total_bytes;
+            int num_kept = 0;
+            for (const auto &worker : workers)
+                if (curr_membership_list.count(worker) && num_kept++ >= num_tasks) curr_membership_list.erase(worker);
+            vector<string> juice_inputs = plan_juice_inputs(partition_sizes, num_tasks, input_sizes);
+            cout << "### Juice plan: " << partition_sizes.size() << " partitions of " << total_bytes << " bytes into "
+                 << juice_inputs.size() << " inputs on " << num_tasks << " workers" << endl;
+            for (auto &item : assign_by_expected_rate(curr_membership_list, juice_inputs, input_sizes))
+                worker_mission_pair[item.first] = {mission_id++, PHASE_I, item.second};
+            for (const auto &item : worker_mission_pair) {
+                string record = "assign " + to_string(job_id) + " " + to_string(item.second.mission_id);
+                for (const auto &prefix : item.second.prefixes) record += " " + prefix;
+                journal_append(record);
+            }
+            journal_sync();
         }
 
         cout << "### Juice workers assigned:" << endl;
@@ -209,62 +944,145 @@ void server::handle_juice_query(pair<string, int> query) {
             cout << endl;
         }
 
-        /// Assign juice missions to selected slaves.
-        for (auto &item: worker_mission_pair) {
-            thread(&server::juice_task_monitor, this, ref(item.second), item.first, juice_exe, sdfs_dest,
-                   delete_input).detach();
-        }
-
-        /// Wait for juice missions to all finish.
-        while (true) {
-            maple_juice_done_count_lock.lock();
-            if (maple_juice_done_count == (int) worker_mission_pair.size()) {
-                maple_juice_done_count_lock.unlock();
-                break;
-            }
-            maple_juice_done_count_lock.unlock();
+        /// Assign juice missions to selected slaves, and wait for them to all finish.
+        reset_free_workers((int) worker_mission_pair.size());
+        vector<MonitoredMission> monitored_missions;
+        vector<string> assigned_workers;
+        set<string> busy_workers;
+        auto add_mission = [&](JuiceMission &mission) {
+            uint64_t mission_bytes = 0;
+            for (const auto &input : mission.prefixes) mission_bytes += input_sizes[input];
+            run.tasks.emplace_back(mission_bytes, 0);
+            monitored_missions.push_back(monitored_juice_mission(mission, juice_exe, sdfs_dest, delete_input,
+                                                                 min_mission_id, job_id));
+        };
+        for (auto &item : worker_mission_pair) {
+            assigned_workers.push_back(item.first);
+            busy_workers.insert(item.first);
+            add_mission(item.second);
         }
+        for (auto &mission : pending_missions) add_mission(mission);
+        release_idle_workers(busy_workers);
+        release_spare_slots(assigned_workers);
+        vector<uint64_t> durations = monitor_missions(monitored_missions, assigned_workers, job_id);
+        /// The jobs preempting this one do not count in its timing.
+        uint64_t preempted_time = preempted_milliseconds - preempted_before;
 
         /// Combine the final juice outputs from multiple slaves to a single file on master node, and put to sdfs.
+        string juice_output_files;
         for (int i = 0; i < mission_id; i++) {
             string juice_output_file_name = sdfs_dest + "_" + to_string(i);
             string target_get_ip = check_file_exist(juice_output_file_name);
             get_query_sender(juice_output_file_name, juice_output_file_name, target_get_ip);
+            juice_output_files += " files/fetched/" + juice_output_file_name;
         }
 
-        string sys_command = "cat files/fetched/" + sdfs_dest + "* | sort > files/fetched/" + sdfs_dest;
+        string sys_command;
+        if (incremental == 1) {
+            /// The new partial aggregates are merged into the previous output by running the juice_exe again,
+            /// so incremental mode requires a juice_exe whose output lines are valid input of itself.
+            string previous_output = sdfs_dest + "_previous";
+            if (check_file_exist(sdfs_dest) != "-1") {
+                get_query_sender(sdfs_dest, previous_output, check_file_exist(sdfs_dest));
+                juice_output_files += " files/fetched/" + previous_output;
+            }
+            if (is_builtin_juice(juice_exe)) {
+                vector<string> input_paths;
+                stringstream input_ss(juice_output_files);
+                for (string path; input_ss >> path;) input_paths.push_back(path);
+                ofstream result_ofs("files/fetched/" + sdfs_dest);
+                bool success = run_builtin_juice(juice_exe, input_paths, result_ofs);
+                result_ofs.close();
+                if (!success)
+                    throw runtime_error("Built-in juice failed on the juice outputs!");
+                sys_command = "sort -o files/fetched/" + sdfs_dest + " files/fetched/" + sdfs_dest;
+            } else {
+                get_query_sender(juice_exe, juice_exe, check_file_exist(juice_exe));
+                sys_command = "chmod +x files/fetched/" + juice_exe;
+                system(sys_command.c_str());
+                sys_command = "cat" + juice_output_files + " | files/fetched/" + juice_exe +
+                              " | sort > files/fetched/" + sdfs_dest;
+            }
+        } else {
+            sys_command = "cat" + juice_output_files + " | sort > files/fetched/" + sdfs_dest;
+        }
         system(sys_command.c_str());
-        maple_juice_put(curr_dir + "/files/fetched/" + sdfs_dest, sdfs_dest);
+        if (sample_fraction < 1) {
+            string error_file = sdfs_dest + SAMPLE_ERROR_SUFFIX;
+            scale_sampled_output("files/fetched/" + sdfs_dest, "files/fetched/" + error_file, sample_fraction);
+            maple_juice_put(curr_dir + "/files/fetched/" + error_file, error_file);
+        }
+        /// A bucketed output is kept partitioned like maple output, so a later job on the same key needs no shuffle.
+        string bucket_summary;
+        if (bucket == 1) {
+            BucketLayout layout = write_bucketed_output("files/fetched/" + sdfs_dest, sdfs_dest);
+            bucket_summary = ", written as " + to_string(layout.buckets.size()) + " buckets " + sdfs_dest +
+                             BUCKET_INFIX + "_<partition>_0";
+        } else {
+            maple_juice_put(curr_dir + "/files/fetched/" + sdfs_dest, sdfs_dest);
+        }
         sys_command = "rm files/fetched/" + sdfs_dest + "*";
         system(sys_command.c_str());
 
+        /// A full juice holds every mission as well, so the next incremental juice starts after them. A bucketed
+        /// output has no single file to merge into, so it keeps no watermark.
+        if (incremental != 1) manifest = load_manifest(sdfs_prefix);
+        if (manifest.next_mission_id > 0) {
+            if (bucket == 1) manifest.juiced_until.erase(sdfs_dest);
+            else manifest.juiced_until[sdfs_dest] = manifest.next_mission_id;
+            store_manifest(sdfs_prefix, manifest);
+        }
+
         for (int i = 0; i < mission_id; i++) {
             string juice_output_file_name = sdfs_dest + "_" + to_string(i);
             delete_all_file_by_prefix(juice_output_file_name);
         }
+        delete_all_file_by_prefix(sdfs_dest + COMMIT_SUFFIX);
+
+        /// The missions of a split partition share its files, so they are deleted once all ranges are done.
+        if (delete_input == 1) {
+            set<string> split_partitions;
+            for (const auto &item : worker_mission_pair)
+                for (const auto &input : item.second.prefixes)
+                    if (input.find(JUICE_RANGE_SEPARATOR) != string::npos)
+                        split_partitions.insert(input.substr(0, input.find(JUICE_RANGE_SEPARATOR)));
+            for (const auto &mission : pending_missions)
+                for (const auto &input : mission.prefixes)
+                    if (input.find(JUICE_RANGE_SEPARATOR) != string::npos)
+                        split_partitions.insert(input.substr(0, input.find(JUICE_RANGE_SEPARATOR)));
+            for (const auto &partition : split_partitions) delete_all_file_by_prefix(partition);
+        }
 
-        string over_write_response = "Juice job: (" + command + ") finished!";
-        const char *res = over_write_response.c_str();
-        send(sock, res, strlen(res), 0);
-        close(sock);
+        /// Record the run for the planning of the next runs, a replayed job only timed part of its missions.
+        if (job.recorded_missions.empty()) {
+            run.signature = signature;
+            run.job_id = job_id;
+            run.elapsed_milliseconds = get_curr_timestamp_milliseconds() - start_time - preempted_time;
+            for (size_t i = 0; i < run.tasks.size(); i++)
+                run.tasks[i].second = durations[i];
+            record_job_run(run);
+        }
+
+        if (sample_fraction < 1)
+            reply_to_client(sock, "Juice job: (" + command + ") finished with an approximate result, confidence "
+                                  "intervals are in " + sdfs_dest + SAMPLE_ERROR_SUFFIX + bucket_summary +
+                                  tuning_summary + "!");
+        else reply_to_client(sock, "Juice job: (" + command + ") finished" + bucket_summary + tuning_summary + "!");
     } catch (runtime_error &e) {
         std::cerr << "error: " << e.what() << std::endl;
-        string error = e.what();
-        const char *res = error.c_str();
-        send(sock, res, strlen(res), 0);
-        close(sock);
+        reply_to_client(sock, e.what());
     }
 }
 
 
 void server::range_based_assign(map<string, MapleMission> &worker_mission_pair,
                                 map<string, Member> &curr_membership_list,
-                                vector<string> &sdfs_source_files) {
+                                vector<string> &sdfs_source_files, int base_mission_id) {
     vector<string> membership;
     membership.reserve(curr_membership_list.size());
     for (const auto &item : curr_membership_list) membership.push_back(item.first);
     int cnt = 0;
-    int mission_id = 0;
+    int mission_id = base_mission_id;
     for (const auto &file : sdfs_source_files) {
         if (worker_mission_pair.find(membership[cnt]) == worker_mission_pair.end()) {
             MapleMission new_mission = {mission_id++, PHASE_I, {file}};
@@ -277,13 +1095,69 @@ void server::range_based_assign(map<string, MapleMission> &worker_mission_pair,
     }
 }
 
+void server::load_based_assign(map<string, MapleMission> &worker_mission_pair,
+                               map<string, Member> &curr_membership_list, vector<string> &sdfs_source_files,
+                               const map<string, uint64_t> &file_sizes, int base_mission_id) {
+    int mission_id = base_mission_id;
+    for (auto &item : assign_by_expected_rate(curr_membership_list, sdfs_source_files, file_sizes))
+        worker_mission_pair[item.first] = {mission_id++, PHASE_I, item.second};
+}
+
+map<string, vector<string>> server::assign_by_expected_rate(const map<string, Member> &workers,
+                                                            vector<string> items,
+                                                            const map<string, uint64_t> &item_sizes) {
+    auto size_of = [&item_sizes](const string &item) {
+        auto it = item_sizes.find(item);
+        return it == item_sizes.end() ? (uint64_t) 1 : max(it->second, (uint64_t) 1);
+    };
+    stable_sort(items.begin(), items.end(),
+                [&size_of](const string &a, const string &b) { return size_of(a) > size_of(b); });
+
+    vector<string> names;
+    vector<double> rates, assigned_bytes;
+    for (const auto &item : workers) {
+        names.push_back(item.first);
+        rates.push_back(expected_worker_rate(item.second));
+        assigned_bytes.push_back(0);
+    }
+
+    map<string, vector<string>> assignment;
+    if (names.empty()) return assignment;
+    for (const auto &item : items) {
+        size_t best = 0;
+        for (size_t i = 1; i < names.size(); i++)
+            if ((assigned_bytes[i] + size_of(item)) / rates[i] < (assigned_bytes[best] + size_of(item)) / rates[best])
+                best = i;
+        assigned_bytes[best] += size_of(item);
+        assignment[names[best]].push_back(item);
+    }
+    for (size_t i = 0; i < names.size(); i++)
+        cout << "### " << names[i] << " expected " << (uint64_t) rates[i] / 1024 << " KB/s, assigned "
+             << (uint64_t) assigned_bytes[i] << " bytes" << endl;
+    return assignment;
+}
+
+double server::expected_worker_rate(const Member &member) {
+    /// Until a worker has reported its own throughput, it is assumed to map as fast as the cluster average.
+    double throughput = member.throughput_kbps > 0 ? member.throughput_kbps * 1024.0 : maple_bytes_per_second;
+    double busy = max(member.cpu_load / 100.0, (double) member.running_missions);
+    return max(throughput, 1.0) / (1 + busy);
+}
+
+void server::record_mission_throughput(uint64_t num_bytes, uint64_t elapsed_milliseconds) {
+    double throughput = (double) num_bytes * 1000 / (double) max(elapsed_milliseconds, (uint64_t) 1);
+    double recent = recent_throughput.load();
+    recent_throughput = recent == 0 ? throughput :
+                        (1 - LOAD_THROUGHPUT_SMOOTHING) * recent + LOAD_THROUGHPUT_SMOOTHING * throughput;
+}
+
 void server::hash_based_assign(map<string, MapleMission> &worker_mission_pair,
                                map<string, Member> &curr_membership_list,
-                               vector<string> &sdfs_source_files) {
+                               vector<string> &sdfs_source_files, int base_mission_id) {
     vector<string> membership;
     membership.reserve(curr_membership_list.size());
     for (const auto &item : curr_membership_list) membership.push_back(item.first);
-    int mission_id = 0;
+    int mission_id = base_mission_id;
 
     for (const auto &file : sdfs_source_files) {
         int temp = hash_string_to_int(file) % curr_membership_list.size();
@@ -296,115 +1170,6 @@ void server::hash_based_assign(map<string, MapleMission> &worker_mission_pair,
     }
 }
 
-void server::maple_task_monitor(MapleMission &mission, string target_ip, string maple_exe, string sdfs_prefix) {
-    int sock = 0;
-    char buffer[MAX_BUFFER_SIZE] = {0};
-    string response;
-    try {
-        /// Initialize socket connection.
-        struct sockaddr_in serv_addr{};
-        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-            throw runtime_error("Failure in create socket");
-
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(this->mj_port);
-
-        if (inet_pton(AF_INET, target_ip.c_str(), &serv_addr.sin_addr) <= 0)
-            throw runtime_error("Invalid address");
-
-        /// Try to connect to server, if fail then mark server as down.
-        if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-            throw runtime_error("Connection failed");
-
-        cout << "### begin send out maple request!" << endl;
-
-        string maple_request = "maple_start " + maple_exe + " " + sdfs_prefix + " " + to_string(mission.mission_id);
-        cout << maple_request << endl;
-        for (auto &f : mission.files) {
-            maple_request.push_back(' ');
-            maple_request += f;
-        }
-        cout << maple_request << endl;
-        const char *ls_file_c = maple_request.c_str();
-        if (send(sock, ls_file_c, strlen(ls_file_c), 0) == -1)
-            throw runtime_error("Sending maple mission failure");
-
-        cout << "### send out maple request success!" << endl;
-
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_I to PHASE_II");
-        else {
-            response = buffer;
-            if (response == "maple_mission_receive") {
-                mission.phase_id = PHASE_II;
-                cout << target_ip << " entered phase II" << endl;
-            }
-        }
-
-        buffer[0] = '\0';
-
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_II to PHASE_III");
-        else {
-            response = buffer;
-            if (response == "maple_mission_finished") {
-                mission.phase_id = PHASE_III;
-                cout << target_ip << " entered phase III" << endl;
-            }
-        }
-
-        buffer[0] = '\0';
-
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_III to PHASE_IV");
-        else {
-            response = buffer;
-            if (response == "maple_mission_uploaded") {
-                mission.phase_id = PHASE_IV;
-                cout << target_ip << " entered phase IV" << endl;
-            }
-        }
-
-        maple_juice_done_count_lock.lock();
-        maple_juice_done_count++;
-        maple_juice_done_count_lock.unlock();
-
-        free_worker_lock.lock();
-        free_worker.push(target_ip);
-        free_worker_lock.unlock();
-
-    } catch (runtime_error &e) {
-        std::cerr << "error: " << e.what() << std::endl;
-        cout << "### Try to redistribute maple work..." << endl;
-
-        /// Wait for files to be redistribute
-        auto time_stamp = get_curr_timestamp_milliseconds();
-        while (true)
-            if (get_curr_timestamp_milliseconds() - time_stamp > 12000) break;
-
-        /// Wait for the availability of a new slave.
-        string new_worker;
-        while (true) {
-            free_worker_lock.lock();
-            if (free_worker.empty()) {
-                free_worker_lock.unlock();
-                continue;
-            }
-            new_worker = free_worker.front();
-            free_worker.pop();
-            free_worker_lock.unlock();
-            break;
-        }
-
-        /// Reset the mission and send it to the free new slave.
-        mission.phase_id = PHASE_I;
-        thread(&server::maple_task_monitor, this, ref(mission), new_worker, maple_exe, sdfs_prefix).detach();
-        cout << "### Maple work redistributed." << endl;
-    }
-
-    close(sock);
-}
-
 void server::maple_task_processor(int sock, string process_command) {
     /// Decode the received maple command.
     stringstream ss(process_command);
@@ -412,255 +1177,150 @@ void server::maple_task_processor(int sock, string process_command) {
     vector<string> files;
     string response;
     int mission_id = 0;
-    ss >> command >> maple_exe >> sdfs_prefix >> mission_id;
+    uint64_t job_id = 0;
+    double sample_fraction = 1;
+    ss >> command >> maple_exe >> sdfs_prefix >> mission_id >> job_id >> sample_fraction;
     while (ss >> curr_file && !curr_file.empty())
         files.push_back(curr_file);
+    RunningMission running(running_missions);
 
     response = "maple_mission_receive";
     const char *res = response.c_str();
     send(sock, res, strlen(res), 0);
     cout << "### Receive maple message success!" << endl;
 
-
-    /// Fetch the exe file and processing files.
-    string target_get_ip = check_file_exist(maple_exe);
-    get_query_sender(maple_exe, maple_exe, target_get_ip);
-    for (auto &f : files) {
-        target_get_ip = check_file_exist(f);
-        get_query_sender(f, f, target_get_ip);
+    /// Other missions of the job may run on this worker in the other task slots, so the files of this mission are
+    /// kept apart from theirs.
+    string mission_dir = create_mission_dir("maple", job_id, mission_id), local_dir = "files/fetched/" + mission_dir;
+    if (mission_dir.empty()) {
+        std::cerr << "error: Failure in create the directory of maple mission " << mission_id << std::endl;
+        close(sock);
+        return;
     }
-    cout << "### All required files obtained!" << endl;
-
-    /// Start running maple task.
 
-    /// Create temp files for processing maple intermediate output.
-    system("touch files/fetched/result");
-    if (TEN_LINES_READ)
-        system("touch files/fetched/maple_exe_input");
-    string line;
-    string sys_command = "chmod +x files/fetched/" + maple_exe;
-    system(sys_command.c_str());
-    string maple_sys_command =
-            "files/fetched/" + maple_exe + " < files/fetched/maple_exe_input >> files/fetched/result";
-
-    /// For all the files fetched, perform maple job.
-    for (auto &file : files) {
-        string file_to_read = "files/fetched/" + file;
-        if (TEN_LINES_READ) {
-            string input_temp_str;
-            ifstream infile(file_to_read);
-            int line_count = 0;
-            while (getline(infile, line)) {
-                line_count++;
-                input_temp_str += (line + "\n");
-                if (line_count == 10) {
-                    line_count = 0;
-                    ofstream ofs("files/fetched/maple_exe_input");
-                    ofs << input_temp_str;
-                    input_temp_str = "";
-                    ofs.close();
-                    system(maple_sys_command.c_str());
-                }
+    /// Fetch the exe file first, every split runs it.
+    string target_get_ip = check_file_exist(maple_exe);
+    get_query_sender(maple_exe, mission_dir + maple_exe, target_get_ip);
+    string exe_path = local_dir + maple_exe;
+    chmod(exe_path.c_str(), 0755);
+
+    /// The mission runs as a pipeline of four stages connected by bounded queues, so the network, the CPU and the
+    /// disk are busy at the same time: the fetcher prefetches the next split while the maple_exe runs on the current
+    /// one, the partitioner splits the output of the previous one, and the uploader ships the sealed partitions.
+    /// A hash partition takes lines from every split, so it is sealed once the last split is partitioned. Every
+    /// stage forwards an empty item at the end, and keeps draining its queue after a failure so none is blocked.
+    SpscQueue<string, MAPLE_PIPELINE_DEPTH> fetched_splits, sealed_partitions;
+    SpscQueue<int, MAPLE_PIPELINE_DEPTH> maple_outputs;
+    atomic<bool> failed(false);
+
+    thread fetcher([&]() {
+        for (auto &file : files) {
+            get_query_sender(file, mission_dir + file, check_file_exist(file));
+            fetched_splits.push(file);
+        }
+        fetched_splits.push("");
+        cout << "### All required files obtained!" << endl;
+    });
+
+    thread mapper([&]() {
+        uint64_t start_time = get_curr_timestamp_milliseconds(), num_bytes = 0;
+        for (string file = fetched_splits.pop(); !file.empty(); file = fetched_splits.pop()) {
+            if (failed) continue;
+            string file_to_read = local_dir + file;
+            struct stat file_stat{};
+            if (stat(file_to_read.c_str(), &file_stat) == 0) num_bytes += (uint64_t) file_stat.st_size;
+            int output_fd = memfd_create("maple_result", MFD_CLOEXEC);
+            bool mapped = false;
+            if (output_fd >= 0) {
+                /// The maple_exe runs in a task slot, so the maple_exes of all missions on this worker are bounded.
+                TaskSlot slot(task_slot_lock, task_slot_cv, free_task_slots);
+                mapped = run_maple_split(exe_path, file_to_read, sample_fraction, job_id ^ hash<string>()(file),
+                                         output_fd, task_limits);
             }
-            if (line_count != 0) {
-                ofstream ofs("files/fetched/maple_exe_input");
-                ofs << input_temp_str;
-                ofs.close();
-                system(maple_sys_command.c_str());
+            if (!mapped) {
+                /// A failed maple_exe closes the socket without the last acks, so the master redistributes the
+                /// mission.
+                std::cerr << "error: " << maple_exe << " failed on " << file << std::endl;
+                if (output_fd >= 0) close(output_fd);
+                failed = true;
+                continue;
             }
             cout << "Finish maple for " << file_to_read << endl;
-            infile.close();
-        } else {
-            maple_sys_command = "files/fetched/" + maple_exe + " < " + file_to_read + " >> files/fetched/result";
-            system(maple_sys_command.c_str());
-        }
-
-    }
-    if (TEN_LINES_READ)
-        system("rm files/fetched/maple_exe_input");
-    cout << "### Finished maple tasks!" << endl;
-
-
-    /// Extract maple result to local files
-    cout << "Begin extracting files" << endl;
-    ifstream infile("files/fetched/result");
-    map<int, ofstream> of_map;
-    while (getline(infile, line)) {
-        stringstream line_ss(line);
-        string key;
-        line_ss >> key;
-        int hashed_key = hash_string_to_int(key) % 9;
-        if (of_map.find(hashed_key) == of_map.end()) {
-            string out_file =
-                    "files/fetched/" + sdfs_prefix + "_" + to_string(hashed_key) + "_" + to_string(mission_id);
-            string temp_sys = "touch " + out_file;
-            system(temp_sys.c_str());
-            of_map[hashed_key].open(out_file);
-        }
-        of_map[hashed_key] << line << "\n";
-    }
-    for (auto &item : of_map) item.second.close();
-    infile.close();
-    cout << "Finish extracting files" << endl;
-    system("rm files/fetched/result");
-
-
-    response = "maple_mission_finished";
-    res = response.c_str();
-    send(sock, res, strlen(res), 0);
-
-
-    /// Upload maple output files to sdfs
-    cout << "Begin uploading files..." << endl;
-
-    for (auto &item : of_map) {
-        string out_file_name = sdfs_prefix + "_" + to_string(item.first) + "_" + to_string(mission_id);
-        string out_file_fetched = curr_dir + "/files/fetched/" + out_file_name;
-        cout << "### Uploading " << out_file_fetched << endl;
-        maple_juice_put(out_file_fetched, out_file_name);
-    }
-
-    response = "maple_mission_uploaded";
-    res = response.c_str();
-    send(sock, res, strlen(res), 0);
-    cout << "### Maple results uploaded!" << endl;
-    close(sock);
-
-    string sys_com = "rm files/fetched/" + sdfs_prefix + "_*";
-    system(sys_com.c_str());
-}
-
-
-void server::juice_task_monitor(JuiceMission &mission, string target_ip, string juice_exe, string sdfs_dest,
-                                int delete_input) {
-    int sock = 0;
-    char buffer[MAX_BUFFER_SIZE] = {0};
-    string response;
-    try {
-        /// Initialize socket connection.
-        struct sockaddr_in serv_addr{};
-        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-            throw runtime_error("Failure in create socket");
-
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(this->mj_port);
-
-        if (inet_pton(AF_INET, target_ip.c_str(), &serv_addr.sin_addr) <= 0)
-            throw runtime_error("Invalid address");
-
-        /// Try to connect to server, if fail then mark server as down.
-        if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-            throw runtime_error("Connection failed");
-
-        cout << "### begin send out juice request!" << endl;
-
-        string juice_request =
-                "juice_start " + juice_exe + " " + sdfs_dest + " " + to_string(mission.mission_id) + " " +
-                to_string(delete_input);
-        cout << juice_request << endl;
-        for (auto &f : mission.prefixes) {
-            juice_request.push_back(' ');
-            juice_request += f;
+            maple_outputs.push(output_fd);
         }
-
-
-        /// Send out juice commad.
-        cout << juice_request << endl;
-        const char *ls_file_c = juice_request.c_str();
-        if (send(sock, ls_file_c, strlen(ls_file_c), 0) == -1)
-            throw runtime_error("Sending maple mission failure");
-
-        cout << "### send out juice request success!" << endl;
-
-
-        /// PHASE_I to PHASE_II: receive juice command ack from slave.
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_I to PHASE_II");
-        else {
-            response = buffer;
-            if (response == "juice_mission_receive") {
-                mission.phase_id = PHASE_II;
-                cout << target_ip << " entered phase II" << endl;
+        maple_outputs.push(-1);
+        record_mission_throughput(num_bytes, get_curr_timestamp_milliseconds() - start_time);
+    });
+
+    thread partitioner([&]() {
+        map<int, ofstream> partitions;
+        PartitionProfile profile;
+        for (int output_fd = maple_outputs.pop(); output_fd >= 0; output_fd = maple_outputs.pop()) {
+            if (!failed && !partition_maple_output(output_fd, &server::hash_string_to_int, local_dir, sdfs_prefix,
+                                                   mission_id, partitions, profile)) {
+                std::cerr << "error: Failure in map the maple result" << std::endl;
+                failed = true;
             }
+            close(output_fd);
         }
-        buffer[0] = '\0';
-
-
-        /// PHASE_II to PHASE_III: receive juice mission finish report from slave.
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_II to PHASE_III");
-        else {
-            response = buffer;
-            if (response == "juice_mission_finished") {
-                mission.phase_id = PHASE_III;
-                cout << target_ip << " entered phase III" << endl;
-            }
+        if (!failed) {
+            response = "maple_mission_finished";
+            send(sock, response.c_str(), response.size(), 0);
+            cout << "### Finished maple tasks!" << endl;
         }
-        buffer[0] = '\0';
-
-        /// PHASE_III to PHASE_IV: receive juice results uploaded from slave.
-        if (read(sock, buffer, MAX_BUFFER_SIZE) == 0)
-            throw runtime_error("Wrong mission phase: PHASE_III to PHASE_IV");
-        else {
-            response = buffer;
-            if (response == "juice_result_uploaded") {
-                mission.phase_id = PHASE_IV;
-                cout << target_ip << " entered phase IV" << endl;
-            }
+        for (auto &item : partitions) {
+            item.second.close();
+            if (!failed)
+                sealed_partitions.push(sdfs_prefix + "_" + to_string(item.first) + "_" + to_string(mission_id));
         }
-
-        /// Add to job_done_count and psuh current slave to free worker.
-        maple_juice_done_count_lock.lock();
-        maple_juice_done_count++;
-        maple_juice_done_count_lock.unlock();
-
-        free_worker_lock.lock();
-        free_worker.push(target_ip);
-        free_worker_lock.unlock();
-
-    } catch (runtime_error &e) {
-        std::cerr << "error: " << e.what() << std::endl;
-        cout << "### Try to redistribute juice work..." << endl;
-        string new_worker;
-
-        /// Wait for files to be redistribute
-        auto time_stamp = get_curr_timestamp_milliseconds();
-        while (true)
-            if (get_curr_timestamp_milliseconds() - time_stamp > 12000) break;
-
-        /// Wait for the availability of a new slave.
-        while (true) {
-            free_worker_lock.lock();
-            if (free_worker.empty()) {
-                free_worker_lock.unlock();
-                continue;
-            }
-            new_worker = free_worker.front();
-            free_worker.pop();
-            free_worker_lock.unlock();
-            break;
+        /// The profile is committed with the partitions, so the master reports the skew of the committed outputs.
+        if (!failed) {
+            string profile_file = sdfs_prefix + PROFILE_INFIX + to_string(mission_id);
+            ofstream profile_ofs(local_dir + profile_file);
+            profile_ofs << profile.serialize();
+            profile_ofs.close();
+            sealed_partitions.push(profile_file);
         }
-
-        /// Reset the mission and send it to the free new slave.
-        mission.phase_id = PHASE_I;
-        thread(&server::juice_task_monitor, this, ref(mission), new_worker, juice_exe, sdfs_dest,
-               delete_input).detach();
-        cout << "### Juice work redistributed." << endl;
+        sealed_partitions.push("");
+    });
+
+    /// Upload maple output files to sdfs as they are sealed.
+    vector<string> out_file_names;
+    for (string out_file_name = sealed_partitions.pop(); !out_file_name.empty();
+         out_file_name = sealed_partitions.pop()) {
+        string out_file_fetched = curr_dir + "/" + local_dir + out_file_name;
+        cout << "### Uploading " << out_file_fetched << endl;
+        maple_juice_put(out_file_fetched, out_file_name);
+        out_file_names.push_back(out_file_name);
+    }
+    fetcher.join();
+    mapper.join();
+    partitioner.join();
+
+    if (!failed) {
+        commit_mission(sdfs_prefix + COMMIT_SUFFIX + to_string(mission_id), job_id, out_file_names);
+        response = "maple_mission_uploaded";
+        send(sock, response.c_str(), response.size(), 0);
+        cout << "### Maple results uploaded!" << endl;
     }
-
     close(sock);
+
+    remove_mission_dir(mission_dir);
 }
 
+
 void server::juice_task_processor(int sock, string process_command) {
     /// Decode the received juice command.
     stringstream ss(process_command);
     string juice_exe, command, sdfs_dest, curr_prefix;
     vector<string> prefixes;
     string response;
-    int mission_id = 0, delete_input = 0;
-    ss >> command >> juice_exe >> sdfs_dest >> mission_id >> delete_input;
+    int mission_id = 0, delete_input = 0, min_mission_id = 0;
+    uint64_t job_id = 0;
+    ss >> command >> juice_exe >> sdfs_dest >> mission_id >> delete_input >> min_mission_id >> job_id;
     while (ss >> curr_prefix && !curr_prefix.empty())
         prefixes.push_back(curr_prefix);
+    RunningMission running(running_missions);
 
     response = "juice_mission_receive";
     const char *res = response.c_str();
@@ -668,31 +1328,93 @@ void server::juice_task_processor(int sock, string process_command) {
     cout << "### Receive juice message success!" << endl;
     string resfile = sdfs_dest + "_" + to_string(mission_id);
 
-    /// Fetch the exe file and processing files.
-    string target_get_ip = check_file_exist(juice_exe);
-    get_query_sender(juice_exe, juice_exe, target_get_ip);
-    for (const auto &prefix : prefixes) {
-        vector<string> files = check_all_exist_file_by_prefix(prefix);
+    /// The ranges of a split partition are missions of the same job that may run on this worker at once, and fetch
+    /// the same files, so the files of this mission are kept apart from theirs.
+    string mission_dir = create_mission_dir("juice", job_id, mission_id), local_dir = "files/fetched/" + mission_dir;
+    if (mission_dir.empty()) {
+        std::cerr << "error: Failure in create the directory of juice mission " << mission_id << std::endl;
+        close(sock);
+        return;
+    }
+
+    /// Fetch the exe file and processing files, a built-in juice has no exe file.
+    string target_get_ip;
+    if (!is_builtin_juice(juice_exe))
+        get_query_sender(juice_exe, mission_dir + juice_exe, check_file_exist(juice_exe));
+    map<string, vector<string>> prefix_files;
+    for (const auto &input : prefixes) {
+        /// An input is a partition prefix, or a key range of a split partition whose records are filtered out of
+        /// the fetched files, so another range of the same partition can fetch them again.
+        string prefix = input.substr(0, input.find(JUICE_RANGE_SEPARATOR));
+        uint64_t range = 0, num_ranges = 0;
+        if (prefix != input) {
+            char slash;
+            stringstream range_ss(input.substr(prefix.size() + 1));
+            range_ss >> range >> slash >> num_ranges;
+        }
+        vector<string> files = check_all_exist_file_by_prefix(prefix + "_");
         for (const auto &file : files) {
+            /// Intermediate files are named prefix_key_missionid, skip the ones already merged.
+            if (atoi(file.substr(file.rfind('_') + 1).c_str()) < min_mission_id) continue;
             target_get_ip = check_file_exist(file);
-            get_query_sender(file, file, target_get_ip);
+            get_query_sender(file, mission_dir + file, target_get_ip);
+            if (num_ranges == 0) {
+                prefix_files[input].push_back(file);
+                continue;
+            }
+            string range_file = file + ".range_" + to_string(range);
+            filter_key_range(local_dir + file, local_dir + range_file, range, num_ranges);
+            remove((local_dir + file).c_str());
+            prefix_files[input].push_back(range_file);
         }
     }
     cout << "### All required files obtained!" << endl;
 
-    string sys_touch = "touch files/fetched/" + sdfs_dest + "_" + to_string(mission_id);
+    string sys_touch = "touch " + local_dir + resfile;
 
     /// Start running juice task.
     system(sys_touch.c_str());
-    string line;
-    string sys_command = "chmod +x files/fetched/" + juice_exe;
-    system(sys_command.c_str());
+    string line, sys_command;
+    if (!is_builtin_juice(juice_exe)) {
+        sys_command = "chmod +x " + local_dir + juice_exe;
+        system(sys_command.c_str());
+    }
 
-    for (auto &prefix : prefixes) {
-        sys_command = "cat files/fetched/" + prefix + "*|./files/fetched/" + juice_exe + " >> files/fetched/" + resfile;
+    /// The juice runs in a task slot, so the juices of all missions on this worker are bounded.
+    TaskSlot slot(task_slot_lock, task_slot_cv, free_task_slots);
+    uint64_t start_time = get_curr_timestamp_milliseconds(), num_bytes = 0;
+    for (auto &item : prefix_files) {
+        string input_files;
+        vector<string> input_paths;
+        for (const auto &file : item.second) {
+            input_files += " " + local_dir + file;
+            input_paths.push_back(local_dir + file);
+            struct stat file_stat{};
+            if (stat((local_dir + file).c_str(), &file_stat) == 0) num_bytes += (uint64_t) file_stat.st_size;
+        }
+        bool success;
+        if (is_builtin_juice(juice_exe)) {
+            /// A built-in juice aggregates columnar batches decoded from the inputs, with no exe and no pipe.
+            ofstream result_ofs(local_dir + resfile, ios::app);
+            success = run_builtin_juice(juice_exe, input_paths, result_ofs);
+            result_ofs.close();
+        } else {
+            int output_fd = open((local_dir + resfile).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            success = output_fd >= 0 && run_udf_over_files(local_dir + juice_exe, input_paths, output_fd, task_limits);
+            if (output_fd >= 0) close(output_fd);
+        }
+        if (!success) {
+            /// Close the socket without the last acks, so the master redistributes the mission.
+            std::cerr << "error: " << juice_exe << " failed on " << item.first << std::endl;
+            close(sock);
+            remove_mission_dir(mission_dir);
+            return;
+        }
+        sys_command = "rm" + input_files;
         system(sys_command.c_str());
-        cout << "Finish juice for " << prefix << endl;
+        cout << "Finish juice for " << item.first << endl;
     }
+    record_mission_throughput(num_bytes, get_curr_timestamp_milliseconds() - start_time);
     cout << "### Finished juice tasks!" << endl;
 
 
@@ -702,11 +1424,15 @@ void server::juice_task_processor(int sock, string process_command) {
 
 
     /// Upload juice output files to sdfs.
-    maple_juice_put(curr_dir + "/files/fetched/" + resfile, resfile);
+    maple_juice_put(curr_dir + "/" + local_dir + resfile, resfile);
+    commit_mission(sdfs_dest + COMMIT_SUFFIX + to_string(mission_id), job_id, {resfile});
 
+    /// Inputs are only deleted after the commit, so a retry never finds its inputs gone. The master deletes the
+    /// split partitions once all their ranges are committed.
     if (delete_input == 1)
         for (auto prefix : prefixes)
-            delete_all_file_by_prefix(prefix);
+            if (prefix.find(JUICE_RANGE_SEPARATOR) == string::npos)
+                delete_all_file_by_prefix(prefix + "_");
 
 
     response = "juice_result_uploaded";
@@ -714,4 +1440,359 @@ void server::juice_task_processor(int sock, string process_command) {
     send(sock, res, strlen(res), 0);
     cout << "### juice results uploaded!" << endl;
     close(sock);
-}
\ No newline at end of file
+    remove_mission_dir(mission_dir);
+}
+
+string server::sdfs_read_text(const string &sdfs_filename) {
+    string target_get_ip = check_file_exist(sdfs_filename);
+    if (target_get_ip == "-1") return "";
+    get_query_sender(sdfs_filename, sdfs_filename, target_get_ip);
+    string local_filename = curr_dir + "/files/fetched/" + sdfs_filename;
+    ifstream infile(local_filename);
+    stringstream content;
+    content << infile.rdbuf();
+    infile.close();
+    remove(local_filename.c_str());
+    return content.str();
+}
+
+void server::sdfs_write_text(const string &sdfs_filename, const string &content) {
+    string local_filename = curr_dir + "/files/fetched/" + sdfs_filename;
+    ofstream outfile(local_filename);
+    outfile << content;
+    outfile.close();
+    maple_juice_put(local_filename, sdfs_filename);
+    remove(local_filename.c_str());
+}
+
+IncrementalManifest server::load_manifest(const string &sdfs_prefix) {
+    IncrementalManifest manifest;
+    stringstream ss(sdfs_read_text(sdfs_prefix + MANIFEST_SUFFIX));
+    string line, type, name;
+    /// Each line is one of "next <mission_id>", "mapped <file>" or "juiced <sdfs_dest> <mission_id>".
+    while (getline(ss, line)) {
+        stringstream line_ss(line);
+        line_ss >> type;
+        if (type == "next") line_ss >> manifest.next_mission_id;
+        else if (type == "mapped" && line_ss >> name) manifest.mapped_files.insert(name);
+        else if (type == "juiced" && line_ss >> name) line_ss >> manifest.juiced_until[name];
+    }
+    return manifest;
+}
+
+void server::store_manifest(const string &sdfs_prefix, const IncrementalManifest &manifest) {
+    string content = "next " + to_string(manifest.next_mission_id) + "\n";
+    for (const auto &file : manifest.mapped_files) content += "mapped " + file + "\n";
+    for (const auto &item : manifest.juiced_until)
+        content += "juiced " + item.first + " " + to_string(item.second) + "\n";
+    sdfs_write_text(sdfs_prefix + MANIFEST_SUFFIX, content);
+}
+
+string server::write_skew_report(const string &sdfs_prefix, uint64_t job_id, int first_mission_id,
+                                 int num_missions) {
+    PartitionProfile total;
+    int num_profiles = 0;
+    for (int mission_id = first_mission_id; mission_id < first_mission_id + num_missions; mission_id++) {
+        PartitionProfile profile;
+        if (!profile.deserialize(sdfs_read_text(sdfs_prefix + PROFILE_INFIX + to_string(mission_id)))) continue;
+        total.merge(profile);
+        num_profiles++;
+    }
+    if (num_profiles == 0) return "";
+
+    uint64_t total_records = 0, total_bytes = 0;
+    for (int i = 0; i < NUM_PARTITIONS; i++) {
+        total_records += total.records[i];
+        total_bytes += total.bytes[i];
+    }
+    double mean_records = (double) total_records / NUM_PARTITIONS, mean_bytes = (double) total_bytes / NUM_PARTITIONS;
+    ostringstream report;
+    report << fixed << setprecision(2);
+    report << "job " << job_id << " missions " << num_profiles << " records " << total_records << " bytes "
+           << total_bytes << "\n";
+    int heaviest = 0, num_imbalanced = 0;
+    for (int i = 0; i < NUM_PARTITIONS; i++) {
+        bool imbalanced = mean_bytes > 0 && (double) total.bytes[i] > SKEW_IMBALANCE_RATIO * mean_bytes;
+        report << "partition " << i << " records " << total.records[i] << " bytes " << total.bytes[i] << " share "
+               << (total_bytes > 0 ? 100.0 * (double) total.bytes[i] / (double) total_bytes : 0) << "%"
+               << (imbalanced ? " imbalanced" : "") << "\n";
+        if (total.bytes[i] > total.bytes[heaviest]) heaviest = i;
+        if (imbalanced) num_imbalanced++;
+    }
+    double imbalance = mean_bytes > 0 ? (double) total.bytes[heaviest] / mean_bytes : 1;
+    report << "imbalance " << imbalance << "\n";
+
+    /// The counters are upper bounds, and a key counted by several missions is added up across them.
+    vector<pair<uint64_t, string>> heavy_keys;
+    for (const auto &item : total.heavy_keys) heavy_keys.emplace_back(item.second, item.first);
+    sort(heavy_keys.rbegin(), heavy_keys.rend());
+    if (heavy_keys.size() > PROFILE_HEAVY_KEYS) heavy_keys.resize(PROFILE_HEAVY_KEYS);
+    string hottest_key;
+    for (const auto &item : heavy_keys) {
+        bool hot = (double) item.first > SKEW_HOT_KEY_FRACTION * mean_records;
+        report << "key " << item.second << " records " << item.first << " partition "
+               << hash_string_to_int(item.second) % NUM_PARTITIONS << (hot ? " hot" : "") << "\n";
+        if (hot && hottest_key.empty()) hottest_key = item.second;
+    }
+    sdfs_write_text(sdfs_prefix + SKEW_REPORT_SUFFIX, report.str());
+
+    ostringstream summary;
+    summary << fixed << setprecision(2) << ", heaviest partition " << heaviest << " at " << imbalance
+            << "x the mean";
+    if (num_imbalanced > 0 || !hottest_key.empty()) {
+        summary << ", skewed:";
+        if (num_imbalanced > 0) summary << " " << num_imbalanced << " imbalanced partitions";
+        if (!hottest_key.empty()) summary << " hot key " << hottest_key;
+        summary << ", see " << sdfs_prefix << SKEW_REPORT_SUFFIX;
+    }
+    cout << "### Skew report of " << sdfs_prefix << ":\n" << report.str();
+    return summary.str();
+}
+
+void server::commit_mission(const string &commit_filename, uint64_t job_id, const vector<string> &output_files) {
+    /// The first line is the job id, so records left by an earlier job with the same names are never trusted.
+    string content = to_string(job_id) + "\n";
+    for (const auto &file : output_files) content += file + "\n";
+    sdfs_write_text(commit_filename, content);
+}
+
+bool server::check_mission_committed(const string &commit_filename, uint64_t job_id) {
+    stringstream ss(sdfs_read_text(commit_filename));
+    string committed_job_id, file;
+    if (!(ss >> committed_job_id) || committed_job_id != to_string(job_id)) return false;
+    /// Outputs lost together with all of their replicas have to be redone.
+    while (ss >> file)
+        if (check_file_exist(file) == "-1") return false;
+    return true;
+}
+
+string server::acquire_free_worker(uint64_t job_id) {
+    unique_lock<mutex> lock(free_worker_lock);
+    while (true) {
+        free_worker_cv.wait_for(lock, chrono::milliseconds(MISSION_POLL_MILLISECONDS),
+                                [this] { return !free_worker.empty(); });
+        if (free_worker.empty()) {
+            /// Parked workers come back when their cooling-off period ends.
+            for (auto it = parked_workers.begin(); it != parked_workers.end();) {
+                if (is_blacklisted_worker(*it, job_id)) {
+                    it++;
+                } else {
+                    free_worker.push(*it);
+                    it = parked_workers.erase(it);
+                }
+            }
+            /// Without a running mission, no worker will be released any more.
+            if (free_worker.empty() && leased_workers <= 0) return "";
+            continue;
+        }
+        string new_worker = free_worker.front();
+        free_worker.pop();
+        if (is_failed_worker(new_worker)) continue;
+        if (is_blacklisted_worker(new_worker, job_id)) {
+            parked_workers.insert(new_worker);
+            continue;
+        }
+        leased_workers++;
+        return new_worker;
+    }
+}
+
+void server::release_free_worker(const string &worker_ip) {
+    worker_health_lock.lock();
+    worker_health[worker_ip].consecutive_failures = 0;
+    worker_health_lock.unlock();
+
+    free_worker_lock.lock();
+    leased_workers--;
+    free_worker.push(worker_ip);
+    free_worker_lock.unlock();
+    free_worker_cv.notify_one();
+}
+
+void server::release_idle_workers(const set<string> &busy_workers) {
+    membership_list_lock.lock();
+    map<string, Member> curr_membership_list = membership_list;
+    membership_list_lock.unlock();
+    free_worker_lock.lock();
+    for (const auto &item : curr_membership_list)
+        if (item.first != my_ip_address && busy_workers.find(item.first) == busy_workers.end() &&
+            !is_failed_worker(item.first))
+            for (int i = 0; i < reported_task_slots(item.second); i++) free_worker.push(item.first);
+    free_worker_lock.unlock();
+    free_worker_cv.notify_all();
+}
+
+void server::release_spare_slots(const vector<string> &workers) {
+    membership_list_lock.lock();
+    map<string, Member> curr_membership_list = membership_list;
+    membership_list_lock.unlock();
+    free_worker_lock.lock();
+    for (const auto &worker : workers) {
+        auto it = curr_membership_list.find(worker);
+        if (worker.empty() || it == curr_membership_list.end()) continue;
+        for (int i = 1; i < reported_task_slots(it->second); i++) free_worker.push(worker);
+    }
+    free_worker_lock.unlock();
+    free_worker_cv.notify_all();
+}
+
+void server::reset_free_workers(int num_leased) {
+    free_worker_lock.lock();
+    while (!free_worker.empty()) free_worker.pop();
+    parked_workers.clear();
+    leased_workers = num_leased;
+    free_worker_lock.unlock();
+}
+
+void server::record_worker_failure(const string &worker_ip, uint64_t job_id) {
+    free_worker_lock.lock();
+    leased_workers--;
+    free_worker_lock.unlock();
+    free_worker_cv.notify_all();
+
+    lock_guard<mutex> lock(worker_health_lock);
+    WorkerHealth &health = worker_health[worker_ip];
+    if (health.job_id != job_id) {
+        health.job_id = job_id;
+        health.job_failures = 0;
+    }
+    health.job_failures++;
+    health.consecutive_failures++;
+    if (health.job_failures == WORKER_JOB_BLACKLIST_FAILURES)
+        cout << "### Worker " << worker_ip << " blacklisted for job " << job_id << endl;
+    if (health.consecutive_failures >= WORKER_BLACKLIST_FAILURES) {
+        health.blacklisted_until = get_curr_timestamp_milliseconds() + WORKER_BLACKLIST_COOLDOWN_MILLISECONDS;
+        health.consecutive_failures = 0;
+        cout << "### Worker " << worker_ip << " blacklisted for " << WORKER_BLACKLIST_COOLDOWN_MILLISECONDS / 1000
+             << " s" << endl;
+    }
+}
+
+bool server::is_blacklisted_worker(const string &worker_ip, uint64_t job_id) {
+    lock_guard<mutex> lock(worker_health_lock);
+    auto it = worker_health.find(worker_ip);
+    if (it == worker_health.end()) return false;
+    const WorkerHealth &health = it->second;
+    return get_curr_timestamp_milliseconds() < health.blacklisted_until ||
+           (health.job_id == job_id && health.job_failures >= WORKER_JOB_BLACKLIST_FAILURES);
+}
+
+bool server::backoff_mission_retry(int &attempts, const string &kind, int mission_id, uint64_t &retry_at) {
+    attempts++;
+    if (attempts >= MISSION_MAX_ATTEMPTS) {
+        abort_mission(kind, mission_id);
+        return false;
+    }
+    int backoff = min(MISSION_RETRY_BACKOFF_MILLISECONDS << (attempts - 1), MISSION_RETRY_BACKOFF_MAX_MILLISECONDS);
+    cout << "### Retry " << kind << " mission " << mission_id << " in " << backoff << " ms" << endl;
+    retry_at = get_curr_timestamp_milliseconds() + backoff;
+    return true;
+}
+
+void server::abort_mission(const string &kind, int mission_id) {
+    cout << "### Give up " << kind << " mission " << mission_id << endl;
+    maple_juice_done_count_lock.lock();
+    maple_juice_aborted = true;
+    maple_juice_done_count++;
+    maple_juice_done_count_lock.unlock();
+}
+
+void server::wait_missions_done(int num_missions) {
+    while (true) {
+        maple_juice_done_count_lock.lock();
+        if (maple_juice_done_count == num_missions) {
+            bool aborted = maple_juice_aborted;
+            maple_juice_done_count_lock.unlock();
+            if (aborted)
+                throw runtime_error("A mission failed " + to_string(MISSION_MAX_ATTEMPTS) +
+                                    " times or no worker is left, job aborted!");
+            return;
+        }
+        maple_juice_done_count_lock.unlock();
+    }
+}
+
+void server::notify_member_failure(const string &ip) {
+    failed_workers_lock.lock();
+    failed_workers.insert(ip);
+    failed_workers_lock.unlock();
+}
+
+void server::notify_member_recovery(const string &ip) {
+    failed_workers_lock.lock();
+    failed_workers.erase(ip);
+    failed_workers_lock.unlock();
+}
+
+bool server::is_failed_worker(const string &ip) {
+    failed_workers_lock.lock();
+    bool failed = failed_workers.find(ip) != failed_workers.end();
+    failed_workers_lock.unlock();
+    return failed;
+}
+
+int server::connect_mission_worker(const string &target_ip) {
+    /// Initialize socket connection.
+    int sock = 0;
+    struct sockaddr_in serv_addr{};
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        throw runtime_error("Failure in create socket");
+
+    /// On linux the send timeout also bounds connect.
+    struct timeval connect_timeout{MISSION_CONNECT_TIMEOUT_MILLISECONDS / 1000,
+                                   (MISSION_CONNECT_TIMEOUT_MILLISECONDS % 1000) * 1000};
+    struct timeval poll_timeout{0, MISSION_POLL_MILLISECONDS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &connect_timeout, sizeof(connect_timeout));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &poll_timeout, sizeof(poll_timeout));
+
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(this->mj_port);
+
+    if (inet_pton(AF_INET, target_ip.c_str(), &serv_addr.sin_addr) <= 0) {
+        close(sock);
+        throw runtime_error("Invalid address");
+    }
+
+    /// Try to connect to server, if fail then mark server as down.
+    if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        close(sock);
+        throw runtime_error("Connection failed");
+    }
+    return sock;
+}
+
+void server::read_mission_socket(int sock, const string &target_ip, const string &waiting_for, uint64_t deadline,
+                                 string &pending) {
+    char buffer[MAX_BUFFER_SIZE];
+    if (is_failed_worker(target_ip))
+        throw runtime_error("Failure detected on " + target_ip + " before " + waiting_for);
+    if (get_curr_timestamp_milliseconds() > deadline)
+        throw runtime_error("Deadline exceeded on " + target_ip + " before " + waiting_for);
+    ssize_t num_bytes = read(sock, buffer, MAX_BUFFER_SIZE);
+    if (num_bytes == 0)
+        throw runtime_error("Connection closed by " + target_ip + " before " + waiting_for);
+    if (num_bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        throw runtime_error("Connection error with " + target_ip + " before " + waiting_for);
+    }
+    pending.append(buffer, num_bytes);
+}
+
+void server::wait_mission_ack(int sock, const string &target_ip, const string &expected_ack, string &pending) {
+    auto deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+    while (pending.compare(0, expected_ack.size(), expected_ack) != 0) {
+        if (pending.size() >= expected_ack.size())
+            throw runtime_error("Unexpected ack from " + target_ip + ": " + pending);
+        read_mission_socket(sock, target_ip, expected_ack, deadline, pending);
+    }
+    pending.erase(0, expected_ack.size());
+}
+
+string server::read_mission_line(int sock, const string &target_ip, string &pending) {
+    auto deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+    while (pending.find('\n') == string::npos)
+        read_mission_socket(sock, target_ip, "a line", deadline, pending);
+    string line = pending.substr(0, pending.find('\n'));
+    pending.erase(0, line.size() + 1);
+    return line;
+}
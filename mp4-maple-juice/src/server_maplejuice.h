@@ -7,6 +7,125 @@
 #define SERVER_MAPLEJUICE_H
 
 #include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+/// The number of partitions maple output is hashed into.
+#define NUM_PARTITIONS 9
+
+/// Suffix of the sdfs file recording incremental maple juice progress of an intermediate prefix.
+#define MANIFEST_SUFFIX ".manifest"
+
+/// Infix of the sdfs files recording the committed outputs of each mission, followed by the mission id.
+#define COMMIT_SUFFIX ".commit_"
+
+/// Suffix of the sdfs file recording the sample fraction of an intermediate prefix: "<job_id> <fraction>".
+#define SAMPLE_SUFFIX ".sample"
+
+/// Suffix of the sdfs file holding the confidence intervals of an approximate juice output.
+#define SAMPLE_ERROR_SUFFIX ".error"
+
+/// The lowest sample fraction a time budget can choose.
+#define SAMPLE_MIN_FRACTION 0.001
+
+/// The z value of the confidence intervals of approximate juice outputs, 1.96 for 95%.
+#define SAMPLE_CONFIDENCE_Z 1.96
+
+/// Maple throughput of one worker in bytes per second, assumed until the master has timed a maple job.
+#define MAPLE_DEFAULT_BYTES_PER_SECOND (4 << 20)
+
+/// Infix of the sdfs file profiling the maple output of each mission, followed by the mission id.
+#define PROFILE_INFIX ".profile_"
+
+/// Suffix of the sdfs file holding the skew report of the last maple job of an intermediate prefix.
+#define SKEW_REPORT_SUFFIX ".skew"
+
+/// The number of heaviest keys each maple mission keeps a counter for.
+#define PROFILE_HEAVY_KEYS 16
+
+/// A partition is flagged when its bytes exceed this number times the mean bytes of a partition.
+#define SKEW_IMBALANCE_RATIO 2.0
+
+/// A key is flagged hot when its records exceed this fraction of the mean records of a partition, since adding
+/// partitions cannot split it.
+#define SKEW_HOT_KEY_FRACTION 0.5
+
+/// A juice task is planned for at least this number of bytes of intermediate files, so a small job runs on fewer
+/// workers instead of paying the task overhead for tiny partitions.
+#define JUICE_MIN_TASK_BYTES (1 << 20)
+
+/// A partition above this number times the planned bytes of a juice task is split into key ranges.
+#define JUICE_SPLIT_RATIO 1.5
+
+/// Separator of a key range in a juice input, "<sdfs_prefix>_<partition>#<range>/<num_ranges>".
+#define JUICE_RANGE_SEPARATOR '#'
+
+/// The number of items each stage of the maple worker pipeline can run ahead of the next stage.
+#define MAPLE_PIPELINE_DEPTH 2
+
+/// How long a stage of the maple worker pipeline sleeps while its queue is empty or full.
+#define MAPLE_PIPELINE_WAIT_MICROSECONDS 200
+
+/// The UDFs a worker runs at the same time, each in a task slot. A worker reports its slots in its heartbeats, and can
+/// override the default with the MJ_TASK_SLOTS environment variable.
+#define MJ_DEFAULT_TASK_SLOTS 2
+
+/// The heap of a UDF process in MB, overridden by MJ_TASK_MEMORY_MB, 0 for no limit. A UDF allocating more fails.
+#define MJ_DEFAULT_TASK_MEMORY_MB 1024
+
+/// The CPU time of a UDF process in seconds, overridden by MJ_TASK_CPU_SECONDS, 0 for no limit. A UDF running longer
+/// is killed.
+#define MJ_DEFAULT_TASK_CPU_SECONDS 600
+
+/// The niceness of UDF processes, so the heartbeats and sdfs transfers of a loaded worker keep their share of the CPU.
+#define MJ_TASK_NICE 10
+
+/// The sdfs file journaling the queued and running maple juice jobs of the master.
+#define MJ_JOURNAL_FILE "maplejuice.journal"
+
+/// The records appended after the journal file was written go to the segments "maplejuice.journal_segment_<n>.log".
+#define MJ_JOURNAL_SEGMENT_PREFIX "maplejuice.journal_segment_"
+#define MJ_JOURNAL_SEGMENT_SUFFIX ".log"
+
+/// The segments folded into the journal file by the journal writer at once.
+#define MJ_JOURNAL_COMPACT_SEGMENTS 32
+
+/// A user can have at most this number of jobs waiting in the queue.
+#define MJ_MAX_QUEUED_JOBS_PER_USER 4
+
+/// Admission control: low priority jobs are only queued while the queue is shorter than this number times the
+/// capacity of the cluster, normal priority jobs while it is shorter than twice that, high priority jobs always.
+#define MJ_QUEUED_JOBS_PER_WORKER 2
+
+/// How often a node checks whether it should take over as maple juice master.
+#define MASTER_CHECK_MILLISECONDS 2000
+
+/// The time slice a mission monitor blocks on its socket before checking the failure detector again.
+#define MISSION_POLL_MILLISECONDS 200
+
+/// The deadline of connecting to a worker, and of every phase ack of a mission.
+#define MISSION_CONNECT_TIMEOUT_MILLISECONDS 3000
+#define MISSION_ACK_TIMEOUT_MILLISECONDS 600000
+
+/// A mission fails its job after this number of attempts.
+#define MISSION_MAX_ATTEMPTS 4
+
+/// The wait before the n-th retry of a mission is the base doubled n - 1 times, up to the max.
+#define MISSION_RETRY_BACKOFF_MILLISECONDS 500
+#define MISSION_RETRY_BACKOFF_MAX_MILLISECONDS 16000
+
+/// A worker failing this number of missions of a job takes no more missions of that job.
+#define WORKER_JOB_BLACKLIST_FAILURES 2
+
+/// A worker failing this number of missions in a row, across jobs, takes no mission for the cooling-off period.
+#define WORKER_BLACKLIST_FAILURES 4
+#define WORKER_BLACKLIST_COOLDOWN_MILLISECONDS 600000
 
 /// Enumerator for worker phase stage.
 enum Stage {
@@ -19,6 +138,8 @@ public:
     int mission_id;
     Stage phase_id;
     vector<string> files;
+    /// The failed attempts of the mission so far.
+    int attempts;
 };
 
 /// Struct for Juice Mission.
@@ -27,7 +148,212 @@ public:
     int mission_id;
     Stage phase_id;
     vector<string> prefixes;
+    int attempts;
+};
+
+/// The limits a worker puts on each UDF process it runs.
+class TaskLimits {
+public:
+    uint64_t memory_mb = MJ_DEFAULT_TASK_MEMORY_MB;
+    uint64_t cpu_seconds = MJ_DEFAULT_TASK_CPU_SECONDS;
+};
+
+/// Holds a task slot of this worker while in scope, waiting for a free one first.
+class TaskSlot {
+public:
+    TaskSlot(std::mutex &lock, std::condition_variable &cv, int &free_slots) : lock(lock), cv(cv),
+                                                                              free_slots(free_slots) {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&] { return free_slots > 0; });
+        free_slots--;
+    }
+
+    ~TaskSlot() {
+        lock.lock();
+        free_slots++;
+        lock.unlock();
+        cv.notify_one();
+    }
+
+private:
+    std::mutex &lock;
+    std::condition_variable &cv;
+    int &free_slots;
+};
+
+/// Counts a mission as running on this worker while in scope.
+class RunningMission {
+public:
+    explicit RunningMission(std::atomic<int> &counter) : counter(counter) { counter++; }
+
+    ~RunningMission() { counter--; }
+
+private:
+    std::atomic<int> &counter;
+};
+
+/**
+ * Bounded lock-free queue connecting two stages of the maple worker pipeline, with exactly one thread pushing and
+ * one thread popping. A full queue blocks the producer and an empty one the consumer, so a slow stage holds back the
+ * stages before it instead of buffering the whole mission.
+ */
+template<typename T, size_t Capacity>
+class SpscQueue {
+public:
+    void push(T item) {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        while (tail - head_index.load(std::memory_order_acquire) == Capacity) wait();
+        slots[tail % Capacity] = std::move(item);
+        tail_index.store(tail + 1, std::memory_order_release);
+    }
+
+    T pop() {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        while (tail_index.load(std::memory_order_acquire) == head) wait();
+        T item = std::move(slots[head % Capacity]);
+        head_index.store(head + 1, std::memory_order_release);
+        return item;
+    }
+
+private:
+    static void wait() {
+        std::this_thread::sleep_for(std::chrono::microseconds(MAPLE_PIPELINE_WAIT_MICROSECONDS));
+    }
+
+    T slots[Capacity];
+    std::atomic<size_t> head_index{0}, tail_index{0};
+};
+
+/// Failure accounting of a worker, kept by the master across jobs.
+class WorkerHealth {
+public:
+    /// The job whose failures are counted in job_failures.
+    uint64_t job_id = 0;
+    int job_failures = 0;
+    /// The failures since the last mission the worker finished.
+    int consecutive_failures = 0;
+    /// The worker takes no mission before this time.
+    uint64_t blacklisted_until = 0;
+};
+
+/// Struct for a mission running a built-in operator on the worker instead of a user executable.
+class NativeMission {
+public:
+    int mission_id;
+    Stage phase_id;
+    /// The request sent to the worker: "<kind>_start <mission_id> <job_id> <commit_filename> <operator args>".
+    string request;
+    /// The sdfs file the worker commits its outputs to.
+    string commit_filename;
+    int attempts;
+};
+
+/// Priority classes of maple juice jobs, a job waiting in a higher class preempts a running job at its next task
+/// boundary.
+enum JobPriority {
+    PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_HIGH
+};
+
+/**
+ * Parse the name of a priority class.
+ *
+ * Returns:
+ *      Return -1 if the name is not a priority class.
+ */
+inline int parse_job_priority(const string &name) {
+    if (name == "low") return PRIORITY_LOW;
+    if (name == "normal") return PRIORITY_NORMAL;
+    if (name == "high") return PRIORITY_HIGH;
+    return -1;
+}
+
+inline string job_priority_name(int priority) {
+    return priority == PRIORITY_HIGH ? "high" : priority == PRIORITY_LOW ? "low" : "normal";
+}
+
+/// Struct for a maple or juice job submitted by client.
+class MapleJuiceJob {
+public:
+    uint64_t job_id;
+    string command;
+    string user = "anonymous";
+    int priority = PRIORITY_NORMAL;
+    /// The client socket waiting for the job result, -1 for a job replayed from the journal.
+    int sock;
+    /// The job is not started before this timestamp in milliseconds, set for the next micro batch of a stream job.
+    uint64_t start_after = 0;
+    /// Mission id to its files (maple) or prefixes (juice), only for a job replayed from the journal.
+    map<int, vector<string>> recorded_missions;
 };
 
+/// Struct for the incremental progress of one sdfs intermediate filename prefix.
+class IncrementalManifest {
+public:
+    /// The first mission id not used by any previous maple run.
+    int next_mission_id = 0;
+    /// The sdfs source files already mapped into this prefix.
+    set<string> mapped_files;
+    /// For each sdfs_dest, the first mission id whose output is not merged into it yet.
+    map<string, int> juiced_until;
+};
+
+/**
+ * Records and bytes of the maple output per partition, and the heavy keys found by the space-saving algorithm: a new
+ * key takes over the counter of the lightest key once all counters are used, so a counter is an upper bound of the
+ * records of its key, and every key above 1 / PROFILE_HEAVY_KEYS of the records has a counter.
+ */
+class PartitionProfile {
+public:
+    PartitionProfile() : records(NUM_PARTITIONS, 0), bytes(NUM_PARTITIONS, 0) {}
+
+    void add(int partition, const string &key, uint64_t num_bytes);
+
+    /// The heavy keys of both profiles are kept, with the counters of a key added up.
+    void merge(const PartitionProfile &other);
+
+    /// Lines "partition <p> <records> <bytes>" and "key <records> <key>".
+    string serialize() const;
+
+    /**
+     * Returns:
+     *      Return false if the text is not a serialized profile.
+     */
+    bool deserialize(const string &text);
+
+    vector<uint64_t> records, bytes;
+    map<string, uint64_t> heavy_keys;
+};
+
+/**
+ * The key range of a record in a split partition, independent of the partition hash so that the keys of one
+ * partition spread over all its ranges: FNV-1a followed by the murmur3 finalizer.
+ */
+inline uint64_t juice_range_hash(const char *key, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) h = (h ^ (unsigned char) key[i]) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Send the result of a job back to client, jobs replayed from the journal have no client to answer.
+ */
+void reply_to_client(int sock, const string &response);
+
+/**
+ * Create a private directory under files/fetched for the local files of one mission, so the missions of a job
+ * sharing a worker never touch each other's files.
+ *
+ * Returns:
+ *      Return the directory relative to files/fetched with a trailing '/', or an empty string on failure.
+ */
+string create_mission_dir(const string &kind, uint64_t job_id, int mission_id);
+
+/**
+ * Delete the directory of a mission with all its local files.
+ */
+void remove_mission_dir(const string &mission_dir);
 
 #endif //SERVER_MAPLEJUICE_H
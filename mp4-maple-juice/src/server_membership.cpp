@@ -5,6 +5,7 @@
 
 #include "server_func.h"
 #include "server_sdfs.h"
+#include <sys/statvfs.h>
 
 vector<Member> server::get_membership_list_as_vector() {
     vector<Member> message;
@@ -19,6 +20,12 @@ vector<Member> server::encode_membership_list(vector<Member> message) {
     for (int i = 0; (size_t) i < message.size(); i++) {
         message[i].time_stamp = htonl(message[i].time_stamp);
         message[i].updated_time = htonl(message[i].updated_time);
+        message[i].cpu_load = htons(message[i].cpu_load);
+        message[i].running_missions = htons(message[i].running_missions);
+        message[i].free_disk_mb = htonl(message[i].free_disk_mb);
+        message[i].throughput_kbps = htonl(message[i].throughput_kbps);
+        message[i].load_reported = htons(message[i].load_reported);
+        message[i].task_slots = htons(message[i].task_slots);
     }
     return message;
 }
@@ -61,6 +68,12 @@ vector<Member> server::decode_membership_list(char *raw_data, int num_bytes) {
         auto *member = (Member *) it;
         member->time_stamp = ntohl(member->time_stamp);
         member->updated_time = ntohl(member->updated_time);
+        member->cpu_load = ntohs(member->cpu_load);
+        member->running_missions = ntohs(member->running_missions);
+        member->free_disk_mb = ntohl(member->free_disk_mb);
+        member->throughput_kbps = ntohl(member->throughput_kbps);
+        member->load_reported = ntohs(member->load_reported);
+        member->task_slots = ntohs(member->task_slots);
         received_list.push_back(*member);
         it += sizeof(Member);
         num_bytes -= sizeof(Member);
@@ -85,6 +98,7 @@ void server::update_membership(vector<Member> received_list) {
         membership_list[m.ip_address] = m;
         membership_list[m.ip_address].updated_time = get_curr_timestamp_milliseconds();
         write_log_file(string(m.ip_address) + " added to my membership list", 1);
+        notify_member_recovery(m.ip_address);
         if (m.updated_time == ANNOUNCE) {
             this_thread::sleep_for(chrono::nanoseconds(2000));
             handle_sdfs_join_rearrange();
@@ -107,6 +121,7 @@ void server::update_membership(vector<Member> received_list) {
         cout << "### Received 'failure' from " << m.ip_address << endl;
         write_log_file("Received 'failure' from " + string(m.ip_address), 0);
         membership_list.erase(m.ip_address);
+        notify_member_failure(m.ip_address);
         handle_sdfs_leave_rearrange();
         write_membership_list_to_log_file();
         to_send = true;
@@ -114,6 +129,7 @@ void server::update_membership(vector<Member> received_list) {
         cout << "### Received 'leave' from " << m.ip_address << endl;
         write_log_file("Received 'leave' from " + string(m.ip_address), 0);
         membership_list.erase(m.ip_address);
+        notify_member_failure(m.ip_address);
         handle_sdfs_leave_rearrange();
         write_membership_list_to_log_file();
         to_send = true;
@@ -124,10 +140,20 @@ void server::update_membership(vector<Member> received_list) {
             write_log_file(string(m.ip_address) + " UNSUSPECT", 1);
             cout << "### Unsuspect " << m.ip_address << " from being failure" << endl;
             suspect_list.erase(m.ip_address);
+            notify_member_recovery(m.ip_address);
             to_send = true;
         }
         membership_list[m.ip_address].time_stamp = m.time_stamp;
         membership_list[m.ip_address].updated_time = get_curr_timestamp_milliseconds();
+        if (m.load_reported) {
+            Member &member = membership_list[m.ip_address];
+            member.cpu_load = m.cpu_load;
+            member.running_missions = m.running_missions;
+            member.free_disk_mb = m.free_disk_mb;
+            member.throughput_kbps = m.throughput_kbps;
+            member.task_slots = m.task_slots;
+            member.load_reported = 1;
+        }
     }
     membership_list_lock.unlock();
     if (to_send) send_one_entity(m);
@@ -173,10 +199,32 @@ void server::heartbeat_sender() {
         heartbeat_entity.time_stamp = get_curr_timestamp_milliseconds();
         /// Change message type to "heartbeat".
         heartbeat_entity.updated_time = HEARTBEAT;
+        fill_load_report(heartbeat_entity);
         send_one_entity(heartbeat_entity);
+
+        /// The maple juice master schedules by the load, so it gets every heartbeat, not only its neighbours'.
+        string master = find_maple_juice_master_candidate();
+        vector<string> send_target = find_my_send_targets();
+        if (!master.empty() && master != my_ip_address &&
+            find(send_target.begin(), send_target.end(), master) == send_target.end())
+            thread(&server::run_udp_sender, this, master, encode_membership_list({heartbeat_entity})).detach();
     }
 }
 
+void server::fill_load_report(Member &member) {
+    double load_average = 0;
+    long num_cores = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+    if (getloadavg(&load_average, 1) == 1)
+        member.cpu_load = (uint16_t) min(load_average * 100 / (double) num_cores, 65535.0);
+    member.running_missions = (uint16_t) running_missions.load();
+    struct statvfs disk{};
+    if (statvfs((curr_dir + "/files").c_str(), &disk) == 0)
+        member.free_disk_mb = (uint32_t) min((double) disk.f_bavail * disk.f_frsize / (1 << 20), 4294967295.0);
+    member.throughput_kbps = (uint32_t) (recent_throughput / 1024);
+    member.task_slots = (uint16_t) task_slots;
+    member.load_reported = 1;
+}
+
 vector<string> server::find_my_send_targets() {
     membership_list_lock.lock();
     vector<string> send_target;
@@ -261,6 +309,8 @@ void server::failure_detector() {
                 suspect_list[target].updated_time = get_curr_timestamp_milliseconds();
                 write_log_file(string(membership_list[target].ip_address) + " may FAILURE", 1);
                 cout << "### Suspect " << membership_list[target].ip_address << " to be failure" << endl;
+                /// Let maple juice reassign the missions of a suspected worker right away.
+                notify_member_failure(target);
             }
         }
 
@@ -275,6 +325,7 @@ void server::failure_detector() {
                     new_failure.push_back(membership_list[suspect.first]);
                 suspect_erase_pool.push_back(suspect.first);
                 membership_list.erase(suspect.first);
+                notify_member_failure(suspect.first);
                 handle_sdfs_leave_rearrange();
                 write_membership_list_to_log_file();
             }
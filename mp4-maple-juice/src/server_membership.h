@@ -21,11 +21,26 @@
 
 #define LOG_FILE_PATH "mp2.log"
 
+/// Workers reporting less free disk than this take no missions.
+#define LOAD_MIN_FREE_DISK_MB 256
+
+/// Weight of the latest mission in the recent throughput of a worker.
+#define LOAD_THROUGHPUT_SMOOTHING 0.3
+
 struct Member {
     char ip_address[14];
     uint64_t time_stamp;
     uint64_t updated_time;
 
+    /// Load of the sender piggybacked on its heartbeats: busy cores in percent, running missions, free disk in MB,
+    /// the recent throughput of its missions in KB/s and its task slots.
+    uint16_t cpu_load;
+    uint16_t running_missions;
+    uint32_t free_disk_mb;
+    uint32_t throughput_kbps;
+    uint16_t load_reported;
+    uint16_t task_slots;
+
     bool operator<(Member other) const {
         return string(ip_address) < string(other.ip_address);
     }
@@ -0,0 +1,348 @@
+/**
+ * server_monitor.cpp
+ * Implementation of the mission event loop in server_func.h, used by the master to watch the missions of a stage.
+ */
+
+#include "server_func.h"
+#include "server_monitor.h"
+#include "general.h"
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+vector<uint64_t> server::monitor_missions(vector<MonitoredMission> &missions, const vector<string> &workers,
+                                          uint64_t job_id) {
+    maple_juice_done_count_lock.lock();
+    int num_done_target = maple_juice_done_count + (int) missions.size();
+    maple_juice_done_count_lock.unlock();
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        if (epoll_fd >= 0) close(epoll_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        throw runtime_error("Failure in create the mission event loop");
+    }
+    struct epoll_event wake_event{};
+    wake_event.events = EPOLLIN;
+    wake_event.data.u64 = missions.size();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event);
+    auto wake = [wake_fd]() {
+        uint64_t one = 1;
+        ssize_t num_written = write(wake_fd, &one, sizeof(one));
+        (void) num_written;
+    };
+
+    /// The loop thread owns the attempts. It hands a mission waiting for a worker to the dispatcher, and a failed
+    /// mission to the recovery threads, which hand it back through the queues below.
+    vector<MissionAttempt> attempts(missions.size());
+    vector<uint64_t> durations(missions.size(), 0);
+    mutex queue_lock;
+    condition_variable queue_cv;
+    multimap<uint64_t, size_t> dispatch_queue;
+    queue<pair<size_t, string>> ready_queue, recovery_queue;
+    bool stopping = false;
+    /// While a job of a higher priority waits, the dispatcher hands out no more missions. Dispatching is set while
+    /// it waits for a worker, and the recovering missions are counted, so the loop knows when none is in flight.
+    bool preempting = false, dispatching = false;
+    int num_recovering = 0;
+
+    auto finish_mission = [&]() {
+        maple_juice_done_count_lock.lock();
+        maple_juice_done_count++;
+        maple_juice_done_count_lock.unlock();
+        wake();
+    };
+
+    /// The dispatcher takes a free worker for each queued mission, the earliest retry first.
+    thread dispatcher([&]() {
+        unique_lock<mutex> lock(queue_lock);
+        while (!stopping) {
+            uint64_t now = get_curr_timestamp_milliseconds();
+            if (dispatch_queue.empty() || preempting) {
+                queue_cv.wait(lock);
+                continue;
+            }
+            if (dispatch_queue.begin()->first > now) {
+                queue_cv.wait_for(lock, chrono::milliseconds(dispatch_queue.begin()->first - now));
+                continue;
+            }
+            size_t index = dispatch_queue.begin()->second;
+            dispatch_queue.erase(dispatch_queue.begin());
+            dispatching = true;
+            lock.unlock();
+            string worker = acquire_free_worker(job_id);
+            lock.lock();
+            dispatching = false;
+            if (!worker.empty()) {
+                ready_queue.emplace(index, worker);
+                wake();
+                continue;
+            }
+            /// No worker is left for the job, so none of the queued missions can run either.
+            vector<size_t> aborted = {index};
+            for (const auto &item : dispatch_queue) aborted.push_back(item.second);
+            dispatch_queue.clear();
+            lock.unlock();
+            for (size_t aborted_index : aborted)
+                abort_mission(missions[aborted_index].kind, missions[aborted_index].mission_id);
+            wake();
+            lock.lock();
+        }
+    });
+
+    /// The recovery threads count the failure against the worker, and either find the outputs committed before the
+    /// failure, so only the ack is lost, or queue the mission again after its backoff.
+    vector<thread> recoverers;
+    for (int i = 0; i < MISSION_RECOVERY_THREADS; i++) {
+        recoverers.emplace_back([&]() {
+            unique_lock<mutex> lock(queue_lock);
+            while (true) {
+                queue_cv.wait(lock, [&] { return stopping || !recovery_queue.empty(); });
+                if (recovery_queue.empty()) return;
+                pair<size_t, string> item = recovery_queue.front();
+                recovery_queue.pop();
+                lock.unlock();
+
+                MonitoredMission &mission = missions[item.first];
+                record_worker_failure(item.second, job_id);
+                uint64_t retry_at = 0;
+                if (check_mission_committed(mission.commit_filename, job_id)) {
+                    *mission.phase_id = PHASE_IV;
+                    cout << "### " << mission.kind << " mission " << mission.mission_id << " already committed."
+                         << endl;
+                    finish_mission();
+                } else if (backoff_mission_retry(*mission.attempts, mission.kind, mission.mission_id, retry_at)) {
+                    *mission.phase_id = PHASE_I;
+                    lock_guard<mutex> queue_guard(queue_lock);
+                    dispatch_queue.emplace(retry_at, item.first);
+                    queue_cv.notify_all();
+                } else {
+                    wake();
+                }
+                lock.lock();
+                num_recovering--;
+            }
+        });
+    }
+
+    auto watch = [&](size_t index, uint32_t events, int op) {
+        struct epoll_event event{};
+        event.events = events;
+        event.data.u64 = index;
+        epoll_ctl(epoll_fd, op, attempts[index].sock, &event);
+    };
+
+    /// A failed attempt waits for the failure detector to suspect its worker, or until it would have timed out,
+    /// before the recovery, like a blocked reader would have.
+    auto fail_attempt = [&](size_t index, const string &reason) {
+        MissionAttempt &attempt = attempts[index];
+        std::cerr << "error: " << reason << std::endl;
+        cout << "### Try to redistribute " << missions[index].kind << " work..." << endl;
+        if (attempt.sock >= 0) close(attempt.sock);
+        attempt.sock = -1;
+        attempt.state = MONITOR_SUSPECTING;
+        attempt.deadline = get_curr_timestamp_milliseconds() + FAILURE_SUSPECT_WAIT_MILLISECONDS;
+    };
+
+    auto start_attempt = [&](size_t index, const string &target_ip) {
+        MissionAttempt &attempt = attempts[index];
+        attempt = MissionAttempt();
+        attempt.target_ip = target_ip;
+        attempt.state = MONITOR_CONNECTING;
+        attempt.started_at = get_curr_timestamp_milliseconds();
+        attempt.deadline = attempt.started_at + MISSION_CONNECT_TIMEOUT_MILLISECONDS;
+        struct sockaddr_in serv_addr{};
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(this->mj_port);
+        if (inet_pton(AF_INET, target_ip.c_str(), &serv_addr.sin_addr) <= 0) {
+            fail_attempt(index, "Invalid address " + target_ip);
+            return;
+        }
+        attempt.sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (attempt.sock < 0) {
+            fail_attempt(index, "Failure in create socket");
+            return;
+        }
+        if (connect(attempt.sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS) {
+            fail_attempt(index, "Connection to " + target_ip + " failed");
+            return;
+        }
+        watch(index, EPOLLOUT, EPOLL_CTL_ADD);
+    };
+
+    auto handle_event = [&](size_t index, uint32_t events) {
+        MissionAttempt &attempt = attempts[index];
+        MonitoredMission &mission = missions[index];
+        if (attempt.state == MONITOR_CONNECTING) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(attempt.sock, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+                fail_attempt(index, "Connection to " + attempt.target_ip + " failed");
+                return;
+            }
+            attempt.state = MONITOR_SENDING;
+        }
+        if (attempt.state == MONITOR_SENDING) {
+            while (attempt.num_sent < mission.request.size()) {
+                ssize_t num_bytes = send(attempt.sock, mission.request.data() + attempt.num_sent,
+                                         mission.request.size() - attempt.num_sent, MSG_NOSIGNAL);
+                if (num_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+                if (num_bytes < 0) {
+                    fail_attempt(index, "Sending " + mission.kind + " mission failure");
+                    return;
+                }
+                attempt.num_sent += (size_t) num_bytes;
+            }
+            cout << "### send out " << mission.kind << " request " << mission.mission_id << " to "
+                 << attempt.target_ip << endl;
+            attempt.state = MONITOR_WAITING_ACK;
+            attempt.deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+            watch(index, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+            return;
+        }
+        if (attempt.state != MONITOR_WAITING_ACK) return;
+
+        /// Acks can arrive in a single read, or an ack in several.
+        char buffer[MAX_BUFFER_SIZE];
+        bool closed = false;
+        while (true) {
+            ssize_t num_bytes = read(attempt.sock, buffer, MAX_BUFFER_SIZE);
+            if (num_bytes > 0) {
+                attempt.pending.append(buffer, num_bytes);
+                continue;
+            }
+            if (num_bytes < 0 && errno == EINTR) continue;
+            closed = num_bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+        while (attempt.num_acks < mission.acks.size()) {
+            const string &expected_ack = mission.acks[attempt.num_acks];
+            if (attempt.pending.compare(0, expected_ack.size(), expected_ack) != 0) {
+                if (attempt.pending.size() >= expected_ack.size()) {
+                    fail_attempt(index, "Unexpected ack from " + attempt.target_ip + ": " + attempt.pending);
+                    return;
+                }
+                break;
+            }
+            attempt.pending.erase(0, expected_ack.size());
+            attempt.num_acks++;
+            *mission.phase_id = (Stage) (PHASE_I + attempt.num_acks);
+            attempt.deadline = get_curr_timestamp_milliseconds() + MISSION_ACK_TIMEOUT_MILLISECONDS;
+        }
+        if (attempt.num_acks == mission.acks.size()) {
+            cout << "### " << mission.kind << " mission " << mission.mission_id << " done on " << attempt.target_ip
+                 << endl;
+            close(attempt.sock);
+            attempt.sock = -1;
+            attempt.state = MONITOR_DONE;
+            durations[index] = get_curr_timestamp_milliseconds() - attempt.started_at;
+            release_free_worker(attempt.target_ip);
+            finish_mission();
+        } else if (closed || (events & (EPOLLERR | EPOLLHUP))) {
+            fail_attempt(index, "Connection closed by " + attempt.target_ip + " before " +
+                                mission.acks[attempt.num_acks]);
+        }
+    };
+
+    /// The missions beyond the given workers wait for a free worker.
+    for (size_t i = 0; i < missions.size(); i++) {
+        if (i < workers.size() && !workers[i].empty()) {
+            start_attempt(i, workers[i]);
+        } else if (i < workers.size()) {
+            abort_mission(missions[i].kind, missions[i].mission_id);
+        } else {
+            lock_guard<mutex> queue_guard(queue_lock);
+            dispatch_queue.emplace(0, i);
+        }
+    }
+    queue_cv.notify_all();
+
+    struct epoll_event events[MISSION_LOOP_MAX_EVENTS];
+    uint64_t last_tick = 0;
+    while (true) {
+        maple_juice_done_count_lock.lock();
+        bool all_done = maple_juice_done_count >= num_done_target;
+        maple_juice_done_count_lock.unlock();
+        if (all_done) break;
+
+        int num_events = epoll_wait(epoll_fd, events, MISSION_LOOP_MAX_EVENTS, MISSION_POLL_MILLISECONDS);
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.u64 == missions.size()) {
+                uint64_t count;
+                ssize_t num_read = read(wake_fd, &count, sizeof(count));
+                (void) num_read;
+            } else {
+                handle_event((size_t) events[i].data.u64, events[i].events);
+            }
+        }
+
+        queue_lock.lock();
+        queue<pair<size_t, string>> ready;
+        ready.swap(ready_queue);
+        queue_lock.unlock();
+        for (; !ready.empty(); ready.pop()) start_attempt(ready.front().first, ready.front().second);
+
+        /// Deadlines and the failure detector are checked once per poll slice, not on every event.
+        uint64_t now = get_curr_timestamp_milliseconds();
+        if (now - last_tick < MISSION_POLL_MILLISECONDS) continue;
+        last_tick = now;
+        for (size_t i = 0; i < attempts.size(); i++) {
+            MissionAttempt &attempt = attempts[i];
+            if (attempt.state == MONITOR_CONNECTING || attempt.state == MONITOR_SENDING ||
+                attempt.state == MONITOR_WAITING_ACK) {
+                if (is_failed_worker(attempt.target_ip))
+                    fail_attempt(i, "Failure detected on " + attempt.target_ip);
+                else if (now > attempt.deadline)
+                    fail_attempt(i, "Deadline exceeded on " + attempt.target_ip);
+            } else if (attempt.state == MONITOR_SUSPECTING &&
+                       (is_failed_worker(attempt.target_ip) || now > attempt.deadline)) {
+                attempt.state = MONITOR_RECOVERING;
+                lock_guard<mutex> queue_guard(queue_lock);
+                recovery_queue.emplace(i, attempt.target_ip);
+                num_recovering++;
+                queue_cv.notify_all();
+            }
+        }
+
+        /// A mission waiting for a worker is a task boundary of the job, where a job of a higher priority preempts
+        /// it. The job hands out no more missions, and the preempting jobs run once none of its missions is in flight.
+        queue_lock.lock();
+        bool at_boundary = !preempting && !dispatch_queue.empty();
+        queue_lock.unlock();
+        if (at_boundary && has_preempting_job()) {
+            cout << "### Hold back the missions of job " << job_id << " for a job of a higher priority" << endl;
+            queue_lock.lock();
+            preempting = true;
+            queue_lock.unlock();
+        }
+        queue_lock.lock();
+        bool in_flight = !preempting || dispatching || num_recovering > 0 || !ready_queue.empty();
+        queue_lock.unlock();
+        for (size_t i = 0; i < attempts.size() && !in_flight; i++)
+            in_flight = attempts[i].state == MONITOR_CONNECTING || attempts[i].state == MONITOR_SENDING ||
+                        attempts[i].state == MONITOR_WAITING_ACK || attempts[i].state == MONITOR_SUSPECTING;
+        if (!in_flight) {
+            run_preempting_jobs();
+            queue_lock.lock();
+            preempting = false;
+            queue_lock.unlock();
+            queue_cv.notify_all();
+        }
+    }
+
+    queue_lock.lock();
+    stopping = true;
+    queue_lock.unlock();
+    queue_cv.notify_all();
+    dispatcher.join();
+    for (auto &recoverer : recoverers) recoverer.join();
+    for (auto &attempt : attempts)
+        if (attempt.sock >= 0) close(attempt.sock);
+    close(wake_fd);
+    close(epoll_fd);
+
+    /// Throws if a mission was aborted.
+    wait_missions_done(num_done_target);
+    return durations;
+}
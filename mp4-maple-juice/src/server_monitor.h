@@ -0,0 +1,56 @@
+/**
+ * server_monitor.h
+ * Define mission monitoring contents used in server.
+ */
+
+#ifndef SERVER_MONITOR_H
+#define SERVER_MONITOR_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/// The number of threads recovering failed missions, which record the failure and check the commit on sdfs.
+#define MISSION_RECOVERY_THREADS 4
+
+/// The most socket events the mission event loop handles per wakeup.
+#define MISSION_LOOP_MAX_EVENTS 64
+
+/// A mission watched by the mission event loop of the master, the same for maple, juice and native missions.
+class MonitoredMission {
+public:
+    /// The kind of the mission in log lines, "maple", "juice" or the native operator.
+    string kind;
+    int mission_id;
+    string request;
+    /// The acks moving the mission to PHASE_II, PHASE_III and PHASE_IV.
+    vector<string> acks;
+    string commit_filename;
+    /// The phase and failed attempts of the maple, juice or native mission watched.
+    Stage *phase_id;
+    int *attempts;
+};
+
+/// States of a monitored mission in the event loop.
+enum MonitorState {
+    MONITOR_QUEUED, MONITOR_CONNECTING, MONITOR_SENDING, MONITOR_WAITING_ACK, MONITOR_SUSPECTING, MONITOR_RECOVERING,
+    MONITOR_DONE
+};
+
+/// The attempt of a monitored mission on one worker.
+class MissionAttempt {
+public:
+    MonitorState state = MONITOR_QUEUED;
+    string target_ip;
+    int sock = -1;
+    /// The bytes of the request sent so far, and the acks received so far.
+    size_t num_sent = 0;
+    size_t num_acks = 0;
+    /// The bytes read but not matched to an ack yet.
+    string pending;
+    /// The start of the attempt, and the deadline of the current state in milliseconds.
+    uint64_t started_at = 0;
+    uint64_t deadline = 0;
+};
+
+#endif //SERVER_MONITOR_H
@@ -0,0 +1,160 @@
+/**
+ * server_native.cpp
+ * Implementation of native mission funcs in server_func.h, used by the jobs running built-in operators.
+ */
+
+#include "server_func.h"
+#include "server_maplejuice.h"
+#include "general.h"
+
+vector<string> server::select_mission_workers(int num_workers, uint64_t job_id) {
+    membership_list_lock.lock();
+    map<string, Member> curr_membership_list = membership_list;
+    membership_list_lock.unlock();
+    vector<pair<double, string>> candidates;
+    for (const auto &item : curr_membership_list) {
+        const Member &member = item.second;
+        if (item.first == my_ip_address || is_failed_worker(item.first) || is_blacklisted_worker(item.first, job_id))
+            continue;
+        if (member.load_reported && member.free_disk_mb < LOAD_MIN_FREE_DISK_MB) continue;
+        candidates.emplace_back(expected_worker_rate(member), item.first);
+    }
+
+    /// The least loaded workers first, ties keep the ip order.
+    stable_sort(candidates.begin(), candidates.end(),
+                [](const pair<double, string> &a, const pair<double, string> &b) { return a.first > b.first; });
+    vector<string> workers;
+    for (const auto &candidate : candidates) {
+        if ((int) workers.size() >= num_workers) break;
+        workers.push_back(candidate.second);
+    }
+    return workers;
+}
+
+void server::run_native_missions(vector<NativeMission> &missions, uint64_t job_id, int num_workers, bool replayed) {
+    /// No mission of the job runs between two stages, so jobs of a higher priority can run in between.
+    run_preempting_jobs();
+
+    vector<string> workers = select_mission_workers(num_workers, job_id);
+    if (workers.empty())
+        throw runtime_error("No enough workers!");
+
+    maple_juice_done_count = 0;
+    maple_juice_aborted = false;
+
+    /// The first missions go to the chosen workers, the others wait for one of them to become free.
+    vector<MonitoredMission> monitored_missions;
+    vector<string> assigned_workers;
+    for (auto &mission : missions) {
+        if (replayed && check_mission_committed(mission.commit_filename, job_id)) {
+            maple_juice_done_count++;
+            continue;
+        }
+        string kind = mission.request.substr(0, mission.request.find("_start"));
+        if (assigned_workers.size() < workers.size()) assigned_workers.push_back(workers[assigned_workers.size()]);
+        monitored_missions.push_back({kind, mission.mission_id, mission.request,
+                                      {kind + "_mission_receive", kind + "_mission_finished",
+                                       kind + "_mission_uploaded"},
+                                      mission.commit_filename, &mission.phase_id, &mission.attempts});
+    }
+
+    reset_free_workers((int) assigned_workers.size());
+
+    /// Spare members only take over failed missions when the missions do not already queue for workers,
+    /// so a job never runs on more than num_workers nodes at a time.
+    if (monitored_missions.size() <= assigned_workers.size())
+        release_idle_workers(set<string>(assigned_workers.begin(), assigned_workers.end()));
+    release_spare_slots(assigned_workers);
+    monitor_missions(monitored_missions, assigned_workers, job_id);
+}
+
+void server::native_task_processor(int sock, string process_command) {
+    /// Decode the received native command.
+    stringstream ss(process_command);
+    string command, commit_filename, response;
+    int mission_id = 0;
+    uint64_t job_id = 0;
+    ss >> command >> mission_id >> job_id >> commit_filename;
+    string kind = command.substr(0, command.find("_start"));
+    RunningMission running(running_missions);
+
+    response = kind + "_mission_receive";
+    send(sock, response.c_str(), response.size(), 0);
+
+    /// Inputs and outputs of the mission go to its own directory, concurrent missions may fetch the same sdfs file.
+    string mission_dir = create_mission_dir(kind, job_id, mission_id);
+    if (mission_dir.empty()) {
+        std::cerr << "error: Failure in create the directory of " << kind << " mission " << mission_id << std::endl;
+        close(sock);
+        return;
+    }
+
+    /// A failed operator closes the socket without the last acks, so the master redistributes the mission.
+    vector<string> output_files;
+    try {
+        /// The operator runs in a task slot like a UDF, though in the worker process, so without the UDF limits.
+        TaskSlot slot(task_slot_lock, task_slot_cv, free_task_slots);
+        output_files = run_native_operator(kind, mission_id, mission_dir, ss);
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        remove_mission_dir(mission_dir);
+        close(sock);
+        return;
+    }
+
+    response = kind + "_mission_finished";
+    send(sock, response.c_str(), response.size(), 0);
+
+    /// Upload native output files to sdfs.
+    for (const auto &file : output_files)
+        maple_juice_put(curr_dir + "/files/fetched/" + mission_dir + file, file);
+    remove_mission_dir(mission_dir);
+    commit_mission(commit_filename, job_id, output_files);
+
+    response = kind + "_mission_uploaded";
+    send(sock, response.c_str(), response.size(), 0);
+    cout << "### " << kind << " mission " << mission_id << " uploaded!" << endl;
+    close(sock);
+}
+
+vector<string> server::run_native_operator(const string &kind, int mission_id, const string &mission_dir,
+                                           stringstream &args) {
+    if (kind == "join_map") return join_map_operator(mission_id, mission_dir, args);
+    if (kind == "join_reduce") return join_reduce_operator(mission_id, mission_dir, args);
+    if (kind == "broadcast_join") return broadcast_join_operator(mission_id, mission_dir, args);
+    if (kind == "query_map") return query_map_operator(mission_id, mission_dir, args);
+    if (kind == "query_reduce") return query_reduce_operator(mission_id, mission_dir, args);
+    if (kind == "sort_sample") return sort_sample_operator(mission_id, mission_dir, args);
+    if (kind == "sort_map") return sort_map_operator(mission_id, mission_dir, args);
+    if (kind == "sort_reduce") return sort_reduce_operator(mission_id, mission_dir, args);
+    if (kind == "index_map") return index_map_operator(mission_id, mission_dir, args);
+    if (kind == "index_reduce") return index_reduce_operator(mission_id, mission_dir, args);
+    if (kind == "sketch_map") return sketch_map_operator(mission_id, mission_dir, args);
+    throw runtime_error("No such native mission: " + kind);
+}
+
+string server::fetch_sdfs_file(const string &sdfs_filename, const string &local_dir) {
+    string target_get_ip = check_file_exist(sdfs_filename);
+    if (target_get_ip == "-1")
+        throw runtime_error("No such sdfs file: " + sdfs_filename);
+    get_query_sender(sdfs_filename, local_dir + sdfs_filename, target_get_ip);
+    return curr_dir + "/files/fetched/" + local_dir + sdfs_filename;
+}
+
+void server::combine_mission_outputs(const vector<string> &sdfs_outputs, const string &sdfs_dest) {
+    string output_files;
+    for (const auto &file : sdfs_outputs) {
+        get_query_sender(file, file, check_file_exist(file));
+        output_files += " files/fetched/" + file;
+    }
+
+    string sys_command = sdfs_outputs.empty() ? "touch files/fetched/" + sdfs_dest :
+                         "cat" + output_files + " | sort > files/fetched/" + sdfs_dest;
+    system(sys_command.c_str());
+    maple_juice_put(curr_dir + "/files/fetched/" + sdfs_dest, sdfs_dest);
+    sys_command = "rm -f files/fetched/" + sdfs_dest + output_files;
+    system(sys_command.c_str());
+
+    for (const auto &file : sdfs_outputs)
+        delete_all_file_by_prefix(file);
+}
@@ -0,0 +1,537 @@
+/**
+ * server_query.cpp
+ * Implementation of declarative query funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_query.h"
+#include "general.h"
+#include <iomanip>
+
+string to_upper_case(string text) {
+    for (auto &c : text) c = (char) toupper((unsigned char) c);
+    return text;
+}
+
+/**
+ * Parse a whole string as a number.
+ *
+ * Returns:
+ *      Return false if the string is not a number.
+ */
+bool parse_query_number(const string &text, double &number) {
+    if (text.empty()) return false;
+    char *end = nullptr;
+    number = strtod(text.c_str(), &end);
+    return end == text.c_str() + text.size();
+}
+
+string format_query_number(double number) {
+    ostringstream oss;
+    oss << setprecision(15) << number;
+    return oss.str();
+}
+
+/**
+ * Compare two values as numbers if both are numbers, otherwise as strings.
+ */
+int compare_query_values(const string &a, const string &b) {
+    double number_a, number_b;
+    if (parse_query_number(a, number_a) && parse_query_number(b, number_b))
+        return number_a < number_b ? -1 : number_a > number_b ? 1 : 0;
+    int result = a.compare(b);
+    return result < 0 ? -1 : result > 0 ? 1 : 0;
+}
+
+/**
+ * Split a query into keywords, $columns, 'strings', operators and punctuation.
+ */
+vector<string> tokenize_query(const string &sql) {
+    vector<string> tokens;
+    size_t i = 0;
+    while (i < sql.size()) {
+        char c = sql[i];
+        if (isspace((unsigned char) c)) {
+            i++;
+        } else if (c == '\'') {
+            size_t end = sql.find('\'', i + 1);
+            if (end == string::npos)
+                throw runtime_error("Unterminated string in query!");
+            tokens.push_back(sql.substr(i, end - i + 1));
+            i = end + 1;
+        } else if (c == '<' || c == '>' || c == '!' || c == '=') {
+            size_t length = i + 1 < sql.size() && (sql[i + 1] == '=' || (c == '<' && sql[i + 1] == '>')) ? 2 : 1;
+            tokens.push_back(sql.substr(i, length));
+            i += length;
+        } else if (c == ',' || c == '(' || c == ')' || c == '*') {
+            tokens.emplace_back(1, c);
+            i++;
+        } else {
+            size_t end = i;
+            while (end < sql.size() && !isspace((unsigned char) sql[end]) &&
+                   string(",()<>=!'*").find(sql[end]) == string::npos)
+                end++;
+            tokens.push_back(sql.substr(i, end - i));
+            i = end;
+        }
+    }
+    return tokens;
+}
+
+/// Recursive descent parser of the query grammar in server_query.h.
+class QueryParser {
+public:
+    explicit QueryParser(const string &sql) : tokens(tokenize_query(sql)) {}
+
+    QueryPlan parse() {
+        QueryPlan plan;
+        expect("SELECT");
+        do plan.select.push_back(parse_select_item(plan)); while (accept(","));
+
+        expect("FROM");
+        plan.source_prefix = next();
+        if (accept("DELIMITER")) {
+            string token = next();
+            if (token.size() != 3 || token[0] != '\'')
+                throw runtime_error("DELIMITER must be a single quoted character!");
+            plan.delimiter = token[1];
+        }
+
+        if (accept("WHERE")) {
+            do {
+                QueryPredicate predicate{};
+                predicate.column = parse_column();
+                predicate.op = next();
+                if (predicate.op == "<>") predicate.op = "!=";
+                if (predicate.op != "=" && predicate.op != "!=" && predicate.op != "<" && predicate.op != "<=" &&
+                    predicate.op != ">" && predicate.op != ">=")
+                    throw runtime_error("No such operator in query: " + predicate.op);
+                predicate.literal = next();
+                if (predicate.literal.size() >= 2 && predicate.literal[0] == '\'')
+                    predicate.literal = predicate.literal.substr(1, predicate.literal.size() - 2);
+                predicate.is_numeric = parse_query_number(predicate.literal, predicate.number);
+                plan.where.push_back(predicate);
+            } while (accept("AND"));
+        }
+
+        if (accept("GROUP")) {
+            expect("BY");
+            do plan.group_by.push_back(parse_column()); while (accept(","));
+        }
+
+        if (accept("ORDER")) {
+            expect("BY");
+            string name = next();
+            if (pos < tokens.size() && tokens[pos] == "(")
+                while (name.back() != ')') name += next();
+            for (size_t i = 0; i < plan.select.size(); i++)
+                if (to_upper_case(plan.select[i].name) == to_upper_case(name)) plan.order_by = (int) i;
+            if (plan.order_by < 0)
+                throw runtime_error("ORDER BY item not in SELECT list: " + name);
+            if (accept("DESC")) plan.descending = true;
+            else accept("ASC");
+        }
+
+        if (accept("LIMIT")) {
+            string token = next();
+            if (token.empty() || token.find_first_not_of("0123456789") != string::npos)
+                throw runtime_error("LIMIT must be a number!");
+            if (token.size() > QUERY_MAX_LIMIT_DIGITS)
+                throw runtime_error("LIMIT is too large: " + token);
+            plan.limit = stoll(token);
+        }
+
+        if (pos != tokens.size())
+            throw runtime_error("Unexpected token in query: " + tokens[pos]);
+
+        /// Conduct error handling, then find the last field the query reads.
+        for (const auto &item : plan.select) {
+            if (item.column == 0 && item.aggregate_index < 0 && (plan.is_aggregate() || plan.order_by >= 0))
+                throw runtime_error("SELECT * can not be aggregated or ordered!");
+            if (plan.is_aggregate() && item.aggregate_index < 0 &&
+                find(plan.group_by.begin(), plan.group_by.end(), item.column) == plan.group_by.end())
+                throw runtime_error("Column " + item.name + " must be in GROUP BY!");
+            plan.max_column = max(plan.max_column, item.column);
+        }
+        for (const auto &predicate : plan.where) plan.max_column = max(plan.max_column, predicate.column);
+        for (int column : plan.group_by) plan.max_column = max(plan.max_column, column);
+        return plan;
+    }
+
+private:
+    vector<string> tokens;
+    size_t pos = 0;
+
+    string peek_keyword() const {
+        return pos < tokens.size() ? to_upper_case(tokens[pos]) : "";
+    }
+
+    bool accept(const string &keyword) {
+        if (peek_keyword() != keyword) return false;
+        pos++;
+        return true;
+    }
+
+    void expect(const string &keyword) {
+        if (!accept(keyword))
+            throw runtime_error("Expected " + keyword + " in query!");
+    }
+
+    string next() {
+        if (pos >= tokens.size())
+            throw runtime_error("Unexpected end of query!");
+        return tokens[pos++];
+    }
+
+    int parse_column() {
+        string token = next();
+        if (token.size() < 2 || token.size() > QUERY_MAX_COLUMN_DIGITS + 1 || token[0] != '$' ||
+            token.find_first_not_of("0123456789", 1) != string::npos || stoi(token.substr(1)) <= 0)
+            throw runtime_error("Expected a column like $1 in query: " + token);
+        return stoi(token.substr(1));
+    }
+
+    QueryColumn parse_select_item(QueryPlan &plan) {
+        QueryColumn item{"*", 0, -1};
+        string keyword = peek_keyword();
+        if (accept("*")) {
+        } else if (keyword == "COUNT" || keyword == "SUM" || keyword == "AVG" || keyword == "MIN" || keyword == "MAX") {
+            pos++;
+            expect("(");
+            QueryAggregate aggregate{keyword, 0};
+            if (!(keyword == "COUNT" && accept("*"))) aggregate.column = parse_column();
+            expect(")");
+            item.name = keyword + "(" + (aggregate.column == 0 ? "*" : "$" + to_string(aggregate.column)) + ")";
+            item.column = aggregate.column;
+            item.aggregate_index = (int) plan.aggregates.size();
+            plan.aggregates.push_back(aggregate);
+        } else {
+            item.column = parse_column();
+            item.name = "$" + to_string(item.column);
+        }
+        if (accept("AS")) item.name = next();
+        return item;
+    }
+};
+
+/**
+ * Split the fields of a record up to max_column, the rest of the record is never split.
+ */
+void split_query_record(const string &line, char delimiter, int max_column, vector<string> &fields) {
+    fields.clear();
+    size_t pos = 0;
+    while ((int) fields.size() < max_column) {
+        size_t begin = delimiter == 0 ? line.find_first_not_of(" \t", pos) : pos;
+        if (begin == string::npos) break;
+        size_t end = delimiter == 0 ? line.find_first_of(" \t", begin) : line.find(delimiter, begin);
+        fields.push_back(line.substr(begin, end - begin));
+        if (end == string::npos) break;
+        pos = end + 1;
+    }
+}
+
+/**
+ * Get a field of a record, column 0 is the whole record and a missing field is empty.
+ */
+const string &query_field(const string &line, const vector<string> &fields, int column) {
+    static const string empty;
+    if (column == 0) return line;
+    return column <= (int) fields.size() ? fields[column - 1] : empty;
+}
+
+bool match_query_predicates(const QueryPlan &plan, const string &line, const vector<string> &fields) {
+    for (const auto &predicate : plan.where) {
+        const string &value = query_field(line, fields, predicate.column);
+        double number;
+        int result;
+        if (predicate.is_numeric && parse_query_number(value, number))
+            result = number < predicate.number ? -1 : number > predicate.number ? 1 : 0;
+        else result = value.compare(predicate.literal) < 0 ? -1 : value.compare(predicate.literal) > 0 ? 1 : 0;
+        bool matched = predicate.op == "=" ? result == 0 : predicate.op == "!=" ? result != 0 :
+                       predicate.op == "<" ? result < 0 : predicate.op == "<=" ? result <= 0 :
+                       predicate.op == ">" ? result > 0 : result >= 0;
+        if (!matched) return false;
+    }
+    return true;
+}
+
+void update_query_partial(QueryPartial &partial, const QueryAggregate &aggregate, const string &value) {
+    double number;
+    if (aggregate.column == 0 || aggregate.function == "COUNT") {
+        if (aggregate.column == 0 || !value.empty()) partial.count++;
+    } else if (parse_query_number(value, number)) {
+        partial.min = partial.count == 0 ? number : min(partial.min, number);
+        partial.max = partial.count == 0 ? number : max(partial.max, number);
+        partial.sum += number;
+        partial.count++;
+    }
+}
+
+void merge_query_partial(QueryPartial &partial, const QueryPartial &other) {
+    if (other.count == 0) return;
+    partial.min = partial.count == 0 ? other.min : min(partial.min, other.min);
+    partial.max = partial.count == 0 ? other.max : max(partial.max, other.max);
+    partial.sum += other.sum;
+    partial.count += other.count;
+}
+
+string encode_query_partial(const QueryPartial &partial) {
+    ostringstream oss;
+    oss << setprecision(17) << partial.count << "," << partial.sum << "," << partial.min << "," << partial.max;
+    return oss.str();
+}
+
+QueryPartial decode_query_partial(const string &text) {
+    QueryPartial partial;
+    char comma;
+    stringstream ss(text);
+    ss >> partial.count >> comma >> partial.sum >> comma >> partial.min >> comma >> partial.max;
+    return partial;
+}
+
+string finalize_query_partial(const QueryPartial &partial, const QueryAggregate &aggregate) {
+    if (aggregate.function == "COUNT") return to_string(partial.count);
+    if (aggregate.function == "SUM") return format_query_number(partial.sum);
+    if (partial.count == 0) return "";
+    if (aggregate.function == "AVG") return format_query_number(partial.sum / (double) partial.count);
+    return format_query_number(aggregate.function == "MIN" ? partial.min : partial.max);
+}
+
+string join_query_fields(const vector<string> &fields) {
+    string line;
+    for (size_t i = 0; i < fields.size(); i++) line += (i ? "\t" : "") + fields[i];
+    return line;
+}
+
+/**
+ * Sort output rows by the ORDER BY item and cut them to the LIMIT.
+ */
+void order_and_limit_query_rows(const QueryPlan &plan, vector<vector<string>> &rows) {
+    if (plan.order_by >= 0) {
+        auto order_by = (size_t) plan.order_by;
+        auto compare = [&plan, order_by](const vector<string> &a, const vector<string> &b) {
+            int result = compare_query_values(a.size() > order_by ? a[order_by] : "",
+                                              b.size() > order_by ? b[order_by] : "");
+            return plan.descending ? result > 0 : result < 0;
+        };
+        if (plan.limit >= 0 && plan.limit < (int64_t) rows.size()) {
+            partial_sort(rows.begin(), rows.begin() + plan.limit, rows.end(), compare);
+        } else stable_sort(rows.begin(), rows.end(), compare);
+    }
+    if (plan.limit >= 0 && plan.limit < (int64_t) rows.size()) rows.resize(plan.limit);
+}
+
+void server::handle_sql_query(MapleJuiceJob job) {
+    string command = job.command, phase, sdfs_dest, sql;
+    int num_workers = 0;
+    cout << "### Receive query:" << command << endl;
+
+    try {
+        /// Decode query command.
+        stringstream ss(command);
+        ss >> phase >> num_workers >> sdfs_dest;
+        getline(ss >> ws, sql);
+
+        /// Conduct error handling.
+        if (phase != "query" || num_workers <= 0 || sdfs_dest.empty())
+            throw runtime_error("Command type error!");
+        QueryPlan plan = QueryParser(sql).parse();
+        vector<string> source_files = check_all_exist_file_by_prefix(plan.source_prefix);
+        if (source_files.empty())
+            throw runtime_error("No such sdfs source prefix!");
+
+        string job_id = to_string(job.job_id);
+        vector<NativeMission> missions;
+        vector<string> outputs;
+
+        /// Map: filter, project and partially aggregate each source file, only the needed columns are shuffled.
+        string map_commit = sdfs_dest + QUERY_INFIX + "map" + COMMIT_SUFFIX;
+        for (const auto &file : source_files) {
+            int mission_id = (int) missions.size();
+            string commit_filename = map_commit + to_string(mission_id);
+            missions.push_back({mission_id, PHASE_I,
+                                "query_map_start " + to_string(mission_id) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + file + " " + sql, commit_filename});
+            if (!plan.is_aggregate()) outputs.push_back(sdfs_dest + "_" + to_string(mission_id));
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// Reduce: merge the partial aggregates of each partition.
+        if (plan.is_aggregate()) {
+            missions.clear();
+            int num_partitions = plan.group_by.empty() ? 1 : NUM_PARTITIONS;
+            for (int partition = 0; partition < num_partitions; partition++) {
+                string commit_filename = sdfs_dest + COMMIT_SUFFIX + to_string(partition);
+                missions.push_back({partition, PHASE_I,
+                                    "query_reduce_start " + to_string(partition) + " " + job_id + " " +
+                                    commit_filename + " " + sdfs_dest + " " + to_string(partition) + " " + sql,
+                                    commit_filename});
+                outputs.push_back(sdfs_dest + "_" + to_string(partition));
+            }
+            run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+        }
+
+        finalize_query_output(plan, outputs, sdfs_dest);
+        delete_all_file_by_prefix(sdfs_dest + QUERY_INFIX);
+        delete_all_file_by_prefix(sdfs_dest + COMMIT_SUFFIX);
+
+        reply_to_client(job.sock, "Query job: (" + command + ") finished!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+vector<string> server::query_map_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, file, sql, line;
+    args >> sdfs_dest >> file;
+    getline(args >> ws, sql);
+    QueryPlan plan = QueryParser(sql).parse();
+
+    string local_file = fetch_sdfs_file(file, mission_dir);
+    ifstream infile(local_file);
+    vector<string> fields, outputs;
+    vector<vector<string>> rows;
+    unordered_map<string, vector<QueryPartial>> groups;
+    uint64_t num_records = 0, num_matched = 0;
+
+    while (getline(infile, line)) {
+        num_records++;
+        split_query_record(line, plan.delimiter, plan.max_column, fields);
+        if (!match_query_predicates(plan, line, fields)) continue;
+        num_matched++;
+
+        if (plan.is_aggregate()) {
+            vector<string> key_fields;
+            for (int column : plan.group_by) key_fields.push_back(query_field(line, fields, column));
+            vector<QueryPartial> &partials = groups[join_query_fields(key_fields)];
+            if (partials.empty()) partials.resize(plan.aggregates.size());
+            for (size_t i = 0; i < plan.aggregates.size(); i++)
+                update_query_partial(partials[i], plan.aggregates[i],
+                                     query_field(line, fields, plan.aggregates[i].column));
+        } else {
+            vector<string> row;
+            for (const auto &item : plan.select) row.push_back(query_field(line, fields, item.column));
+            rows.push_back(row);
+            /// Without ORDER BY, no file needs more rows than the LIMIT.
+            if (plan.order_by < 0 && plan.limit >= 0 && (int64_t) rows.size() >= plan.limit) break;
+        }
+    }
+    infile.close();
+    remove(local_file.c_str());
+    cout << "### Query map: " << num_matched << " of " << num_records << " records matched" << endl;
+
+    if (!plan.is_aggregate()) {
+        /// With ORDER BY and LIMIT, each file only ships its own top rows.
+        order_and_limit_query_rows(plan, rows);
+        string out_file = sdfs_dest + "_" + to_string(mission_id);
+        ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+        for (const auto &row : rows) ofs << join_query_fields(row) << "\n";
+        ofs.close();
+        return {out_file};
+    }
+
+    /// Partial aggregates are hash partitioned by group, a query without GROUP BY has a single partition.
+    map<int, ofstream> of_map;
+    for (const auto &group : groups) {
+        int partition = plan.group_by.empty() ? 0 : hash_string_to_int(group.first) % NUM_PARTITIONS;
+        if (of_map.find(partition) == of_map.end()) {
+            string out_file = sdfs_dest + QUERY_INFIX + to_string(partition) + "_" + to_string(mission_id);
+            of_map[partition].open(curr_dir + "/files/fetched/" + mission_dir + out_file);
+            outputs.push_back(out_file);
+        }
+        vector<string> line_fields;
+        if (!plan.group_by.empty()) line_fields.push_back(group.first);
+        for (const auto &partial : group.second) line_fields.push_back(encode_query_partial(partial));
+        of_map[partition] << join_query_fields(line_fields) << "\n";
+    }
+    for (auto &item : of_map) item.second.close();
+    return outputs;
+}
+
+vector<string> server::query_reduce_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, sql, line;
+    int partition = 0;
+    args >> sdfs_dest >> partition;
+    getline(args >> ws, sql);
+    QueryPlan plan = QueryParser(sql).parse();
+    size_t num_keys = plan.group_by.size(), num_aggregates = plan.aggregates.size();
+
+    /// Merge the partial aggregates of all map missions by group.
+    unordered_map<string, vector<QueryPartial>> groups;
+    for (const auto &file : check_all_exist_file_by_prefix(sdfs_dest + QUERY_INFIX + to_string(partition) + "_")) {
+        string local_file = fetch_sdfs_file(file, mission_dir);
+        ifstream infile(local_file);
+        vector<string> fields;
+        while (getline(infile, line)) {
+            split_query_record(line, '\t', (int) (num_keys + num_aggregates), fields);
+            if (fields.size() != num_keys + num_aggregates) continue;
+            vector<string> key_fields(fields.begin(), fields.begin() + (long) num_keys);
+            vector<QueryPartial> &partials = groups[join_query_fields(key_fields)];
+            if (partials.empty()) partials.resize(num_aggregates);
+            for (size_t i = 0; i < num_aggregates; i++)
+                merge_query_partial(partials[i], decode_query_partial(fields[num_keys + i]));
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+
+    string out_file = sdfs_dest + "_" + to_string(mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+    vector<string> key_fields;
+    for (const auto &group : groups) {
+        split_query_record(group.first, '\t', (int) num_keys, key_fields);
+        vector<string> row;
+        for (const auto &item : plan.select) {
+            if (item.aggregate_index >= 0) {
+                row.push_back(finalize_query_partial(group.second[item.aggregate_index],
+                                                     plan.aggregates[item.aggregate_index]));
+            } else {
+                size_t key_index = find(plan.group_by.begin(), plan.group_by.end(), item.column) -
+                                   plan.group_by.begin();
+                row.push_back(key_index < key_fields.size() ? key_fields[key_index] : "");
+            }
+        }
+        ofs << join_query_fields(row) << "\n";
+    }
+    ofs.close();
+    return {out_file};
+}
+
+void server::finalize_query_output(const QueryPlan &plan, const vector<string> &sdfs_outputs,
+                                   const string &sdfs_dest) {
+    vector<vector<string>> rows;
+    string line;
+    for (const auto &file : sdfs_outputs) {
+        string local_file = fetch_sdfs_file(file);
+        ifstream infile(local_file);
+        while (getline(infile, line)) {
+            /// SELECT * rows are never split, they are not ordered.
+            vector<string> row;
+            if (plan.order_by >= 0) split_query_record(line, '\t', (int) plan.select.size(), row);
+            else row.push_back(line);
+            rows.push_back(row);
+        }
+        infile.close();
+        remove(local_file.c_str());
+    }
+
+    /// An aggregate without GROUP BY answers one row even for empty input.
+    if (plan.is_aggregate() && plan.group_by.empty() && rows.empty()) {
+        vector<string> row;
+        for (const auto &item : plan.select)
+            row.push_back(finalize_query_partial(QueryPartial(), plan.aggregates[item.aggregate_index]));
+        rows.push_back(row);
+    }
+    order_and_limit_query_rows(plan, rows);
+
+    string local_dest = curr_dir + "/files/fetched/" + sdfs_dest;
+    ofstream ofs(local_dest);
+    for (const auto &row : rows) ofs << join_query_fields(row) << "\n";
+    ofs.close();
+    maple_juice_put(local_dest, sdfs_dest);
+    remove(local_dest.c_str());
+
+    for (const auto &file : sdfs_outputs)
+        delete_all_file_by_prefix(file);
+}
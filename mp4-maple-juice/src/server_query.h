@@ -0,0 +1,79 @@
+/**
+ * server_query.h
+ * Define declarative query contents used in server.
+ */
+
+#ifndef SERVER_QUERY_H
+#define SERVER_QUERY_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/// Infix of the sdfs files of a query: map commit records and map side partial aggregates of each partition.
+#define QUERY_INFIX ".query_"
+
+/// The most digits of a column number and of a LIMIT, so they convert without overflow.
+#define QUERY_MAX_COLUMN_DIGITS 9
+#define QUERY_MAX_LIMIT_DIGITS 18
+
+/// An aggregate function over a column, column 0 is COUNT(*).
+class QueryAggregate {
+public:
+    string function;
+    int column;
+};
+
+/// The partial state of an aggregate, merged on the reduce side.
+class QueryPartial {
+public:
+    uint64_t count = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+};
+
+/// A predicate "$column op literal" of the WHERE clause, compared as numbers if both sides are numbers.
+class QueryPredicate {
+public:
+    int column;
+    string op;
+    string literal;
+    bool is_numeric;
+    double number;
+};
+
+/// An item of the SELECT list, either a column ($1 is the first field, 0 is the whole record) or an aggregate.
+class QueryColumn {
+public:
+    string name;
+    int column;
+    /// Index in QueryPlan::aggregates, -1 for a plain column.
+    int aggregate_index;
+};
+
+/// A parsed query:
+/// SELECT <items> FROM <sdfs_prefix> [DELIMITER '<c>'] [WHERE <predicates>] [GROUP BY <columns>]
+/// [ORDER BY <item> [ASC|DESC]] [LIMIT <n>]
+class QueryPlan {
+public:
+    vector<QueryColumn> select;
+    vector<QueryAggregate> aggregates;
+    string source_prefix;
+    /// Field delimiter, 0 splits on whitespace.
+    char delimiter = 0;
+    vector<QueryPredicate> where;
+    vector<int> group_by;
+    /// Index in select of the ORDER BY item, -1 if unordered.
+    int order_by = -1;
+    bool descending = false;
+    int64_t limit = -1;
+    /// The last field the query reads, the rest of a record is never split.
+    int max_column = 0;
+
+    bool is_aggregate() const {
+        return !aggregates.empty() || !group_by.empty();
+    }
+};
+
+#endif //SERVER_QUERY_H
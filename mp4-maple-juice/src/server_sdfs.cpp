@@ -1138,6 +1138,52 @@ vector<string> server::check_all_exist_file_by_prefix(string prefix) {
     return result;
 }
 
+map<string, uint64_t> server::get_file_sizes_by_prefix(string prefix) {
+    membership_list_lock.lock();
+    map<string, Member> curr_membership_list = membership_list;
+    membership_list_lock.unlock();
+    map<string, uint64_t> result;
+    for (const auto &ip_curr: curr_membership_list) {
+        string ip = ip_curr.first;
+        int sock = 0;
+        char buffer[MAX_BUFFER_SIZE] = {0};
+        try {
+            /// Initialize socket connection.
+            struct sockaddr_in serv_addr{};
+            if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+                throw runtime_error("Failure in create socket");
+
+            serv_addr.sin_family = AF_INET;
+            serv_addr.sin_port = htons(this->sdfs_port);
+
+            if (inet_pton(AF_INET, ip.c_str(), &serv_addr.sin_addr) <= 0)
+                throw runtime_error("Invalid address");
+
+            /// Try to connect to server, if fail then mark server as down.
+            if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+                throw runtime_error("Connection failed");
+
+            string size_request = "prefix_size " + prefix;
+            send(sock, size_request.c_str(), size_request.size(), 0);
+
+            /// The response lists the replicas stored on that node as "<sdfs_filename> <file_size>" pairs.
+            read(sock, buffer, MAX_BUFFER_SIZE - 1);
+            stringstream ss(buffer);
+            string query_type, file_name;
+            uint64_t file_size = 0;
+            ss >> query_type;
+            if (query_type != "prefix_size")
+                throw runtime_error("Message connection failed!");
+            while (ss >> file_name >> file_size) result[file_name] = file_size;
+            close(sock);
+        } catch (runtime_error &e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            close(sock);
+        }
+    }
+    return result;
+}
+
 void server::delete_all_file_by_prefix(string prefix) {
     membership_list_lock.lock();
     map<string, Member> curr_membership_list = membership_list;
@@ -1199,6 +1245,21 @@ void server::handle_prefix_check_exist(int sock, string file_exist_command) {
     close(sock);
 }
 
+void server::handle_prefix_size(int sock, const string &prefix_size_command) {
+    stringstream ss(prefix_size_command);
+    string prefix, command;
+    ss >> command >> prefix;
+    string result = "prefix_size";
+    stored_sdfs_files_lock.lock();
+    for (auto &stored_sdfs_file : stored_sdfs_files) {
+        if (stored_sdfs_file.first.find(prefix) == 0)
+            result += " " + stored_sdfs_file.first + " " + to_string(stored_sdfs_file.second.file_size);
+    }
+    stored_sdfs_files_lock.unlock();
+    send(sock, result.c_str(), result.size(), 0);
+    close(sock);
+}
+
 void server::handle_prefix_delete(int sock, const string &prefix_delete_command) {
     close(sock);
     stringstream ss(prefix_delete_command);
@@ -0,0 +1,380 @@
+/**
+ * server_sketch.cpp
+ * Implementation of mergeable sketch funcs in server_func.h and server_sketch.h.
+ */
+
+#include "server_func.h"
+#include "server_sketch.h"
+#include "general.h"
+#include <cmath>
+#include <iomanip>
+#include <sys/stat.h>
+
+void write_u64(ostream &out, uint64_t value) {
+    out.write((const char *) &value, sizeof(value));
+}
+
+bool read_u64(istream &in, uint64_t &value) {
+    return (bool) in.read((char *) &value, sizeof(value));
+}
+
+void HyperLogLog::insert(uint64_t hash) {
+    /// The first bits choose the register, it keeps the longest run of leading zeros of the remaining bits.
+    size_t index = hash >> (64 - SKETCH_HLL_PRECISION);
+    uint64_t remaining = hash << SKETCH_HLL_PRECISION;
+    uint8_t rank = remaining == 0 ? 64 - SKETCH_HLL_PRECISION + 1 : (uint8_t) (__builtin_clzll(remaining) + 1);
+    registers[index] = max(registers[index], rank);
+}
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+    for (size_t i = 0; i < registers.size(); i++) registers[i] = max(registers[i], other.registers[i]);
+}
+
+double HyperLogLog::estimate() const {
+    double m = (double) registers.size(), sum = 0;
+    int zeros = 0;
+    for (uint8_t rank : registers) {
+        sum += ldexp(1.0, -rank);
+        if (rank == 0) zeros++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    /// Linear counting is more accurate while many registers are still empty.
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+    return estimate;
+}
+
+void HyperLogLog::save(ostream &out) const {
+    out.write((const char *) registers.data(), (streamsize) registers.size());
+}
+
+bool HyperLogLog::load(istream &in) {
+    return (bool) in.read((char *) registers.data(), (streamsize) registers.size());
+}
+
+void CountMinSketch::add(uint64_t hash, uint64_t count) {
+    /// Double hashing: the two halves of the hash give the counter of each row.
+    uint64_t h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1;
+    for (uint64_t row = 0; row < SKETCH_CMS_DEPTH; row++)
+        counters[row * SKETCH_CMS_WIDTH + (h1 + row * h2) % SKETCH_CMS_WIDTH] += count;
+}
+
+uint64_t CountMinSketch::estimate(uint64_t hash) const {
+    uint64_t h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1, estimate = UINT64_MAX;
+    for (uint64_t row = 0; row < SKETCH_CMS_DEPTH; row++)
+        estimate = min(estimate, counters[row * SKETCH_CMS_WIDTH + (h1 + row * h2) % SKETCH_CMS_WIDTH]);
+    return estimate;
+}
+
+void CountMinSketch::merge(const CountMinSketch &other) {
+    for (size_t i = 0; i < counters.size(); i++) counters[i] += other.counters[i];
+}
+
+void CountMinSketch::save(ostream &out) const {
+    out.write((const char *) counters.data(), (streamsize) (counters.size() * sizeof(uint64_t)));
+}
+
+bool CountMinSketch::load(istream &in) {
+    return (bool) in.read((char *) counters.data(), (streamsize) (counters.size() * sizeof(uint64_t)));
+}
+
+void TopKSketch::update_candidate(const string &key, uint64_t estimate) {
+    auto it = candidates.find(key);
+    if (it != candidates.end()) {
+        ranked.erase(make_pair(it->second, key));
+        it->second = estimate;
+    } else if (candidates.size() < capacity) {
+        candidates[key] = estimate;
+    } else if (!ranked.empty() && estimate > ranked.begin()->first) {
+        /// Evict the candidate with the lowest estimate.
+        candidates.erase(ranked.begin()->second);
+        ranked.erase(ranked.begin());
+        candidates[key] = estimate;
+    } else {
+        return;
+    }
+    ranked.insert(make_pair(estimate, key));
+}
+
+void TopKSketch::insert(const string &key) {
+    uint64_t hash = sketch_hash(key);
+    counts.add(hash, 1);
+    update_candidate(key, counts.estimate(hash));
+}
+
+void TopKSketch::merge(const TopKSketch &other) {
+    counts.merge(other.counts);
+    set<string> keys;
+    for (const auto &item : candidates) keys.insert(item.first);
+    for (const auto &item : other.candidates) keys.insert(item.first);
+    candidates.clear();
+    ranked.clear();
+    for (const auto &key : keys) update_candidate(key, counts.estimate(sketch_hash(key)));
+}
+
+vector<pair<string, uint64_t>> TopKSketch::top(size_t k) const {
+    vector<pair<string, uint64_t>> result;
+    for (auto it = ranked.rbegin(); it != ranked.rend() && result.size() < k; it++)
+        result.emplace_back(it->second, it->first);
+    return result;
+}
+
+void TopKSketch::save(ostream &out) const {
+    counts.save(out);
+    write_u64(out, candidates.size());
+    for (const auto &item : candidates) {
+        write_u64(out, item.first.size());
+        out.write(item.first.data(), (streamsize) item.first.size());
+    }
+}
+
+bool TopKSketch::load(istream &in) {
+    uint64_t num_candidates = 0, length = 0;
+    if (!counts.load(in) || !read_u64(in, num_candidates)) return false;
+    for (uint64_t i = 0; i < num_candidates; i++) {
+        if (!read_u64(in, length)) return false;
+        string key(length, '\0');
+        if (!in.read(&key[0], (streamsize) length)) return false;
+        update_candidate(key, counts.estimate(sketch_hash(key)));
+    }
+    return true;
+}
+
+size_t KllSketch::level_capacity(size_t level) const {
+    /// Each level below the top holds 2/3 of the one above it, at least 2 items.
+    double capacity = SKETCH_KLL_K * pow(2.0 / 3.0, (double) (levels.size() - 1 - level));
+    return max((size_t) 2, (size_t) ceil(capacity));
+}
+
+void KllSketch::compress() {
+    while (true) {
+        size_t total_capacity = 0;
+        for (size_t level = 0; level < levels.size(); level++) total_capacity += level_capacity(level);
+        if (num_retained < total_capacity) return;
+        for (size_t level = 0; level < levels.size(); level++) {
+            if (levels[level].size() < level_capacity(level)) continue;
+            if (level + 1 == levels.size()) levels.emplace_back();
+            vector<double> &items = levels[level];
+            sort(items.begin(), items.end());
+            /// An odd item out stays on its level.
+            double leftover = items.back();
+            bool odd = items.size() % 2 == 1;
+            if (odd) items.pop_back();
+            for (size_t i = generator() % 2; i < items.size(); i += 2) levels[level + 1].push_back(items[i]);
+            num_retained -= items.size() / 2;
+            items.clear();
+            if (odd) items.push_back(leftover);
+            break;
+        }
+    }
+}
+
+void KllSketch::insert(double value) {
+    if (num_items == 0 || value < min_value) min_value = value;
+    if (num_items == 0 || value > max_value) max_value = value;
+    levels[0].push_back(value);
+    num_items++;
+    num_retained++;
+    compress();
+}
+
+void KllSketch::merge(const KllSketch &other) {
+    if (other.num_items == 0) return;
+    if (num_items == 0 || other.min_value < min_value) min_value = other.min_value;
+    if (num_items == 0 || other.max_value > max_value) max_value = other.max_value;
+    if (other.levels.size() > levels.size()) levels.resize(other.levels.size());
+    for (size_t level = 0; level < other.levels.size(); level++)
+        levels[level].insert(levels[level].end(), other.levels[level].begin(), other.levels[level].end());
+    num_items += other.num_items;
+    num_retained += other.num_retained;
+    compress();
+}
+
+double KllSketch::quantile(double rank) const {
+    vector<pair<double, uint64_t>> weighted;
+    uint64_t total_weight = 0;
+    for (size_t level = 0; level < levels.size(); level++)
+        for (double value : levels[level]) {
+            weighted.emplace_back(value, (uint64_t) 1 << level);
+            total_weight += (uint64_t) 1 << level;
+        }
+    if (weighted.empty()) return 0;
+    sort(weighted.begin(), weighted.end());
+    if (rank <= 0) return min_value;
+    if (rank >= 1) return max_value;
+    uint64_t cumulative = 0;
+    for (const auto &item : weighted) {
+        cumulative += item.second;
+        if ((double) cumulative >= rank * (double) total_weight) return item.first;
+    }
+    return max_value;
+}
+
+void KllSketch::save(ostream &out) const {
+    write_u64(out, num_items);
+    out.write((const char *) &min_value, sizeof(double));
+    out.write((const char *) &max_value, sizeof(double));
+    write_u64(out, levels.size());
+    for (const auto &items : levels) {
+        write_u64(out, items.size());
+        out.write((const char *) items.data(), (streamsize) (items.size() * sizeof(double)));
+    }
+}
+
+bool KllSketch::load(istream &in) {
+    uint64_t num_levels = 0, size = 0;
+    if (!read_u64(in, num_items) || !in.read((char *) &min_value, sizeof(double)) ||
+        !in.read((char *) &max_value, sizeof(double)) || !read_u64(in, num_levels))
+        return false;
+    levels.assign(num_levels, vector<double>());
+    num_retained = 0;
+    for (auto &items : levels) {
+        if (!read_u64(in, size)) return false;
+        items.resize(size);
+        if (!in.read((char *) items.data(), (streamsize) (size * sizeof(double)))) return false;
+        num_retained += size;
+    }
+    return true;
+}
+
+/**
+ * The 1-based column of a line, empty if the line has fewer columns.
+ */
+string sketch_column(const string &line, int column) {
+    stringstream ss(line);
+    string field;
+    for (int i = 0; i < column; i++)
+        if (!(ss >> field)) return "";
+    return field;
+}
+
+void server::handle_sketch_query(MapleJuiceJob job) {
+    string command = job.command, phase, kind, sdfs_src, sdfs_dest, option;
+    int num_workers = 0, column = 1, k = 10;
+    uint64_t total_bytes = 0, sketch_bytes = 0, start_time = get_curr_timestamp_milliseconds();
+    cout << "### Receive sketch:" << command << endl;
+
+    try {
+        /// Decode sketch command.
+        stringstream ss(command);
+        ss >> phase >> kind >> num_workers >> sdfs_src >> sdfs_dest;
+        while (ss >> option) {
+            if (option.compare(0, 7, "column=") == 0) column = atoi(option.c_str() + 7);
+            else if (option.compare(0, 2, "k=") == 0) k = atoi(option.c_str() + 2);
+        }
+
+        /// Conduct error handling.
+        if (phase != "sketch" || (kind != "distinct" && kind != "topk" && kind != "quantile") || num_workers <= 0 ||
+            sdfs_src.empty() || sdfs_dest.empty() || column <= 0 || k <= 0)
+            throw runtime_error("Command type error!");
+        vector<string> source_files = check_all_exist_file_by_prefix(sdfs_src);
+        if (source_files.empty())
+            throw runtime_error("No such sdfs source prefix!");
+        map<string, uint64_t> file_sizes = get_file_sizes_by_prefix(sdfs_src);
+        for (const auto &file : source_files) total_bytes += file_sizes[file];
+
+        /// Map: each source file is summarized by a sketch, only the sketches are shipped.
+        string job_id = to_string(job.job_id);
+        vector<NativeMission> missions;
+        string commit_prefix = sdfs_dest + SKETCH_INFIX + "map" + COMMIT_SUFFIX;
+        for (const auto &file : source_files) {
+            int mission_id = (int) missions.size();
+            string commit_filename = commit_prefix + to_string(mission_id);
+            missions.push_back({mission_id, PHASE_I,
+                                "sketch_map_start " + to_string(mission_id) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + kind + " " + to_string(column) + " " + to_string(k) + " " +
+                                file, commit_filename});
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// Merge the sketches on the master, each is a few hundred kilobytes at most.
+        HyperLogLog distinct;
+        TopKSketch heavy_hitters((size_t) k * SKETCH_TOPK_CANDIDATE_FACTOR);
+        KllSketch quantiles(job.job_id);
+        for (size_t i = 0; i < missions.size(); i++) {
+            string local_file = fetch_sdfs_file(sdfs_dest + SKETCH_INFIX + to_string(i));
+            ifstream infile(local_file, ifstream::binary);
+            bool loaded;
+            if (kind == "distinct") {
+                HyperLogLog partial;
+                if ((loaded = partial.load(infile))) distinct.merge(partial);
+            } else if (kind == "topk") {
+                TopKSketch partial((size_t) k * SKETCH_TOPK_CANDIDATE_FACTOR);
+                if ((loaded = partial.load(infile))) heavy_hitters.merge(partial);
+            } else {
+                KllSketch partial(job.job_id);
+                if ((loaded = partial.load(infile))) quantiles.merge(partial);
+            }
+            infile.close();
+            struct stat file_stat{};
+            if (stat(local_file.c_str(), &file_stat) == 0) sketch_bytes += (uint64_t) file_stat.st_size;
+            remove(local_file.c_str());
+            if (!loaded)
+                throw runtime_error("Corrupted sketch of mission " + to_string(i) + "!");
+        }
+
+        ostringstream result;
+        if (kind == "distinct") {
+            result << "distinct " << llround(distinct.estimate()) << "\n";
+            result << "relative_standard_error " << 1.04 / sqrt((double) (1 << SKETCH_HLL_PRECISION)) << "\n";
+        } else if (kind == "topk") {
+            for (const auto &item : heavy_hitters.top((size_t) k)) result << item.first << " " << item.second << "\n";
+        } else {
+            result << "count " << quantiles.count() << "\n";
+            result << "min " << quantiles.min_value << "\n";
+            for (double rank : {0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99})
+                result << "p" << rank * 100 << " " << quantiles.quantile(rank) << "\n";
+            result << "max " << quantiles.max_value << "\n";
+        }
+        sdfs_write_text(sdfs_dest, result.str());
+        delete_all_file_by_prefix(sdfs_dest + SKETCH_INFIX);
+
+        double elapsed_seconds = (double) (get_curr_timestamp_milliseconds() - start_time) / 1000;
+        ostringstream summary;
+        summary << fixed << setprecision(2) << (double) total_bytes / (1 << 20) << " MB summarized by "
+                << (double) sketch_bytes / (1 << 20) << " MB of sketches in " << elapsed_seconds << " s";
+        reply_to_client(job.sock, "Sketch job: (" + command + ") finished, " + summary.str() + "!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+vector<string> server::sketch_map_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, kind, file, line;
+    int column = 1, k = 10;
+    args >> sdfs_dest >> kind >> column >> k >> file;
+
+    string local_file = fetch_sdfs_file(file, mission_dir);
+    ifstream infile(local_file);
+    HyperLogLog distinct;
+    TopKSketch heavy_hitters((size_t) k * SKETCH_TOPK_CANDIDATE_FACTOR);
+    /// Seeded by the mission, so a redone mission compacts the same way.
+    KllSketch quantiles((uint64_t) mission_id);
+    uint64_t skipped_lines = 0;
+    while (getline(infile, line)) {
+        string field = sketch_column(line, column);
+        if (field.empty()) continue;
+        if (kind == "distinct") {
+            distinct.insert(sketch_hash(field));
+        } else if (kind == "topk") {
+            heavy_hitters.insert(field);
+        } else {
+            char *end = nullptr;
+            double value = strtod(field.c_str(), &end);
+            if (end == field.c_str() + field.size() && !std::isnan(value)) quantiles.insert(value);
+            else skipped_lines++;
+        }
+    }
+    infile.close();
+    remove(local_file.c_str());
+    if (skipped_lines > 0)
+        cout << "### Sketch " << file << ": " << skipped_lines << " lines without a numeric value skipped" << endl;
+
+    string out_file = sdfs_dest + SKETCH_INFIX + to_string(mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file, ofstream::binary);
+    if (kind == "distinct") distinct.save(ofs);
+    else if (kind == "topk") heavy_hitters.save(ofs);
+    else quantiles.save(ofs);
+    ofs.close();
+    return {out_file};
+}
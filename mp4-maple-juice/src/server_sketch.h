@@ -0,0 +1,149 @@
+/**
+ * server_sketch.h
+ * Define mergeable sketch contents used in server.
+ */
+
+#ifndef SERVER_SKETCH_H
+#define SERVER_SKETCH_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <random>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+/// Infix of the partial sketches shipped from the map missions, followed by the mission id.
+#define SKETCH_INFIX ".sketch_"
+
+/// HyperLogLog keeps 2^14 one byte registers, a relative standard error of 1.04 / sqrt(2^14), about 0.8%.
+#define SKETCH_HLL_PRECISION 14
+
+/// Count-min sketch of 4 rows of 4096 counters, an estimate is above the true count by at most e / 4096 of all the
+/// records with probability 1 - e^-4.
+#define SKETCH_CMS_DEPTH 4
+#define SKETCH_CMS_WIDTH 4096
+
+/// A map mission keeps this many times k candidates for the top k, so a key heavy over all the files but not in the
+/// top k of any single file is still found.
+#define SKETCH_TOPK_CANDIDATE_FACTOR 4
+
+/// The accuracy parameter of the KLL quantile sketch, the rank error is about 1.65 / k, 0.8% for k = 200.
+#define SKETCH_KLL_K 200
+
+/**
+ * The 64 bit hash of a key used by all sketches: FNV-1a followed by the murmur3 finalizer, so that every bit of the
+ * hash depends on every byte of the key.
+ */
+inline uint64_t sketch_hash(const std::string &key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) h = (h ^ c) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/// HyperLogLog distinct counter, partial counters are merged by the maximum of each register.
+class HyperLogLog {
+public:
+    HyperLogLog() : registers(1 << SKETCH_HLL_PRECISION, 0) {}
+
+    void insert(uint64_t hash);
+
+    void merge(const HyperLogLog &other);
+
+    double estimate() const;
+
+    void save(std::ostream &out) const;
+
+    bool load(std::istream &in);
+
+private:
+    std::vector<uint8_t> registers;
+};
+
+/// Count-min sketch of key frequencies, partial sketches are merged by adding the counters.
+class CountMinSketch {
+public:
+    CountMinSketch() : counters(SKETCH_CMS_DEPTH * SKETCH_CMS_WIDTH, 0) {}
+
+    void add(uint64_t hash, uint64_t count);
+
+    uint64_t estimate(uint64_t hash) const;
+
+    void merge(const CountMinSketch &other);
+
+    void save(std::ostream &out) const;
+
+    bool load(std::istream &in);
+
+private:
+    std::vector<uint64_t> counters;
+};
+
+/// Heavy hitters: a count-min sketch of all the keys, and the keys with the highest estimates as candidates.
+class TopKSketch {
+public:
+    explicit TopKSketch(size_t capacity) : capacity(capacity) {}
+
+    void insert(const std::string &key);
+
+    /// The candidates of both sketches are estimated again from the merged counters.
+    void merge(const TopKSketch &other);
+
+    /// The k candidates with the highest estimates, highest first.
+    std::vector<std::pair<std::string, uint64_t>> top(size_t k) const;
+
+    void save(std::ostream &out) const;
+
+    bool load(std::istream &in);
+
+private:
+    size_t capacity;
+    CountMinSketch counts;
+    std::map<std::string, uint64_t> candidates;
+    std::set<std::pair<uint64_t, std::string>> ranked;
+
+    void update_candidate(const std::string &key, uint64_t estimate);
+};
+
+/**
+ * KLL quantile sketch: a stack of compactors, the items of level h weigh 2^h. A full level is sorted and every other
+ * item, starting from a random one of the first two, is promoted to the level above, the lower levels get less
+ * capacity than the higher ones.
+ */
+class KllSketch {
+public:
+    explicit KllSketch(uint64_t seed) : levels(1), generator(seed) {}
+
+    void insert(double value);
+
+    void merge(const KllSketch &other);
+
+    /// The value at the given rank in [0, 1].
+    double quantile(double rank) const;
+
+    uint64_t count() const { return num_items; }
+
+    void save(std::ostream &out) const;
+
+    bool load(std::istream &in);
+
+    double min_value = 0, max_value = 0;
+
+private:
+    std::vector<std::vector<double>> levels;
+    uint64_t num_items = 0, num_retained = 0;
+    std::mt19937_64 generator;
+
+    size_t level_capacity(size_t level) const;
+
+    void compress();
+};
+
+#endif //SERVER_SKETCH_H
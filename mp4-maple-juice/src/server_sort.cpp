@@ -0,0 +1,221 @@
+/**
+ * server_sort.cpp
+ * Implementation of total order sort funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_sort.h"
+#include "general.h"
+#include <iomanip>
+#include <random>
+
+string sort_partition_filename(const string &sdfs_dest, int partition) {
+    ostringstream oss;
+    oss << sdfs_dest << SORT_PART_INFIX << setw(5) << setfill('0') << partition;
+    return oss.str();
+}
+
+void server::handle_sort_query(MapleJuiceJob job) {
+    string command = job.command, phase, sdfs_src, sdfs_dest, line;
+    int num_workers = 0, num_partitions = 0;
+    uint64_t start_time = get_curr_timestamp_milliseconds(), total_bytes = 0;
+    cout << "### Receive sort:" << command << endl;
+
+    try {
+        /// Decode sort command.
+        stringstream ss(command);
+        ss >> phase >> num_workers >> num_partitions >> sdfs_src >> sdfs_dest;
+
+        /// Conduct error handling.
+        if (phase != "sort" || num_workers <= 0 || num_partitions <= 0 || sdfs_src.empty() || sdfs_dest.empty())
+            throw runtime_error("Command type error!");
+        vector<string> source_files = check_all_exist_file_by_prefix(sdfs_src);
+        if (source_files.empty())
+            throw runtime_error("No such sdfs source prefix!");
+        map<string, uint64_t> file_sizes = get_file_sizes_by_prefix(sdfs_src);
+        for (const auto &file : source_files) total_bytes += file_sizes[file];
+
+        string job_id = to_string(job.job_id);
+        vector<NativeMission> missions;
+
+        /// Sample: each source file sends a random sample of its keys.
+        if (num_partitions > 1) {
+            int samples_per_file = max(SORT_MIN_SAMPLES_PER_FILE, SORT_SAMPLE_KEYS / (int) source_files.size());
+            string sample_commit = sdfs_dest + SORT_INFIX + "sample" + COMMIT_SUFFIX;
+            for (const auto &file : source_files) {
+                int mission_id = (int) missions.size();
+                string commit_filename = sample_commit + to_string(mission_id);
+                missions.push_back({mission_id, PHASE_I,
+                                    "sort_sample_start " + to_string(mission_id) + " " + job_id + " " +
+                                    commit_filename + " " + sdfs_dest + " " + file + " " +
+                                    to_string(samples_per_file) + " " + job_id, commit_filename});
+            }
+            run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+            /// Choose the split points at evenly spaced ranks of the sorted sample, so each partition gets about
+            /// the same number of records.
+            vector<string> samples;
+            for (size_t i = 0; i < missions.size(); i++) {
+                string local_file = fetch_sdfs_file(sdfs_dest + SORT_SAMPLE_INFIX + to_string(i));
+                ifstream infile(local_file);
+                while (getline(infile, line)) samples.push_back(line);
+                infile.close();
+                remove(local_file.c_str());
+            }
+            if (samples.empty())
+                throw runtime_error("No record to sort!");
+            sort(samples.begin(), samples.end());
+            string splits;
+            for (int i = 1; i < num_partitions; i++)
+                splits += samples[(uint64_t) i * samples.size() / num_partitions] + "\n";
+            sdfs_write_text(sdfs_dest + SORT_SPLITS_SUFFIX, splits);
+            missions.clear();
+        }
+
+        /// Map: range partition each source file by the split points and sort each range.
+        string map_commit = sdfs_dest + SORT_INFIX + "map" + COMMIT_SUFFIX;
+        for (const auto &file : source_files) {
+            int mission_id = (int) missions.size();
+            string commit_filename = map_commit + to_string(mission_id);
+            missions.push_back({mission_id, PHASE_I,
+                                "sort_map_start " + to_string(mission_id) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + file + " " + to_string(num_partitions), commit_filename});
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// Reduce: merge the sorted runs of each range into one output partition.
+        missions.clear();
+        string partition_list;
+        for (int partition = 0; partition < num_partitions; partition++) {
+            string commit_filename = sdfs_dest + COMMIT_SUFFIX + to_string(partition);
+            missions.push_back({partition, PHASE_I,
+                                "sort_reduce_start " + to_string(partition) + " " + job_id + " " + commit_filename +
+                                " " + sdfs_dest + " " + to_string(partition), commit_filename});
+            partition_list += sort_partition_filename(sdfs_dest, partition) + "\n";
+        }
+        run_native_missions(missions, job.job_id, num_workers, job.sock < 0);
+
+        /// The partitions are in key order, sdfs_dest lists them so the output can be read in order.
+        sdfs_write_text(sdfs_dest, partition_list);
+        delete_all_file_by_prefix(sdfs_dest + SORT_INFIX);
+        delete_all_file_by_prefix(sdfs_dest + COMMIT_SUFFIX);
+
+        double elapsed_seconds = (double) (get_curr_timestamp_milliseconds() - start_time) / 1000;
+        ostringstream summary;
+        summary << fixed << setprecision(2) << (double) total_bytes / (1 << 20) << " MB in " << elapsed_seconds
+                << " s";
+        reply_to_client(job.sock, "Sort job: (" + command + ") finished, " + summary.str() + "!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+}
+
+vector<string> server::sort_sample_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, file, line;
+    int num_samples = 0;
+    uint64_t seed = 0;
+    args >> sdfs_dest >> file >> num_samples >> seed;
+
+    /// Reservoir sampling over the records, seeded by the job so a redone mission gives the same sample.
+    string local_file = fetch_sdfs_file(file, mission_dir);
+    ifstream infile(local_file);
+    mt19937_64 generator(seed ^ hash<string>()(file));
+    vector<string> samples;
+    uint64_t num_records = 0;
+    while (getline(infile, line)) {
+        num_records++;
+        if ((int) samples.size() < num_samples) {
+            samples.push_back(sort_record_key(line));
+        } else {
+            uint64_t index = generator() % num_records;
+            if (index < (uint64_t) num_samples) samples[index] = sort_record_key(line);
+        }
+    }
+    infile.close();
+    remove(local_file.c_str());
+
+    string out_file = sdfs_dest + SORT_SAMPLE_INFIX + to_string(mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+    for (const auto &key : samples) ofs << key << "\n";
+    ofs.close();
+    return {out_file};
+}
+
+vector<string> server::sort_map_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, file, line;
+    int num_partitions = 0;
+    args >> sdfs_dest >> file >> num_partitions;
+
+    vector<string> splits;
+    if (num_partitions > 1) {
+        string local_splits = fetch_sdfs_file(sdfs_dest + SORT_SPLITS_SUFFIX, mission_dir);
+        ifstream splits_file(local_splits);
+        while (getline(splits_file, line)) splits.push_back(line);
+        splits_file.close();
+        remove(local_splits.c_str());
+    }
+
+    /// A record belongs to the first partition whose split point is greater than its key.
+    string local_file = fetch_sdfs_file(file, mission_dir);
+    ifstream infile(local_file);
+    vector<vector<pair<string, string>>> partitions((size_t) num_partitions);
+    while (getline(infile, line)) {
+        string key = sort_record_key(line);
+        size_t partition = upper_bound(splits.begin(), splits.end(), key) - splits.begin();
+        partitions[partition].emplace_back(move(key), move(line));
+    }
+    infile.close();
+    remove(local_file.c_str());
+
+    /// Each partition is shipped as a sorted run, so the reducers only merge.
+    vector<string> outputs;
+    for (int partition = 0; partition < num_partitions; partition++) {
+        vector<pair<string, string>> &records = partitions[partition];
+        if (records.empty()) continue;
+        sort(records.begin(), records.end());
+        string out_file = sdfs_dest + SORT_INFIX + to_string(partition) + "_" + to_string(mission_id);
+        ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+        for (const auto &record : records) ofs << record.second << "\n";
+        ofs.close();
+        outputs.push_back(out_file);
+    }
+    return outputs;
+}
+
+vector<string> server::sort_reduce_operator(int mission_id, const string &mission_dir, stringstream &args) {
+    string sdfs_dest, line;
+    int partition = 0;
+    args >> sdfs_dest >> partition;
+
+    vector<string> local_files;
+    for (const auto &file : check_all_exist_file_by_prefix(sdfs_dest + SORT_INFIX + to_string(partition) + "_"))
+        local_files.push_back(fetch_sdfs_file(file, mission_dir));
+
+    /// K-way merge of the sorted runs of all map missions.
+    vector<ifstream> runs(local_files.size());
+    typedef tuple<string, string, size_t> MergeHead;
+    priority_queue<MergeHead, vector<MergeHead>, greater<MergeHead>> heads;
+    for (size_t i = 0; i < runs.size(); i++) {
+        runs[i].open(local_files[i]);
+        if (getline(runs[i], line)) heads.emplace(sort_record_key(line), line, i);
+    }
+
+    string out_file = sort_partition_filename(sdfs_dest, mission_id);
+    ofstream ofs(curr_dir + "/files/fetched/" + mission_dir + out_file);
+    uint64_t num_records = 0;
+    while (!heads.empty()) {
+        size_t run = get<2>(heads.top());
+        ofs << get<1>(heads.top()) << "\n";
+        heads.pop();
+        num_records++;
+        if (getline(runs[run], line)) heads.emplace(sort_record_key(line), line, run);
+    }
+    ofs.close();
+    for (size_t i = 0; i < runs.size(); i++) {
+        runs[i].close();
+        remove(local_files[i].c_str());
+    }
+    cout << "### Sort partition " << partition << ": " << num_records << " records merged" << endl;
+    return {out_file};
+}
@@ -0,0 +1,31 @@
+/**
+ * server_sort.h
+ * Define total order sort contents used in server.
+ */
+
+#ifndef SERVER_SORT_H
+#define SERVER_SORT_H
+
+#include <string>
+
+/// Infix of the sdfs files of a sort job: key samples, split points and sorted runs of each partition.
+#define SORT_INFIX ".sort_"
+#define SORT_SAMPLE_INFIX ".sort_sample_"
+#define SORT_SPLITS_SUFFIX ".sort_splits"
+
+/// Infix of the output partitions, followed by the zero padded partition number.
+#define SORT_PART_INFIX "_part_"
+
+/// The number of keys sampled from the whole input to choose the split points, and the least from each file.
+#define SORT_SAMPLE_KEYS 100000
+#define SORT_MIN_SAMPLES_PER_FILE 100
+
+/**
+ * The sort key of a record is its first field, records without a space or tab are keys themselves. Keys are compared
+ * byte by byte, the same order as teravalidate.
+ */
+inline std::string sort_record_key(const std::string &record) {
+    return record.substr(0, record.find_first_of(" \t"));
+}
+
+#endif //SERVER_SORT_H
@@ -0,0 +1,163 @@
+/**
+ * server_stream.cpp
+ * Implementation of streaming micro batch funcs in server_func.h.
+ */
+
+#include "server_func.h"
+#include "server_stream.h"
+#include "server_columnar.h"
+#include "general.h"
+#include <iomanip>
+
+string stream_window_filename(const string &sdfs_dest, int batch) {
+    ostringstream oss;
+    oss << sdfs_dest << STREAM_WINDOW_INFIX << setw(8) << setfill('0') << batch;
+    return oss.str();
+}
+
+void server::handle_stream_query(MapleJuiceJob job) {
+    string command = job.command, phase, maple_exe, juice_exe, interval_seconds, sdfs_src, sdfs_dest, option;
+    int num_workers = 0, window_batches = 0, batch = 0;
+    uint64_t start_time = get_curr_timestamp_milliseconds();
+    bool schedule_next = false;
+    cout << "### Receive stream:" << command << endl;
+
+    try {
+        /// Decode stream command.
+        stringstream ss(command);
+        ss >> phase;
+        if (phase == "stream_stop") {
+            ss >> sdfs_dest;
+            if (sdfs_dest.empty())
+                throw runtime_error("Command type error!");
+            /// The stop is an sdfs file, so it still reaches the queued batch after a master failover.
+            sdfs_write_text(sdfs_dest + STREAM_STOP_SUFFIX, "stop\n");
+            reply_to_client(job.sock, "Stream job of " + sdfs_dest + " stops at its next batch!");
+            return;
+        }
+        ss >> maple_exe >> juice_exe >> num_workers >> interval_seconds >> window_batches >> sdfs_src >> sdfs_dest;
+        while (ss >> option)
+            if (option.compare(0, 6, "batch=") == 0) batch = atoi(option.c_str() + 6);
+
+        /// Conduct error handling.
+        if (phase != "stream" || juice_exe.empty() || num_workers <= 0 || atof(interval_seconds.c_str()) <= 0 ||
+            window_batches < 0 || sdfs_src.empty() || sdfs_dest.empty())
+            throw runtime_error("Command type error!");
+        if (check_file_exist(maple_exe) == "-1" ||
+            (!is_builtin_juice(juice_exe) && check_file_exist(juice_exe) == "-1"))
+            throw runtime_error("No such maple_exe or juice_exe, please first put them onto sdfs!");
+        if (is_builtin_juice(juice_exe) && (parse_builtin_juice(juice_exe) == JUICE_UNKNOWN || juice_exe == "@count"))
+            throw runtime_error("A stream job takes the built-in juices @sum, @min, @max or @avg!");
+        string sdfs_prefix = sdfs_dest + STREAM_INTERMEDIATE_SUFFIX, batch_output = sdfs_dest + ".stream_batch";
+        string stop_file = sdfs_dest + STREAM_STOP_SUFFIX;
+        if (check_file_exist(stop_file) != "-1") {
+            /// A new stream ignores the stop of a previous one on the same sdfs_dest.
+            delete_all_file_by_prefix(stop_file);
+            if (batch > 0) {
+                delete_all_file_by_prefix(sdfs_dest + STREAM_WINDOW_INFIX);
+                delete_all_file_by_prefix(batch_output);
+                reply_to_client(job.sock, "Stream job of " + sdfs_dest + " stopped after " + to_string(batch) +
+                                          " batches!");
+                return;
+            }
+        }
+        schedule_next = true;
+
+        /// The batch runs the normal maple and juice of the job in incremental mode, as stages without a client.
+        auto run_stage = [this, &job](const string &stage_command) {
+            MapleJuiceJob stage = job;
+            stage.command = stage_command;
+            stage.sock = -1;
+            stage.recorded_missions.clear();
+            if (stage_command.compare(0, 6, "maple ") == 0) handle_maple_query(stage);
+            else handle_juice_query(stage);
+        };
+
+        /// Map only the source files added since the previous batch, the manifest of the intermediate prefix
+        /// remembers the mapped ones, so old data is never mapped again.
+        IncrementalManifest manifest = load_manifest(sdfs_prefix);
+        int num_new_files = 0;
+        for (const auto &file : check_all_exist_file_by_prefix(sdfs_src))
+            if (manifest.mapped_files.find(file) == manifest.mapped_files.end()) num_new_files++;
+        string workers = to_string(num_workers);
+        if (num_new_files > 0)
+            run_stage("maple " + maple_exe + " " + workers + " " + sdfs_prefix + " " + sdfs_src + " incremental=1");
+
+        /// Reduce the maple missions not reduced by a previous batch into the partial aggregate of this batch, and
+        /// delete their intermediate files. The manifest keeps the first mission not reduced yet for batch_output,
+        /// so missions of a failed batch are reduced by the next one.
+        delete_all_file_by_prefix(batch_output);
+        run_stage("juice " + juice_exe + " " + workers + " " + sdfs_prefix + " " + batch_output + " 1 1");
+        string batch_file = stream_window_filename(sdfs_dest, batch);
+        bool has_batch = check_file_exist(batch_output) != "-1";
+        if (has_batch) {
+            sdfs_write_text(batch_file, sdfs_read_text(batch_output));
+            delete_all_file_by_prefix(batch_output);
+        }
+
+        /// Emit the aggregate of the window by running the juice_exe over the partial aggregates of its batches, so
+        /// like incremental juice, a stream job requires a juice_exe whose output lines are valid input of itself.
+        /// A window of 0 batches aggregates the whole stream, merging the new batch into the previous result.
+        vector<string> inputs;
+        if (window_batches == 0) {
+            if (has_batch && check_file_exist(sdfs_dest) != "-1") inputs.push_back(sdfs_dest);
+            if (has_batch) inputs.push_back(batch_file);
+        } else {
+            for (int i = max(0, batch - window_batches + 1); i <= batch; i++)
+                if (check_file_exist(stream_window_filename(sdfs_dest, i)) != "-1")
+                    inputs.push_back(stream_window_filename(sdfs_dest, i));
+        }
+        if (window_batches > 0 || has_batch) {
+            string local_inputs, sys_command;
+            for (const auto &input : inputs) {
+                string local_input = input + ".stream_input";
+                get_query_sender(input, local_input, check_file_exist(input));
+                local_inputs += " files/fetched/" + local_input;
+            }
+            string local_output = "files/fetched/" + sdfs_dest + ".stream_result";
+            if (inputs.empty()) {
+                sys_command = "touch " + local_output;
+            } else if (is_builtin_juice(juice_exe)) {
+                vector<string> input_paths;
+                for (const auto &input : inputs) input_paths.push_back("files/fetched/" + input + ".stream_input");
+                ofstream result_ofs(local_output);
+                bool success = run_builtin_juice(juice_exe, input_paths, result_ofs);
+                result_ofs.close();
+                if (!success)
+                    throw runtime_error("Built-in juice failed on the window!");
+                sys_command = "sort -o " + local_output + " " + local_output;
+            } else {
+                get_query_sender(juice_exe, juice_exe, check_file_exist(juice_exe));
+                sys_command = "chmod +x files/fetched/" + juice_exe;
+                system(sys_command.c_str());
+                sys_command = "cat" + local_inputs + " | files/fetched/" + juice_exe + " | sort > " + local_output;
+            }
+            system(sys_command.c_str());
+            maple_juice_put(curr_dir + "/" + local_output, sdfs_dest);
+            sys_command = "rm -f " + local_output + local_inputs;
+            system(sys_command.c_str());
+        }
+
+        /// Drop the partial aggregate leaving the window, a window of 0 batches has merged it already.
+        if (window_batches == 0 && has_batch) delete_all_file_by_prefix(batch_file);
+        if (window_batches > 0 && batch >= window_batches)
+            delete_all_file_by_prefix(stream_window_filename(sdfs_dest, batch - window_batches));
+
+        reply_to_client(job.sock, "Stream job: (" + command + ") emitted batch " + to_string(batch) + " with " +
+                                  to_string(num_new_files) + " new files, next batch in " + interval_seconds +
+                                  " s, stop it with stream_stop " + sdfs_dest + "!");
+    } catch (runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        reply_to_client(job.sock, e.what());
+    }
+
+    /// Queue the next batch one interval after this one was due, it waits in the queue and lets other jobs run.
+    if (schedule_next) {
+        uint64_t due_time = job.start_after > 0 ? job.start_after : start_time;
+        string next_command = "stream " + maple_exe + " " + juice_exe + " " + to_string(num_workers) + " " +
+                              interval_seconds + " " + to_string(window_batches) + " " + sdfs_src + " " + sdfs_dest +
+                              " batch=" + to_string(batch + 1) + " at=" +
+                              to_string(due_time + (uint64_t) (atof(interval_seconds.c_str()) * 1000));
+        enqueue_maple_juice_job(next_command, -1, job.user, job.priority);
+    }
+}
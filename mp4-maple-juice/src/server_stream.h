@@ -0,0 +1,34 @@
+/**
+ * server_stream.h
+ * Define streaming micro batch contents used in server.
+ */
+
+#ifndef SERVER_STREAM_H
+#define SERVER_STREAM_H
+
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+
+/// Suffix of the sdfs intermediate filename prefix a stream job maps its source files into.
+#define STREAM_INTERMEDIATE_SUFFIX ".stream_mapped"
+
+/// Infix of the partial aggregate of each micro batch, followed by the zero padded batch number.
+#define STREAM_WINDOW_INFIX ".stream_window_"
+
+/// Suffix of the sdfs file asking a stream job to stop at its next micro batch.
+#define STREAM_STOP_SUFFIX ".stream_stop"
+
+/**
+ * The timestamp before which a queued micro batch of a stream job must not start, given by its "at=" option.
+ *
+ * Returns:
+ *      Return 0 for any other job.
+ */
+inline uint64_t parse_stream_start_after(const std::string &command) {
+    if (command.compare(0, 7, "stream ") != 0) return 0;
+    size_t pos = command.find(" at=");
+    return pos == std::string::npos ? 0 : strtoull(command.c_str() + pos + 4, nullptr, 10);
+}
+
+#endif //SERVER_STREAM_H